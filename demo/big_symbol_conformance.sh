@@ -0,0 +1,31 @@
+#!/bin/bash
+
+# Checks use_elf_symtab against plain llvm-symbolizer on big-symbol.cpp,
+# whose C1..C4 chain and recursive templates make deep inlined stacks.
+#
+#   big_symbol_conformance.sh path/to/symtab-conformance [llvm-symbolizer]
+#
+# Runs on the prebuilt demo binaries, and on big-symbol.cpp built again
+# with $CXX at -O1 and -O2, with DWARF 4 and 5.
+
+set -euo pipefail
+
+DIR_CUR="$( cd -- "$(dirname "$0")" >/dev/null 2>&1 ; pwd -P )" #https://stackoverflow.com/a/4774063
+TOOL=$1
+SYMBOLIZER=${2:-/usr/bin/llvm-symbolizer}
+CXX=${CXX:-g++}
+
+DIR_TMP=`mktemp -d`
+trap 'rm -rf "$DIR_TMP"' EXIT
+
+for OPT in -O1 -O2; do
+  for DW in 4 5; do
+    $CXX $OPT -g -gdwarf-$DW $DIR_CUR/big-symbol.cpp -o $DIR_TMP/big-symbol$OPT-dwarf$DW.bin
+  done
+done
+
+$TOOL -s $SYMBOLIZER \
+        $DIR_CUR/big-symbol-elf-dbg1-pie1.bin \
+        $DIR_CUR/big-symbol-elf-dbg1-pie0.bin \
+        $DIR_CUR/bug-san0-dbg0-64.bin \
+        $DIR_TMP/*.bin
@@ -13,7 +13,24 @@ $CXX $COMMON_FLAG -c $DIR_LIB/interface.cpp           -o $DIR_CUR/demo-interface
 $CXX $COMMON_FLAG -c $DIR_LIB/common.cpp              -o $DIR_CUR/demo-common-tmp.o
 $CXX $COMMON_FLAG -c $DIR_LIB/symbolizer.cpp          -o $DIR_CUR/demo-symbolizer-tmp.o
 $CXX $COMMON_FLAG -c $DIR_LIB/use_llvm_symbolizer.cpp -o $DIR_CUR/demo-llvm-tmp.o
+$CXX $COMMON_FLAG -c $DIR_LIB/use_llvm_library.cpp    -o $DIR_CUR/demo-llvmlib-tmp.o
 $CXX $COMMON_FLAG -c $DIR_LIB/use_addr2line.cpp       -o $DIR_CUR/demo-ad2l-tmp.o
+$CXX $COMMON_FLAG -c $DIR_LIB/cached_symbolizer.cpp   -o $DIR_CUR/demo-cache-tmp.o
+$CXX $COMMON_FLAG -c $DIR_LIB/address_index.cpp       -o $DIR_CUR/demo-addridx-tmp.o
+$CXX $COMMON_FLAG -c $DIR_LIB/elf_file.cpp            -o $DIR_CUR/demo-elf-tmp.o
+$CXX $COMMON_FLAG -c $DIR_LIB/debug_file.cpp          -o $DIR_CUR/demo-debug-tmp.o
+$CXX $COMMON_FLAG -c $DIR_LIB/demangle.cpp            -o $DIR_CUR/demo-demangle-tmp.o
+$CXX $COMMON_FLAG -c $DIR_LIB/disk_cache.cpp          -o $DIR_CUR/demo-disk-tmp.o
+$CXX $COMMON_FLAG -c $DIR_LIB/in_process_symbolizer.cpp -o $DIR_CUR/demo-inproc-tmp.o
+$CXX $COMMON_FLAG -c $DIR_LIB/elf_symbolizer.cpp      -o $DIR_CUR/demo-elfsym-tmp.o
+$CXX $COMMON_FLAG -c $DIR_LIB/dwarf.cpp               -o $DIR_CUR/demo-dwarf-tmp.o
+$CXX $COMMON_FLAG -c $DIR_LIB/dwarf_line.cpp          -o $DIR_CUR/demo-dwline-tmp.o
+$CXX $COMMON_FLAG -c $DIR_LIB/dwarf_inline.cpp        -o $DIR_CUR/demo-dwinl-tmp.o
+$CXX $COMMON_FLAG -c $DIR_LIB/gsym_file.cpp           -o $DIR_CUR/demo-gsym-tmp.o
+$CXX $COMMON_FLAG -c $DIR_LIB/gsym_symbolizer.cpp     -o $DIR_CUR/demo-gsymsym-tmp.o
+$CXX $COMMON_FLAG -c $DIR_LIB/symbol_index.cpp        -o $DIR_CUR/demo-index-tmp.o
+$CXX $COMMON_FLAG -c $DIR_LIB/index_symbolizer.cpp    -o $DIR_CUR/demo-indexsym-tmp.o
+$CXX $COMMON_FLAG -c $DIR_LIB/symbolizer_service.cpp  -o $DIR_CUR/demo-service-tmp.o
 
 $CXX $COMMON_FLAG \
         $DIR_CUR/demo-main-tmp.o \
@@ -21,8 +38,25 @@ $CXX $COMMON_FLAG \
         $DIR_CUR/demo-common-tmp.o \
         $DIR_CUR/demo-symbolizer-tmp.o \
         $DIR_CUR/demo-llvm-tmp.o \
+        $DIR_CUR/demo-llvmlib-tmp.o \
         $DIR_CUR/demo-ad2l-tmp.o \
--o $DIR_CUR/simple_demo
+        $DIR_CUR/demo-cache-tmp.o \
+        $DIR_CUR/demo-addridx-tmp.o \
+        $DIR_CUR/demo-elf-tmp.o \
+        $DIR_CUR/demo-debug-tmp.o \
+        $DIR_CUR/demo-demangle-tmp.o \
+        $DIR_CUR/demo-disk-tmp.o \
+        $DIR_CUR/demo-inproc-tmp.o \
+        $DIR_CUR/demo-elfsym-tmp.o \
+        $DIR_CUR/demo-dwarf-tmp.o \
+        $DIR_CUR/demo-dwline-tmp.o \
+        $DIR_CUR/demo-dwinl-tmp.o \
+        $DIR_CUR/demo-gsym-tmp.o \
+        $DIR_CUR/demo-gsymsym-tmp.o \
+        $DIR_CUR/demo-index-tmp.o \
+        $DIR_CUR/demo-indexsym-tmp.o \
+        $DIR_CUR/demo-service-tmp.o \
+-pthread -o $DIR_CUR/simple_demo
 
 rm -f $DIR_CUR/demo-*-tmp.o
 
@@ -20,7 +20,8 @@ extern "C" {
 
 /**
  * Init all stuffs.
- * Will init all global buf and object pointers.
+ * Will init all buf and object pointers of the default
+ * context, which the functions without a handle use.
  * If not succeed, they will be all nullptr.
  * 
  * @param external_symbolizer_path
@@ -32,11 +33,156 @@ extern "C" {
 */
 int SanSymTool_init(const char * external_symbolizer_path);
 
+/**
+ * Options for SanSymTool_init_ex.
+ * Zero-initialize it and then set what you need,
+ * since a zero field always means the default.
+*/
+struct SanSymTool_options {
+  /**
+   * Number of llvm-symbolizer subprocesses run as a pool.
+   * Batched requests are split across all of them, so bulk
+   * symbolizing scales with cores. A single request goes to
+   * the subprocess picked by the module name.
+   * 0 means 1. Ignored by addr2line.
+  */
+  unsigned int n_shards;
+  /**
+   * Nonzero to launch symbolizer subprocesses with
+   * posix_spawn instead of fork. It avoids copying
+   * page tables of a large host process, but fds
+   * not marked close-on-exec may leak into the
+   * subprocess before glibc 2.34.
+  */
+  int use_posix_spawn;
+  /**
+   * Milliseconds to wait for each answer from the
+   * symbolizer. If it's exceeded, the request fails
+   * with err_timeout and the symbolizer is restarted
+   * for the following requests. 0 means no limit.
+   * Completion-based requests are not affected.
+  */
+  unsigned int timeout_ms;
+  /**
+   * Bytes of memory for caching results in process,
+   * so a request seen before never reaches the
+   * symbolizer. Least recently used results are
+   * dropped first. 0 disables the cache.
+  */
+  unsigned long cache_size;
+  /**
+   * Directory of files keeping results across runs,
+   * one for each module named by its build-id, or by
+   * its size, mtime and inode without one, and by the
+   * symbolizer, its binary and debug_file_dir. So a
+   * rebuilt module never gets stale results, nor ones
+   * of another symbolizer. Results with neither a
+   * name nor a file aren't kept. Files are replaced
+   * atomically and never modified in place, so many
+   * processes can share the directory. Symbolizers
+   * are started only when a result is missing.
+   * New results are written out by SanSymTool_fini
+   * at the latest. With use_elf_symtab, compressed
+   * DWARF sections are also kept here once inflated.
+   * 0 disables it.
+  */
+  const char * cache_dir;
+  /**
+   * Nonzero to look up function and object names in
+   * ELF symbol tables in process first, which is
+   * much faster than asking the symbolizer. For code,
+   * file, line and column come from .debug_line of
+   * the module if there is one, and inlined frames
+   * from its .debug_info, giving the same frames as
+   * llvm-symbolizer does. Offsets not covered by any
+   * symbol are still passed on to the symbolizer.
+   * Stripped modules have them read from their
+   * separate debug files, see debug_file_dir.
+   * Compressed DWARF (-gz) is inflated on first use
+   * if the library is built with zlib or zstd.
+  */
+  int use_elf_symtab;
+  /**
+   * Nonzero to symbolize with LLVM's Symbolize library
+   * in process instead of running llvm-symbolizer, so
+   * external_symbolizer_path can be 0. Results are the
+   * same as from llvm-symbolizer of the LLVM linked in.
+   * It needs the library built with cmake option
+   * -DSANSYMTOOL_LLVM_SYMBOLIZE=ON, otherwise
+   * SanSymTool_init_ex returns err_unsupported_tool.
+   * n_shards, use_posix_spawn and timeout_ms are
+   * ignored then.
+  */
+  int use_llvm_library;
+  /**
+   * Nonzero to answer code requests from GSYM files
+   * made by llvm-gsymutil, before anything else but
+   * index files. For each module, "<module>.gsym" is
+   * looked for, and then the file of that name in
+   * gsym_dir. Lookups cost a binary search and
+   * decoding one function, without reading any DWARF,
+   * but columns are 0. Modules without a GSYM file,
+   * and data requests, go on to the other ways
+   * enabled.
+  */
+  int use_gsym;
+  /**
+   * Directory of GSYM files. Can be 0 to only look
+   * for them next to the modules.
+  */
+  const char * gsym_dir;
+  /**
+   * Nonzero to answer requests from index files made
+   * by tools/sansymtool-index, before anything else.
+   * For each module, "<module>.ssti" is looked for, and
+   * then the file of that name in index_dir. An index
+   * holds every answer a symbolizer gave for a module,
+   * so a lookup is a binary search in the mapped file.
+   * An index made from another build of the module is
+   * ignored. Modules without an index go on to the
+   * other ways enabled.
+  */
+  int use_index;
+  /**
+   * Directory of index files. Can be 0 to only look
+   * for them next to the modules.
+  */
+  const char * index_dir;
+  /**
+   * Directory of separate debug files, for modules
+   * stripped of their symbols or DWARF. As in gdb, the
+   * one of a module is looked for by its build-id in
+   * "<dir>/.build-id/xx/yyyy.debug", then by the name
+   * in its .gnu_debuglink next to it, in ".debug"
+   * there, and in this directory under the one of the
+   * module. It's only taken if its build-id or CRC
+   * matches. Used by use_elf_symtab and by
+   * use_llvm_library. Can be 0 for /usr/lib/debug.
+  */
+  const char * debug_file_dir;
+  /**
+   * Nonzero to get C++ names demangled, until it's
+   * changed by SanSymTool_set_demangle. 0 gives them
+   * as they are in the module, e.g. _Z3bazv for baz().
+  */
+  int demangle;
+};
+
+/**
+ * Same as SanSymTool_init, with extra options.
+ * 
+ * @param opts Can be 0 to use all the defaults,
+ * which is what SanSymTool_init does.
+ * @return Defined by enum RetCode in lib/interface.cpp
+*/
+int SanSymTool_init_ex(const char * external_symbolizer_path, const struct SanSymTool_options * opts);
+
 /**
  * Destroy all stuffs to clean up.
  * Will stop symbolizer subprocess, call
  * SanSymTool_*_free, free all allocated
- * global pointers and set them to nullptr.
+ * pointers of the default context and set
+ * them to nullptr.
  * If some of them are already nullptr,
  * it will just jmp over.
 */
@@ -84,25 +230,91 @@ int SanSymTool_addr_read(unsigned long idx, char **file, char **function, unsign
  * Free the internal allocated memory because of
  * symbolizing executable code.
  * 
- * @attention After calling this, the pointers returned
- * by SanSymTool_addr_read before should not be touched 
- * anymore. Otherwise it's *Use-After-Free*. 
- * 
- * @warning This can only free the *latest* allocated memory.
- * The allocation happens when you call SanSymTool_addr_send, and
- * the allocated ones then can be accessed by SanSymTool_addr_read.
- * That is to say, if you don't use SanSymTool_addr_free 
- * between two calls of SanSymTool_addr_read, the pointers 
- * received from SanSymTool_addr_read between the two call
- * will be the ONLY way to touch the memory. If the pointers
- * are not held, there will be *Memory-Leaks*.
- * Besides, calling free on these pointers manually is a dirty idea.
- * So you must:
- * (1) Make a safe copy of strings from the allocated memory in your way.
- * (2) Call this before the next call of SanSymTool_addr_send.
+ * @attention Strings received by SanSymTool_addr_read are
+ * interned: each distinct file or name is kept once and stays
+ * valid until SanSymTool_fini, whatever is freed in between.
+ * Equal strings are the same pointer, so results can be
+ * deduplicated by pointer. They are shared, so never write
+ * to them or call free on them.
+ * 
+ * @warning This frees the table of results filled by
+ * SanSymTool_addr_send, which grows until it's called.
+ * So you must call this before the next call of
+ * SanSymTool_addr_send, and keep no index from before.
 */
 void SanSymTool_addr_free(void);
 
+/**
+ * Send a batch of requests to symbolize the addresses
+ * in the same module as executable code.
+ * 
+ * All the requests are pipelined through the symbolizer
+ * instead of waiting for each response in turn, which
+ * saves lots of round trips for a large batch.
+ * 
+ * The frames of all the offsets are put into one result
+ * table in order, i.e. frames of offsets[0] come first,
+ * then frames of offsets[1], and so on. Read them with
+ * SanSymTool_addr_read, with idx running across the whole
+ * batch, and free them all with SanSymTool_addr_free.
+ * 
+ * @param module The name/path of target binary.
+ * @param offsets Array of offsets in virtual memory before relocating.
+ * @param n Number of entries in offsets.
+ * @param n_frames Array of n entries to receive number of
+ * the frames for each offset. If the return value indicates
+ * it's failed, it will not be touched and nothing is put
+ * into the result table.
+ * @return Defined by enum RetCode in lib/interface.cpp
+*/
+int SanSymTool_addr_send_batch(char *module, const unsigned int *offsets, unsigned long n, unsigned long *n_frames);
+
+/**
+ * A PC of a stack for SanSymTool_stack_symbolize.
+*/
+struct SanSymTool_pc {
+  /** The name/path of the binary the PC is in. */
+  char *module;
+  /** Offset in virtual memory before relocating. */
+  unsigned int offset;
+};
+
+/**
+ * Symbolize all the PCs of a stack as executable code
+ * at once, e.g. a backtrace of a crash.
+ * 
+ * The PCs can be in different modules. They are grouped
+ * by module and sent as one pipelined batch, like
+ * SanSymTool_addr_send_batch does for a single module.
+ * 
+ * The frames of all the PCs are put into the result table
+ * in the order of the stack, inlined frames first as usual.
+ * Read them with SanSymTool_addr_read and free them all
+ * with SanSymTool_addr_free. If the symbolizer fails on
+ * some of the modules, e.g. one that can't be read, PCs in
+ * them get no frames, while the others are still given.
+ * If it times out, the whole stack fails with err_timeout.
+ * 
+ * @param pcs Array of the PCs, the top of the stack first.
+ * @param n Number of entries in pcs.
+ * @param first_frames Array of n+1 entries to receive the
+ * idx of the first frame of each PC, and lastly the idx
+ * past the last frame. So frames of pcs[i] are read with idx
+ * from first_frames[i] to first_frames[i+1]-1, and there are
+ * first_frames[i+1]-first_frames[i] of them. If the return
+ * value indicates it's failed for all the modules, it will
+ * not be touched and nothing is put into the result table.
+ * @param hash_frames Number of frames from the top, inlined
+ * ones included, to hash into *hash.
+ * @param hash Can be 0. Receive a hash of the top hash_frames
+ * frames for deduplicating stacks. It takes the mangled name
+ * of each frame, or the module file name if there is none,
+ * and no offset, file or line. So it stays the same across
+ * processes, builds moving code around, and demangle settings.
+ * @return Defined by enum RetCode in lib/interface.cpp
+*/
+int SanSymTool_stack_symbolize(const struct SanSymTool_pc *pcs, unsigned long n, unsigned long *first_frames, unsigned long hash_frames, unsigned long long *hash);
+
 /**
  * Send a request to symbolize the address
  * as as data.
@@ -148,25 +360,264 @@ int SanSymTool_data_read(char **file, char **name, unsigned long *line, unsigned
  * Free the internal allocated memory
  * because of symbolizing data.
  * 
- * @attention After calling this, the pointers returned
- * by SanSymTool_data_read before should not be touched
- * anymore. Otherwise it's *Use-After-Free*. 
- * 
- * @warning This can only free the *latest* allocated memory.
- * The allocation happens when you call SanSymTool_data_send, and
- * the allocated ones then can be accessed by SanSymTool_data_read.
- * That is to say, if you don't use SanSymTool_data_free 
- * between two calls of SanSymTool_data_read, the pointers 
- * received from SanSymTool_data_read between the two call
- * will be the ONLY way to touch the memory. If the pointers
- * are not held, there will be *Memory-Leaks*.
- * Besides, calling free on these pointers manually is a dirty idea.
- * So you must:
- * (1) Make a safe copy of strings from the allocated memory in your way.
- * (2) Call this before the next call of SanSymTool_data_send.
+ * @attention Strings received by SanSymTool_data_read are
+ * interned: each distinct file or name is kept once and stays
+ * valid until SanSymTool_fini, whatever is freed in between.
+ * Equal strings are the same pointer, so results can be
+ * deduplicated by pointer. They are shared, so never write
+ * to them or call free on them.
+ * 
+ * @warning This frees the table of results filled by
+ * SanSymTool_data_send, which grows until it's called.
+ * So you must call this before the next call of
+ * SanSymTool_data_send, and keep no index from before.
 */
 void SanSymTool_data_free(void);
 
+/**
+ * Send a batch of requests to symbolize the
+ * addresses in the same module as data.
+ * 
+ * Like SanSymTool_addr_send_batch, the requests are
+ * pipelined through the symbolizer. The result of offsets[i]
+ * can be read by SanSymTool_data_read_at with idx i, and all
+ * the results are freed by SanSymTool_data_free.
+ * 
+ * @param module The name/path of target binary.
+ * @param offsets Array of offsets in virtual memory before relocating.
+ * @param n Number of entries in offsets.
+ * @return Defined by enum RetCode in lib/interface.cpp
+*/
+int SanSymTool_data_send_batch(char *module, const unsigned int *offsets, unsigned long n);
+
+/**
+ * Read the idx-th symbolizing result of data
+ * after the last batch of requests sent out.
+ * 
+ * @note SanSymTool_data_read is the same as calling this with idx 0.
+ * Other params are the same as SanSymTool_data_read as well.
+ * 
+ * @param idx Index of the offset in the batch.
+ * Can't be greater than (n-1).
+*/
+int SanSymTool_data_read_at(unsigned long idx, char **file, char **name, unsigned long *line, unsigned long *start, unsigned long *size);
+
+/**
+ * Get an fd for watching completion-based requests
+ * in your own event loop, e.g. by poll or epoll.
+ * It stays readable while SanSymTool_async_poll may
+ * have something to hand back. Don't read or close it.
+ * 
+ * @note Only available with llvm-symbolizer on Linux.
+ * Completion-based requests still work without it,
+ * just call SanSymTool_async_poll from time to time.
+ * 
+ * @return The fd, or -1 if not available.
+*/
+int SanSymTool_async_fd(void);
+
+/**
+ * Submit a request to symbolize the address
+ * as executable code, without waiting for it.
+ * 
+ * The request is handled by a dedicated symbolizer
+ * subprocess, and SanSymTool_async_poll hands back
+ * the result later.
+ * 
+ * @attention Currently only llvm-symbolizer is supported.
+ * 
+ * @param module The name/path of target binary.
+ * @param offset Offset in virtual memory before relocating.
+ * @param ticket Receive the ticket identifying this request.
+ * @return Defined by enum RetCode in lib/interface.cpp
+*/
+int SanSymTool_addr_submit(char *module, unsigned int offset, unsigned long *ticket);
+
+/**
+ * Submit a request to symbolize the address
+ * as data, without waiting for it.
+ * Works like SanSymTool_addr_submit.
+*/
+int SanSymTool_data_submit(char *module, unsigned int offset, unsigned long *ticket);
+
+/**
+ * Take one finished request submitted before,
+ * if there is any. It never blocks.
+ * 
+ * A finished code request puts its frames into the
+ * result table as if SanSymTool_addr_send was called,
+ * and a finished data request is readable by
+ * SanSymTool_data_read as if SanSymTool_data_send was
+ * called. So read and free them in the same way
+ * before polling the next one.
+ * 
+ * @param ticket Receive the ticket of the finished request.
+ * It's also set when the request failed.
+ * @param is_data Receive 1 for a data request, 0 for code.
+ * @param n_frames Receive number of the frames
+ * of a finished code request.
+ * @return Defined by enum RetCode in lib/interface.cpp,
+ * err_not_ready if nothing has finished yet.
+*/
+int SanSymTool_async_poll(unsigned long *ticket, int *is_data, unsigned long *n_frames);
+
+/**
+ * Choose whether names of the requests sent or polled
+ * from now on are demangled, e.g. _Z3bazv becomes baz(),
+ * whilst the non-mangled name foz is given as is.
+ * 
+ * Symbolizers are always asked for mangled names, and
+ * names are demangled in process when they are read
+ * out, so it can be changed before any request without
+ * restarting anything. Each name is demangled once,
+ * and looked up afterwards. Names are demangled like
+ * llvm-symbolizer --demangle does if the library is
+ * built with -DSANSYMTOOL_LLVM_SYMBOLIZE=ON, or by
+ * __cxa_demangle of the C++ runtime otherwise.
+ * 
+ * @param demangle Nonzero to demangle.
+*/
+void SanSymTool_set_demangle(int demangle);
+
+/**
+ * Get counters of the result cache enabled
+ * by SanSymTool_options.cache_size.
+ * 
+ * @param hits Receive number of requests served from the cache.
+ * @param misses Receive number of requests sent to the symbolizer.
+ * @param size Receive bytes currently taken by the cache.
+ * @return Defined by enum RetCode in lib/interface.cpp,
+ * err_unsupported_tool if the cache isn't enabled.
+*/
+int SanSymTool_cache_stats(unsigned long *hits, unsigned long *misses, unsigned long *size);
+
+/**
+ * Handle of a symbolizer context.
+ * 
+ * All the functions above work on a default context, so
+ * they must be called from one thread at a time. A context
+ * made by SanSymTool_ctx_create is independent of the default
+ * one and of all the other contexts: it runs its own symbolizer
+ * (which can be a different one from the others, e.g. addr2line
+ * beside llvm-symbolizer) and has its own results, cache and
+ * tickets. So different contexts can be used on different
+ * threads at the same time, e.g. one per worker thread, while
+ * one context must still be used by one thread at a time.
+ * 
+ * Each SanSymTool_ctx_* function works like the one named
+ * without "ctx_" above, but on the given context. If the
+ * handle is 0, they return err_has_nullptr (-1 for
+ * SanSymTool_ctx_async_fd), or do nothing.
+*/
+typedef struct SanSymTool_ctx SanSymTool_ctx;
+
+/**
+ * Make a new context, like SanSymTool_init_ex does for
+ * the default one.
+ * 
+ * @param external_symbolizer_path Same as SanSymTool_init_ex.
+ * @param opts Same as SanSymTool_init_ex.
+ * @param ctx Receive the handle, or 0 if it's failed.
+ * @return Defined by enum RetCode in lib/interface.cpp
+*/
+int SanSymTool_ctx_create(const char * external_symbolizer_path, const struct SanSymTool_options * opts, SanSymTool_ctx ** ctx);
+
+/**
+ * Destroy a context made by SanSymTool_ctx_create,
+ * like SanSymTool_fini does for the default one.
+ * The handle can't be used anymore afterwards.
+*/
+void SanSymTool_ctx_destroy(SanSymTool_ctx * ctx);
+
+int SanSymTool_ctx_addr_send(SanSymTool_ctx * ctx, char *module, unsigned int offset, unsigned long *n_frames);
+int SanSymTool_ctx_addr_read(SanSymTool_ctx * ctx, unsigned long idx, char **file, char **function, unsigned long *line, unsigned long *column);
+void SanSymTool_ctx_addr_free(SanSymTool_ctx * ctx);
+int SanSymTool_ctx_addr_send_batch(SanSymTool_ctx * ctx, char *module, const unsigned int *offsets, unsigned long n, unsigned long *n_frames);
+int SanSymTool_ctx_stack_symbolize(SanSymTool_ctx * ctx, const struct SanSymTool_pc *pcs, unsigned long n, unsigned long *first_frames, unsigned long hash_frames, unsigned long long *hash);
+
+int SanSymTool_ctx_data_send(SanSymTool_ctx * ctx, char *module, unsigned int offset);
+int SanSymTool_ctx_data_read(SanSymTool_ctx * ctx, char **file, char **name, unsigned long *line, unsigned long *start, unsigned long *size);
+void SanSymTool_ctx_data_free(SanSymTool_ctx * ctx);
+int SanSymTool_ctx_data_send_batch(SanSymTool_ctx * ctx, char *module, const unsigned int *offsets, unsigned long n);
+int SanSymTool_ctx_data_read_at(SanSymTool_ctx * ctx, unsigned long idx, char **file, char **name, unsigned long *line, unsigned long *start, unsigned long *size);
+
+int SanSymTool_ctx_async_fd(SanSymTool_ctx * ctx);
+int SanSymTool_ctx_addr_submit(SanSymTool_ctx * ctx, char *module, unsigned int offset, unsigned long *ticket);
+int SanSymTool_ctx_data_submit(SanSymTool_ctx * ctx, char *module, unsigned int offset, unsigned long *ticket);
+int SanSymTool_ctx_async_poll(SanSymTool_ctx * ctx, unsigned long *ticket, int *is_data, unsigned long *n_frames);
+
+void SanSymTool_ctx_set_demangle(SanSymTool_ctx * ctx, int demangle);
+int SanSymTool_ctx_cache_stats(SanSymTool_ctx * ctx, unsigned long *hits, unsigned long *misses, unsigned long *size);
+
+/**
+ * Handle of a symbolizer service.
+ * 
+ * A service is one symbolizer shared by any number of threads,
+ * which can all call it at the same time. Each call puts its
+ * request on a lock-free queue and waits for it, so callers
+ * never wait for each other. A thread of the service takes all
+ * the requests queued while it was busy and sends them to the
+ * symbolizer as one batch, so the more callers there are, the
+ * fewer round trips each request costs.
+ * 
+ * Results of a service are interned like those of a context,
+ * and stay valid until SanSymTool_service_destroy. There is
+ * nothing to free after each call.
+*/
+typedef struct SanSymTool_service SanSymTool_service;
+
+/**
+ * A frame of the results of SanSymTool_service_addr.
+ * Both strings can be 0 for unknown names, like those
+ * read by SanSymTool_addr_read. Never write to them.
+*/
+struct SanSymTool_frame {
+  char *file;
+  char *function;
+  unsigned long line;
+  unsigned long column;
+};
+
+/**
+ * Make a new service and start its thread.
+ * 
+ * @param external_symbolizer_path Same as SanSymTool_init_ex.
+ * @param opts Same as SanSymTool_init_ex. Demangling is chosen
+ * by its demangle field once and for all.
+ * @param svc Receive the handle, or 0 if it's failed.
+ * @return Defined by enum RetCode in lib/interface.cpp
+*/
+int SanSymTool_service_create(const char * external_symbolizer_path, const struct SanSymTool_options * opts, SanSymTool_service ** svc);
+
+/**
+ * Stop the thread of a service and destroy it.
+ * No call on it may be in progress or made afterwards.
+*/
+void SanSymTool_service_destroy(SanSymTool_service * svc);
+
+/**
+ * Symbolize the address as executable code, from any thread.
+ * Blocks until the result is ready.
+ * 
+ * @param frames Receive the first max_frames frames.
+ * @param max_frames Number of entries in frames, can be 0.
+ * @param n_frames Receive the number of all the frames,
+ * which can be more than max_frames.
+ * @return Defined by enum RetCode in lib/interface.cpp,
+ * yes_send_done on success.
+*/
+int SanSymTool_service_addr(SanSymTool_service * svc, char *module, unsigned int offset, struct SanSymTool_frame *frames, unsigned long max_frames, unsigned long *n_frames);
+
+/**
+ * Symbolize the address as data, from any thread.
+ * Blocks until the result is ready. The results are
+ * the same as those of SanSymTool_data_read.
+ * 
+ * @return Defined by enum RetCode in lib/interface.cpp,
+ * yes_send_done on success.
+*/
+int SanSymTool_service_data(SanSymTool_service * svc, char *module, unsigned int offset, char **file, char **name, unsigned long *line, unsigned long *start, unsigned long *size);
+
 #ifdef __cplusplus
 }  // extern "C"
 #endif
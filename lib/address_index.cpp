@@ -0,0 +1,175 @@
+//===-- address_index.cpp -------------------------------------------------===//
+//
+// Based on the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file gives implementation of the address search index.
+//===----------------------------------------------------------------------===//
+
+#include "address_index.h"
+
+#include <cstdlib>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SANSYMTOOL_X86 1
+#include <immintrin.h>
+#else
+#define SANSYMTOOL_X86 0
+#endif
+
+namespace SANSYMTOOL_NS
+{
+
+// Keys in a node, which is a cache line of them.
+static const uptr kNodeKeys = 8;
+static const u64 kSignBit = 1ULL << 63;
+// What fills the last node, greater than any key but the flipped
+// ~0, which UpperBound doesn't search for.
+static const s64 kPaddingKey = (s64)(~0ULL ^ kSignBit);
+
+// Node |node| has its children at node * 9 + 1 to node * 9 + 9, the
+// one at node * 9 + 1 + i holding the keys between its keys i - 1
+// and i.
+static inline uptr Child(uptr node, uptr i) {
+  return node * (kNodeKeys + 1) + i + 1;
+}
+
+// Each search walks down from the root, keeping the first key above
+// |key| seen so far, which ends up being the first one in the table.
+// Returns its slot, or ~0 if there is none.
+typedef uptr (*SearchFn)(const s64 *keys, uptr n_nodes, s64 key);
+
+static uptr SearchScalar(const s64 *keys, uptr n_nodes, s64 key) {
+  uptr found = ~(uptr)0;
+  for (uptr node = 0; node < n_nodes;) {
+    const s64 *node_keys = keys + node * kNodeKeys;
+    uptr i = 0;
+    for (uptr j = 0; j < kNodeKeys; ++j)
+      i += node_keys[j] <= key;
+    if (i < kNodeKeys)
+      found = node * kNodeKeys + i;
+    node = Child(node, i);
+  }
+  return found;
+}
+
+#if SANSYMTOOL_X86
+
+__attribute__((target("sse4.2")))
+static uptr SearchSse42(const s64 *keys, uptr n_nodes, s64 key) {
+  const __m128i key_x2 = _mm_set1_epi64x(key);
+  uptr found = ~(uptr)0;
+  for (uptr node = 0; node < n_nodes;) {
+    const __m128i *node_keys = (const __m128i *)(keys + node * kNodeKeys);
+    int above = 0;
+    for (int j = 0; j < 4; ++j) {
+      __m128i gt = _mm_cmpgt_epi64(_mm_load_si128(node_keys + j), key_x2);
+      above |= _mm_movemask_pd(_mm_castsi128_pd(gt)) << (2 * j);
+    }
+    // Keys are sorted, so those above |key| are the last ones.
+    uptr i = __builtin_ctz(above | (1 << kNodeKeys));
+    if (i < kNodeKeys)
+      found = node * kNodeKeys + i;
+    node = Child(node, i);
+  }
+  return found;
+}
+
+__attribute__((target("avx2")))
+static uptr SearchAvx2(const s64 *keys, uptr n_nodes, s64 key) {
+  const __m256i key_x4 = _mm256_set1_epi64x(key);
+  uptr found = ~(uptr)0;
+  for (uptr node = 0; node < n_nodes;) {
+    const __m256i *node_keys = (const __m256i *)(keys + node * kNodeKeys);
+    __m256i low = _mm256_cmpgt_epi64(_mm256_load_si256(node_keys), key_x4);
+    __m256i high =
+        _mm256_cmpgt_epi64(_mm256_load_si256(node_keys + 1), key_x4);
+    int above = _mm256_movemask_pd(_mm256_castsi256_pd(low)) |
+                _mm256_movemask_pd(_mm256_castsi256_pd(high)) << 4;
+    uptr i = __builtin_ctz(above | (1 << kNodeKeys));
+    if (i < kNodeKeys)
+      found = node * kNodeKeys + i;
+    node = Child(node, i);
+  }
+  return found;
+}
+
+#endif // SANSYMTOOL_X86
+
+static SearchFn ChooseSearch() {
+#if SANSYMTOOL_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return SearchAvx2;
+  if (__builtin_cpu_supports("sse4.2"))
+    return SearchSse42;
+#endif // SANSYMTOOL_X86
+  return SearchScalar;
+}
+
+// Chosen once at load time, so that indexes can be built and searched
+// from many threads.
+static const SearchFn search = ChooseSearch();
+
+AddressIndex::AddressIndex()
+    : keys_(nullptr), ranks_(nullptr), n_(0), n_nodes_(0) {}
+
+AddressIndex::~AddressIndex() { Clear(); }
+
+void AddressIndex::Clear() {
+  std::free(keys_);
+  std::free(ranks_);
+  keys_ = nullptr;
+  ranks_ = nullptr;
+  n_ = 0;
+  n_nodes_ = 0;
+}
+
+void AddressIndex::Build(const u64 *addresses, uptr n) {
+  Clear();
+  if (n == 0)
+    return;
+  CHECK_LE(n, (uptr)~0U);
+  n_ = n;
+  n_nodes_ = (n + kNodeKeys - 1) / kNodeKeys;
+  void *keys = nullptr;
+  if (posix_memalign(&keys, kNodeKeys * sizeof(s64),
+                     n_nodes_ * kNodeKeys * sizeof(s64)))
+    keys = nullptr;
+  keys_ = (s64 *)keys;
+  ranks_ = (u32 *)std::malloc(n_nodes_ * kNodeKeys * sizeof(u32));
+  CHECK(keys_ && ranks_);
+  uptr next = 0;
+  Fill(0, addresses, &next);
+}
+
+// Visits the slots in order, giving them the addresses one by one.
+void AddressIndex::Fill(uptr node, const u64 *addresses, uptr *next) {
+  if (node >= n_nodes_)
+    return;
+  for (uptr i = 0; i < kNodeKeys; ++i) {
+    Fill(Child(node, i), addresses, next);
+    uptr slot = node * kNodeKeys + i;
+    if (*next < n_) {
+      keys_[slot] = (s64)(addresses[*next] ^ kSignBit);
+      ranks_[slot] = (u32)*next;
+      ++*next;
+    } else {
+      keys_[slot] = kPaddingKey;
+      ranks_[slot] = (u32)n_;
+    }
+  }
+  Fill(Child(node, kNodeKeys), addresses, next);
+}
+
+uptr AddressIndex::UpperBound(u64 address) const {
+  if (n_ == 0 || address == ~0ULL)
+    return n_;
+  uptr slot = search(keys_, n_nodes_, (s64)(address ^ kSignBit));
+  return slot == ~(uptr)0 ? n_ : ranks_[slot];
+}
+
+} // namespace SANSYMTOOL_NS
@@ -0,0 +1,186 @@
+//===-- cached_symbolizer.cpp ---------------------------------------------===//
+//
+// Based on the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file gives implementation of the caching symbolizer tool.
+//===----------------------------------------------------------------------===//
+
+#include "cached_symbolizer.h"
+
+#include <cstdlib>
+#include <cstring>
+
+namespace SANSYMTOOL_NS
+{
+
+// What a cached string costs, with the allocator's own header.
+// Interned ones are shared, so they cost the cache nothing.
+static uptr StringCharge(StringTable *strings, const char *str) {
+  return str && !strings ? std::strlen(str) + 1 + 2 * sizeof(void *) : 0;
+}
+
+// Strings of results are kept as they are if |strings| interned them,
+// or copied otherwise.
+static char *KeepString(StringTable *strings, char *str) {
+  return str && !strings ? strdup(str) : str;
+}
+
+static void FreeFrames(StringTable *strings, std::vector<FrameDat> *frames) {
+  for (uptr i = 0; i < frames->size(); ++i) {
+    FreeResultString(strings, (*frames)[i].func);
+    FreeResultString(strings, (*frames)[i].file);
+  }
+  frames->clear();
+}
+
+// Gives a string kept by an entry to a result.
+static char *GiveString(StringTable *entry_strings, StringTable *strings,
+                        char *str) {
+  return strings && strings == entry_strings
+             ? str
+             : CopyResultString(strings, str);
+}
+
+uptr CachedSymbolizer::KeyHash::operator()(const Key &key) const {
+  // FNV-1a
+  u64 hash = 14695981039346656037ULL;
+  for (const char *p = key.module; *p; ++p)
+    hash = (hash ^ (u8)*p) * 1099511628211ULL;
+  hash = (hash ^ key.module_offset) * 1099511628211ULL;
+  return (uptr)(hash ^ key.is_data);
+}
+
+bool CachedSymbolizer::KeyEqual::operator()(const Key &a, const Key &b) const {
+  return a.module_offset == b.module_offset && a.is_data == b.is_data &&
+         0 == std::strcmp(a.module, b.module);
+}
+
+CachedSymbolizer::CachedSymbolizer(SymbolizerTool *tool, uptr max_size)
+    : InProcessSymbolizer(tool),
+      max_size_(max_size),
+      size_(0),
+      hits_(0),
+      misses_(0) {
+  CHECK(next);
+}
+
+CachedSymbolizer::~CachedSymbolizer() { Clear(); }
+
+void CachedSymbolizer::StopTheWorld() {
+  InProcessSymbolizer::StopTheWorld();
+  Clear();
+}
+
+void CachedSymbolizer::Clear() {
+  while (!entries_.empty())
+    EvictLast();
+}
+
+void CachedSymbolizer::EvictLast() {
+  Entry &entry = entries_.back();
+  index_.erase(entry.key);
+  size_ -= entry.charge;
+  std::free((char *)entry.key.module);
+  FreeResultString(entry.strings, entry.data.file);
+  FreeResultString(entry.strings, entry.data.name);
+  FreeFrames(entry.strings, &entry.frames);
+  entries_.pop_back();
+}
+
+bool CachedSymbolizer::Lookup(DataInfo *info) {
+  Key key = {info->module, info->module_offset, true};
+  auto it = index_.find(key);
+  if (it == index_.end()) {
+    ++misses_;
+    return false;
+  }
+  ++hits_;
+  entries_.splice(entries_.begin(), entries_, it->second);
+  StringTable *strings = it->second->strings;
+  const DataInfo &data = it->second->data;
+  info->file  = GiveString(strings, info->strings, data.file);
+  info->line  = data.line;
+  info->name  = GiveString(strings, info->strings, data.name);
+  info->start = data.start;
+  info->size  = data.size;
+  return true;
+}
+
+bool CachedSymbolizer::Lookup(AddrInfo *info) {
+  Key key = {info->module, info->module_offset, false};
+  auto it = index_.find(key);
+  if (it == index_.end()) {
+    ++misses_;
+    return false;
+  }
+  ++hits_;
+  entries_.splice(entries_.begin(), entries_, it->second);
+  StringTable *strings = it->second->strings;
+  const std::vector<FrameDat> &frames = it->second->frames;
+  for (uptr i = 0; i < frames.size(); ++i) {
+    FrameDat frame = frames[i];
+    frame.func = GiveString(strings, info->strings, frame.func);
+    frame.file = GiveString(strings, info->strings, frame.file);
+    info->frames.push_back(frame);
+  }
+  return true;
+}
+
+void CachedSymbolizer::Insert(const DataInfo &info) {
+  Key key = {info.module, info.module_offset, true};
+  Entry *entry = NewEntry(key, StringCharge(info.strings, info.file) +
+                                   StringCharge(info.strings, info.name));
+  if (!entry)
+    return;
+  entry->strings    = info.strings;
+  entry->data.file  = KeepString(info.strings, info.file);
+  entry->data.line  = info.line;
+  entry->data.name  = KeepString(info.strings, info.name);
+  entry->data.start = info.start;
+  entry->data.size  = info.size;
+}
+
+void CachedSymbolizer::Insert(const AddrInfo &info, uptr first_frame) {
+  Key key = {info.module, info.module_offset, false};
+  uptr charge = (info.frames.size() - first_frame) * sizeof(FrameDat);
+  for (uptr i = first_frame; i < info.frames.size(); ++i)
+    charge += StringCharge(info.strings, info.frames[i].func) +
+              StringCharge(info.strings, info.frames[i].file);
+  Entry *entry = NewEntry(key, charge);
+  if (!entry)
+    return;
+  entry->strings = info.strings;
+  for (uptr i = first_frame; i < info.frames.size(); ++i) {
+    FrameDat frame = info.frames[i];
+    frame.func = KeepString(info.strings, frame.func);
+    frame.file = KeepString(info.strings, frame.file);
+    entry->frames.push_back(frame);
+  }
+}
+
+// Makes room for an entry of |charge| bytes besides its key and
+// puts it at the front. Returns nullptr if it would never fit.
+CachedSymbolizer::Entry *CachedSymbolizer::NewEntry(Key key, uptr charge) {
+  // The list node, the hash node and its bucket.
+  charge += sizeof(Entry) + 8 * sizeof(void *) +
+            StringCharge(nullptr, key.module);
+  if (charge > max_size_ || index_.count(key))
+    return nullptr;
+  while (size_ + charge > max_size_)
+    EvictLast();
+  entries_.push_front(Entry());
+  Entry *entry = &entries_.front();
+  std::memset(&entry->data, 0, sizeof(entry->data));
+  key.module = strdup(key.module);
+  entry->key = key;
+  entry->charge = charge;
+  index_[key] = entries_.begin();
+  size_ += charge;
+  return entry;
+}
+
+} // namespace SANSYMTOOL_NS
@@ -0,0 +1,86 @@
+//===-- cached_symbolizer.h -----------------------------------------------===//
+//
+// Based on the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file declares a symbolizer tool keeping recent results of another
+// one in memory, so repeated requests don't reach the symbolizer at all.
+//===----------------------------------------------------------------------===//
+
+#ifndef SANSYMTOOL_HEAD_CACHED_SYMBOLIZER_H
+#define SANSYMTOOL_HEAD_CACHED_SYMBOLIZER_H
+
+#include "in_process_symbolizer.h"
+
+#include <list>
+#include <unordered_map>
+
+namespace SANSYMTOOL_NS
+{
+
+// Results are keyed by (module, offset, code or data) and evicted in
+// LRU order once their estimated size exceeds the limit. A hit gives
+// the caller its own copies of all the strings, just like a result
+// parsed from the symbolizer, so they are freed in the same way.
+// Strings interned by the request's StringTable are kept and given
+// back as they are instead, so that table must outlive the cache.
+// Only successful requests are cached.
+// Completion-based requests go straight to the wrapped tool.
+class CachedSymbolizer final : public InProcessSymbolizer {
+ public:
+  // Takes ownership of |tool|. |max_size| is in bytes.
+  CachedSymbolizer(SymbolizerTool *tool, uptr max_size);
+  ~CachedSymbolizer() override;
+
+  void StopTheWorld() override;
+
+  uptr hits() const { return hits_; }
+  uptr misses() const { return misses_; }
+  uptr size() const { return size_; }
+
+ private:
+  struct Key {
+    const char *module;  // Owned by the entry
+    uptr        module_offset;
+    bool        is_data;
+  };
+  struct KeyHash {
+    uptr operator()(const Key &key) const;
+  };
+  struct KeyEqual {
+    bool operator()(const Key &a, const Key &b) const;
+  };
+  struct Entry {
+    Key                   key;
+    uptr                  charge;
+    // Interned the strings below if set, which then aren't owned.
+    StringTable          *strings;
+    DataInfo              data;
+    std::vector<FrameDat> frames;
+  };
+  typedef std::list<Entry> EntryList;
+
+  // On a hit, fill in the result and mark the entry as most recent.
+  bool Lookup(DataInfo *info) override;
+  bool Lookup(AddrInfo *info) override;
+  void Insert(const DataInfo &info) override;
+  void Insert(const AddrInfo &info, uptr first_frame) override;
+  Entry *NewEntry(Key key, uptr charge);
+  void EvictLast();
+  void Clear();
+
+  // Most recently used at the front.
+  EntryList entries_;
+  std::unordered_map<Key, EntryList::iterator, KeyHash, KeyEqual> index_;
+  uptr max_size_;
+  uptr size_;
+  uptr hits_;
+  uptr misses_;
+};
+
+} // namespace SANSYMTOOL_NS
+
+#endif // SANSYMTOOL_HEAD_CACHED_SYMBOLIZER_H
@@ -20,8 +20,11 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <time.h>
 #include <unistd.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 
 #else // SANITIZER_POSIX
 #error ONLY SUPPORT POSIX NOW
@@ -122,6 +125,39 @@ bool WriteToFile(fd_t fd, const void *buff, uptr buff_size, uptr *bytes_written,
   }
 }
 
+bool WriteFileAtomically(const char *path, const FileChunk *chunks,
+                         uptr n_chunks) {
+  // Named after the thread, so that writers never share one.
+  char tmp_path[4096];
+  if (std::snprintf(tmp_path, sizeof(tmp_path), "%s.tmp.%d", path,
+                    GetTid()) >= (int)sizeof(tmp_path))
+    return false;
+  fd_t fd = OpenFile(tmp_path, WrOnly);
+  if (fd == kInvalidFd)
+    return false;
+  bool ok = true;
+  for (uptr i = 0; ok && i < n_chunks; ++i) {
+    const char *data = (const char *)chunks[i].data;
+    uptr size = chunks[i].size;
+    while (ok && size) {
+      uptr written = 0;
+      error_t err = 0;
+      if (!WriteToFile(fd, data, size, &written, &err)) {
+        ok = err == EINTR;
+        continue;
+      }
+      data += written;
+      size -= written;
+    }
+  }
+  CloseFile(fd);
+  if (!ok || rename(tmp_path, path)) {
+    unlink(tmp_path);
+    return false;
+  }
+  return true;
+}
+
 bool FileExists(const char *filename) {
   if (!filename) return false;
 
@@ -141,6 +177,40 @@ bool DirExists(const char *path) {
   return S_ISDIR(st.st_mode);
 }
 
+const void *MapFileToMemory(const char *filename, uptr *size) {
+  fd_t fd = OpenFile(filename, RdOnly);
+  if (fd == kInvalidFd)
+    return nullptr;
+  auto file_closer = at_scope_exit([&] { CloseFile(fd); });
+  struct stat st;
+  if (fstat(fd, &st) || !S_ISREG(st.st_mode) || st.st_size <= 0)
+    return nullptr;
+  void *addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (addr == MAP_FAILED)
+    return nullptr;
+  *size = st.st_size;
+  return addr;
+}
+
+void UnmapFromMemory(const void *addr, uptr size) {
+  if (addr)
+    munmap(const_cast<void *>(addr), size);
+}
+
+u64 MonotonicNanoTime() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (u64)ts.tv_sec * (1000ULL * 1000 * 1000) + ts.tv_nsec;
+}
+
+int GetTid() {
+#if SANITIZER_LINUX
+  return (int)syscall(SYS_gettid);
+#else // SANITIZER_LINUX
+  return (int)getpid();
+#endif // SANITIZER_LINUX
+}
+
 #else // SANITIZER_POSIX
 #error ONLY SUPPORT POSIX NOW
 #endif // SANITIZER_POSIX
@@ -33,13 +33,6 @@
 */
 #define SANSYMTOOL_DBG_START_SUBPROCESS 0
 
-/**
- * Whether to make llvm-symbolizer print demangled
- * function names if the names are mangled.
- * @note e.g. the mangled name _Z3bazv becomes baz(), 
- * whilst the non-mangled name foz is printed as is.
-*/
-#define SANSYMTOOL_LLVMSYMBOLIZER_DEMANGLE 0
 /**
  * Whether to make llvm-symbolizer print all
  * the inlined frames if a source code location 
@@ -47,13 +40,6 @@
 */
 #define SANSYMTOOL_LLVMSYMBOLIZER_INLINES 1
 
-/**
- * Whether to make addr2line print demangled
- * function names. Just like what
- * SANSYMTOOL_LLVMSYMBOLIZER_DEMANGLE
- * does.
-*/
-#define SANSYMTOOL_ADDR2LINE_DEMANGLE 0
 /**
  * Whether to make addr2line print 
  * all the inlined frames. Just like what
@@ -71,6 +57,16 @@
  * start new ones.
 */
 #define SANSYMTOOL_ADDR2LINE_POOLMAX 16
+/**
+ * Whether to build LLVMLibrarySymbolizer, which
+ * links LLVM's DebugInfo/Symbolize library and
+ * symbolizes in process, as llvm-symbolizer would.
+ * @note Set by the cmake option of the same name,
+ * which also adds the LLVM headers and libraries.
+*/
+#ifndef SANSYMTOOL_LLVM_SYMBOLIZE
+#define SANSYMTOOL_LLVM_SYMBOLIZE 0
+#endif
 
 namespace SANSYMTOOL_NS
 {
@@ -262,9 +258,33 @@ bool ReadFromFile(fd_t fd, void *buff, uptr buff_size,
 bool WriteToFile(fd_t fd, const void *buff, uptr buff_size,
                  uptr *bytes_written = nullptr, error_t *error_p = nullptr);
 
+struct FileChunk {
+  const void *data;
+  uptr size;
+};
+
+// Writes |chunks| one after another to a temporary file next to |path|,
+// then renames it over |path|. So readers see either the old file or
+// the new one, never a partial one. Returns false on error, leaving
+// |path| as it was.
+bool WriteFileAtomically(const char *path, const FileChunk *chunks,
+                         uptr n_chunks);
+
 bool FileExists(const char *filename);
 bool DirExists(const char *path);
 
+// Maps the whole file read-only. Returns nullptr on error,
+// or if the file is empty.
+const void *MapFileToMemory(const char *filename, uptr *size);
+void UnmapFromMemory(const void *addr, uptr size);
+
+// Nanoseconds from an unspecified point, never going backwards.
+u64 MonotonicNanoTime();
+
+// Id of the calling thread, the pid for the main one. Temporary files
+// are named after it, so that contexts on other threads never collide.
+int GetTid();
+
 template <typename Fn>
 class RunOnDestruction {
  public:
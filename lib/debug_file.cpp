@@ -0,0 +1,162 @@
+//===-- debug_file.cpp ----------------------------------------------------===//
+//
+// Based on the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file gives implementation of the lookup of separate debug files.
+//===----------------------------------------------------------------------===//
+
+#include "debug_file.h"
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#if SANITIZER_POSIX
+
+#include <elf.h>
+#include <unistd.h>
+
+#else // SANITIZER_POSIX
+#error ONLY SUPPORT POSIX NOW
+#endif // SANITIZER_POSIX
+
+namespace SANSYMTOOL_NS
+{
+
+namespace {
+
+struct Crc32Table {
+  Crc32Table() {
+    for (u32 i = 0; i < 256; ++i) {
+      u32 c = i;
+      for (int k = 0; k < 8; ++k)
+        c = (c & 1) ? 0xedb88320U ^ (c >> 1) : c >> 1;
+      entries[i] = c;
+    }
+  }
+  u32 entries[256];
+};
+
+} // namespace
+
+u32 DebuglinkCrc32(const u8 *data, uptr size, u32 crc) {
+  // Built once by the first caller, others wait for it.
+  static const Crc32Table table;
+  crc = ~crc;
+  for (uptr i = 0; i < size; ++i)
+    crc = table.entries[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+  return ~crc;
+}
+
+namespace {
+
+// What a candidate has to match to be taken.
+struct DebugFileKey {
+  u8 build_id[64];
+  uptr build_id_size;
+  u32 crc;
+  bool has_crc;
+};
+
+bool OpenCandidate(const std::string &candidate, const DebugFileKey &key,
+                   ElfFile *debug) {
+  if (!FileExists(candidate.c_str()) || !debug->Open(candidate.c_str()))
+    return false;
+  // Only what the module was stripped of makes it a debug file. This
+  // also turns away the module itself, or another stripped copy of it.
+  bool has_debug = debug->FindSection(".debug_info") != nullptr;
+  for (uptr i = 0; i < debug->NumSections() && !has_debug; ++i)
+    has_debug = debug->GetSection(i).type == SHT_SYMTAB;
+
+  bool matches = false;
+  u8 build_id[64];
+  uptr build_id_size = debug->GetBuildId(build_id, sizeof(build_id));
+  if (key.build_id_size && build_id_size)
+    matches = build_id_size == key.build_id_size &&
+              !std::memcmp(build_id, key.build_id, build_id_size);
+  else if (key.has_crc)
+    matches = DebuglinkCrc32(debug->data(), debug->size(), 0) == key.crc;
+  if (has_debug && matches)
+    return true;
+  debug->Close();
+  return false;
+}
+
+// Reads the name and CRC of .gnu_debuglink: the name terminated and
+// padded to 4 bytes, followed by the CRC in the byte order of the file.
+bool GetDebuglink(const ElfFile &elf, std::string *name, u32 *crc) {
+  const ElfFile::Section *section = elf.FindSection(".gnu_debuglink");
+  if (!section)
+    return false;
+  const char *data = (const char *)elf.SectionData(*section);
+  if (!data || section->size < 8)
+    return false;
+  const char *end = (const char *)std::memchr(data, '\0', section->size - 4);
+  if (!end || end == data)
+    return false;
+  uptr crc_offset = ((end - data) + 4) & ~(uptr)3;
+  if (crc_offset + 4 > section->size)
+    return false;
+  name->assign(data, end - data);
+  std::memcpy(crc, data + crc_offset, sizeof(*crc));
+  return true;
+}
+
+} // namespace
+
+bool OpenDebugFile(const char *path, const ElfFile &elf, const char *dir,
+                   ElfFile *debug) {
+  if (!dir || !dir[0])
+    dir = kDefaultDebugFileDir;
+  DebugFileKey key;
+  key.build_id_size = elf.GetBuildId(key.build_id, sizeof(key.build_id));
+  key.has_crc = false;
+  std::string candidate;
+
+  if (key.build_id_size) {
+    char hex[3];
+    candidate = dir;
+    candidate += "/.build-id/";
+    for (uptr i = 0; i < key.build_id_size; ++i) {
+      std::snprintf(hex, sizeof(hex), "%02x", key.build_id[i]);
+      candidate += hex;
+      if (i == 0)
+        candidate += '/';
+    }
+    candidate += ".debug";
+    if (key.build_id_size > 1 && OpenCandidate(candidate, key, debug))
+      return true;
+  }
+
+  std::string name;
+  if (!GetDebuglink(elf, &name, &key.crc))
+    return false;
+  key.has_crc = true;
+  const char *base = StripModuleName(path);
+  std::string module_dir(path, base - path);
+
+  candidate = module_dir + name;
+  if (OpenCandidate(candidate, key, debug))
+    return true;
+  candidate = module_dir + ".debug/" + name;
+  if (OpenCandidate(candidate, key, debug))
+    return true;
+
+  // "<dir>/full/path/to/module/name", whatever the module was called by.
+  if (module_dir.empty() || module_dir[0] != '/') {
+    char cwd[4096];
+    if (!getcwd(cwd, sizeof(cwd)))
+      return false;
+    module_dir = std::string(cwd) + "/" + module_dir;
+  }
+  candidate = dir;
+  candidate += module_dir;
+  candidate += name;
+  return OpenCandidate(candidate, key, debug);
+}
+
+} // namespace SANSYMTOOL_NS
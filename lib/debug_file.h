@@ -0,0 +1,41 @@
+//===-- debug_file.h ------------------------------------------------------===//
+//
+// Based on the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file declares the lookup of separate debug files, for the parts
+// of the tool reading symbols and DWARF of stripped modules in process.
+//===----------------------------------------------------------------------===//
+
+#ifndef SANSYMTOOL_HEAD_DEBUG_FILE_H
+#define SANSYMTOOL_HEAD_DEBUG_FILE_H
+
+#include "elf_file.h"
+
+namespace SANSYMTOOL_NS
+{
+
+// Where separate debug files are installed when no other directory
+// is given, as in gdb and llvm-symbolizer.
+static const char kDefaultDebugFileDir[] = "/usr/lib/debug";
+
+// Finds the separate debug file of the module |elf| mapped from |path|,
+// and opens it in |debug|. As in gdb and llvm-symbolizer, it's looked
+// for by build-id in "<dir>/.build-id/xx/yyyy.debug", then by the name
+// in .gnu_debuglink next to the module, in ".debug" there, and in
+// |dir| under the absolute directory of the module. A file is only
+// taken if its build-id matches the one of the module, or without
+// one, if its CRC matches the one in .gnu_debuglink. |dir| can be
+// nullptr for kDefaultDebugFileDir. Returns false if none is found.
+bool OpenDebugFile(const char *path, const ElfFile &elf, const char *dir,
+                   ElfFile *debug);
+
+// CRC-32 as in zlib, which .gnu_debuglink holds, continued from |crc|.
+u32 DebuglinkCrc32(const u8 *data, uptr size, u32 crc);
+
+} // namespace SANSYMTOOL_NS
+
+#endif // SANSYMTOOL_HEAD_DEBUG_FILE_H
@@ -0,0 +1,91 @@
+//===-- demangle.cpp ------------------------------------------------------===//
+//
+// Based on the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file gives implementation of the memoized demangler.
+//===----------------------------------------------------------------------===//
+
+#include "demangle.h"
+
+#include <cstdlib>
+#include <cstring>
+
+#if SANSYMTOOL_LLVM_SYMBOLIZE
+#include "llvm/Demangle/Demangle.h"
+#else // SANSYMTOOL_LLVM_SYMBOLIZE
+#include <cxxabi.h>
+#endif // SANSYMTOOL_LLVM_SYMBOLIZE
+
+namespace SANSYMTOOL_NS
+{
+
+Demangler::Demangler()
+    :
+#if !SANSYMTOOL_LLVM_SYMBOLIZE
+      buffer_(nullptr),
+      buffer_size_(0),
+#endif // !SANSYMTOOL_LLVM_SYMBOLIZE
+      hits_(0),
+      misses_(0) {
+}
+
+Demangler::~Demangler() {
+#if !SANSYMTOOL_LLVM_SYMBOLIZE
+  std::free(buffer_);
+#endif // !SANSYMTOOL_LLVM_SYMBOLIZE
+}
+
+const char *Demangler::Demangle(const char *name) {
+  // Like llvm-symbolizer, only Itanium names are taken as mangled,
+  // since a C name could look like anything else.
+  if (name[0] != '_' || name[1] != 'Z')
+    return name;
+
+  auto it = names_.find(name);
+  if (it != names_.end()) {
+    ++hits_;
+    return it->second.empty() ? name : it->second.c_str();
+  }
+  ++misses_;
+  if (names_.size() >= kMaxNames)
+    names_.clear();
+
+  std::string &demangled = names_[name];
+#if SANSYMTOOL_LLVM_SYMBOLIZE
+  demangled = llvm::demangle(name);
+  if (demangled == name)
+    demangled.clear();
+#else // SANSYMTOOL_LLVM_SYMBOLIZE
+  int status = 0;
+  char *buffer = abi::__cxa_demangle(name, buffer_, &buffer_size_, &status);
+  if (status == 0 && buffer) {
+    // It may have grown the buffer.
+    buffer_ = buffer;
+    demangled = buffer;
+  }
+#endif // SANSYMTOOL_LLVM_SYMBOLIZE
+  return demangled.empty() ? name : demangled.c_str();
+}
+
+const char *Demangler::Demangle(const char *name, StringTable *strings) {
+  if (name[0] != '_' || name[1] != 'Z')
+    return name;
+  auto it = interned_.find(name);
+  if (it != interned_.end()) {
+    ++hits_;
+    return it->second;
+  }
+  if (interned_.size() >= kMaxNames)
+    interned_.clear();
+  const char *demangled = Demangle(name);
+  if (demangled != name)
+    demangled = strings->Intern(demangled, std::strlen(demangled));
+  interned_[name] = demangled;
+  return demangled;
+}
+
+} // namespace SANSYMTOOL_NS
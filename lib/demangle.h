@@ -0,0 +1,67 @@
+//===-- demangle.h --------------------------------------------------------===//
+//
+// Based on the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file declares demangling of names in process, so that symbolizers
+// can always be asked for mangled names.
+//===----------------------------------------------------------------------===//
+
+#ifndef SANSYMTOOL_HEAD_DEMANGLE_H
+#define SANSYMTOOL_HEAD_DEMANGLE_H
+
+#include "common.h"
+#include "symbolizer.h"
+
+#include <string>
+#include <unordered_map>
+
+namespace SANSYMTOOL_NS
+{
+
+// Demangles with LLVM's demangler if the library is built with
+// SANSYMTOOL_LLVM_SYMBOLIZE, giving what llvm-symbolizer --demangle
+// prints, or with __cxa_demangle otherwise. A few hundred names make
+// up almost all frames, and the long template ones from C++ take
+// microseconds each, so every name is demangled once and then looked
+// up by its hash. Past kMaxNames names, all of them are dropped.
+class Demangler {
+ public:
+  Demangler();
+  ~Demangler();
+  Demangler(const Demangler &) = delete;
+  Demangler &operator=(const Demangler &) = delete;
+
+  // Returns the demangled |name|, or |name| itself if it isn't a
+  // mangled one. What's returned otherwise stays valid until the
+  // next call.
+  const char *Demangle(const char *name);
+  // Same for a |name| interned by |strings|, giving a name interned by
+  // it too. Names are looked up by their pointers, so not hashed.
+  const char *Demangle(const char *name, StringTable *strings);
+
+  uptr hits() const { return hits_; }
+  uptr misses() const { return misses_; }
+
+ private:
+  enum { kMaxNames = 1 << 16 };
+
+  // Empty for names given back as they are.
+  std::unordered_map<std::string, std::string> names_;
+  // From interned names to interned results.
+  std::unordered_map<const char *, const char *> interned_;
+#if !SANSYMTOOL_LLVM_SYMBOLIZE
+  // Reused by __cxa_demangle.
+  char *buffer_;
+  size_t buffer_size_;
+#endif // !SANSYMTOOL_LLVM_SYMBOLIZE
+  uptr hits_;
+  uptr misses_;
+};
+
+} // namespace SANSYMTOOL_NS
+
+#endif // SANSYMTOOL_HEAD_DEMANGLE_H
@@ -0,0 +1,417 @@
+//===-- disk_cache.cpp ----------------------------------------------------===//
+//
+// Based on the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file gives implementation of the on-disk symbolizer cache.
+//===----------------------------------------------------------------------===//
+
+#include "disk_cache.h"
+#include "elf_file.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+
+#if SANITIZER_POSIX
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#else // SANITIZER_POSIX
+#error ONLY SUPPORT POSIX NOW
+#endif // SANITIZER_POSIX
+
+namespace SANSYMTOOL_NS
+{
+
+static const char kDiskCacheMagic[8] = {'S', 'S', 'T', 'C', 'A', 'C', 'H', 'E'};
+static const char kDiskCacheSuffix[] = ".sstc";
+
+// FNV-1a, which stays the same across processes and builds.
+static u64 HashString(const char *str) {
+  u64 hash = 14695981039346656037ULL;
+  for (; *str; ++str)
+    hash = (hash ^ (u8)*str) * 1099511628211ULL;
+  return hash;
+}
+
+static u64 MakeKey(uptr module_offset, bool is_data) {
+  return (u64)module_offset << 1 | (is_data ? 1 : 0);
+}
+
+// Returns false if |offset| isn't a string within |strings|.
+static bool GetString(const char *strings, uptr strings_size, u32 offset,
+                      const char **str) {
+  if (offset == kDiskCacheNoString) {
+    *str = nullptr;
+    return true;
+  }
+  if (offset >= strings_size)
+    return false;
+  *str = strings + offset;
+  return true;
+}
+
+DiskCachedSymbolizer::DiskCachedSymbolizer(SymbolizerTool *tool,
+                                           const char *dir,
+                                           const char *producer)
+    : InProcessSymbolizer(tool),
+      dir_(strdup(dir)),
+      producer_(strdup(producer)),
+      producer_hash_(HashString(producer)) {
+  CHECK(next);
+  if (!DirExists(dir_) && mkdir(dir_, 0777) && errno != EEXIST)
+    SAYSTH("WARNING: Can't create the cache directory\n");
+}
+
+DiskCachedSymbolizer::~DiskCachedSymbolizer() {
+  for (uptr i = 0; i < modules_.size(); ++i) {
+    Flush(modules_[i]);
+    UnmapFile(modules_[i]);
+    std::free(modules_[i]->name);
+    delete modules_[i];
+  }
+  std::free(dir_);
+  std::free(producer_);
+}
+
+void DiskCachedSymbolizer::StopTheWorld() {
+  for (uptr i = 0; i < modules_.size(); ++i)
+    Flush(modules_[i]);
+  InProcessSymbolizer::StopTheWorld();
+}
+
+DiskCachedSymbolizer::Module *
+DiskCachedSymbolizer::GetModule(const char *module_name) {
+  for (uptr i = 0; i < modules_.size(); ++i)
+    if (0 == std::strcmp(modules_[i]->name, module_name))
+      return modules_[i];
+  Module *module = new Module();
+  module->name = strdup(module_name);
+  module->has_identity = GetModuleIdentity(module_name, module->identity,
+                                           sizeof(module->identity));
+  if (module->has_identity)
+    MapFile(module);
+  modules_.push_back(module);
+  return module;
+}
+
+void DiskCachedSymbolizer::GetPath(const Module *module, const char *suffix,
+                                   char *buffer, uptr size) const {
+  std::snprintf(buffer, size, "%s/%s-%016llx%s", dir_, module->identity,
+                (unsigned long long)producer_hash_, suffix);
+}
+
+void DiskCachedSymbolizer::UnmapFile(Module *module) {
+  UnmapFromMemory(module->map, module->map_size);
+  module->map = nullptr;
+  module->map_size = 0;
+  module->entries = nullptr;
+  module->records = nullptr;
+  module->strings = nullptr;
+  module->n_entries = module->n_records = module->strings_size = 0;
+}
+
+void DiskCachedSymbolizer::MapFile(Module *module) {
+  UnmapFile(module);
+  char path[4096];
+  GetPath(module, kDiskCacheSuffix, path, sizeof(path));
+  uptr size = 0;
+  const u8 *map = (const u8 *)MapFileToMemory(path, &size);
+  if (!map)
+    return;
+
+  // A file not matching in every way is ignored, and later replaced.
+  const DiskCacheHeader *header = (const DiskCacheHeader *)map;
+  bool ok = size >= sizeof(DiskCacheHeader) &&
+            !std::memcmp(header->magic, kDiskCacheMagic,
+                         sizeof(kDiskCacheMagic)) &&
+            header->version == kDiskCacheVersion &&
+            header->header_size == sizeof(DiskCacheHeader) &&
+            !std::strncmp(header->identity, module->identity,
+                          sizeof(header->identity)) &&
+            header->producer_hash == producer_hash_ &&
+            !std::strncmp(header->producer, producer_,
+                          sizeof(header->producer) - 1);
+  u64 expected = sizeof(DiskCacheHeader);
+  if (ok) {
+    // Every count is bounded by the file size before multiplying.
+    ok = header->n_entries <= size && header->n_records <= size &&
+         header->strings_size <= size;
+    expected += header->n_entries * sizeof(DiskCacheEntry) +
+                header->n_records * sizeof(DiskCacheRecord) +
+                header->strings_size;
+  }
+  if (ok && header->strings_size)
+    ok = map[size - 1] == '\0';
+  if (!ok || expected != size) {
+    UnmapFromMemory(map, size);
+    return;
+  }
+  module->map = map;
+  module->map_size = size;
+  module->entries = (const DiskCacheEntry *)(map + sizeof(DiskCacheHeader));
+  module->n_entries = header->n_entries;
+  module->records = (const DiskCacheRecord *)(module->entries +
+                                              module->n_entries);
+  module->n_records = header->n_records;
+  module->strings = (const char *)(module->records + module->n_records);
+  module->strings_size = header->strings_size;
+}
+
+const DiskCacheEntry *DiskCachedSymbolizer::Find(Module *module, u64 key,
+                                                 bool *is_new) {
+  const DiskCacheEntry *end = module->entries + module->n_entries;
+  const DiskCacheEntry *it = std::lower_bound(
+      module->entries, end, key,
+      [](const DiskCacheEntry &entry, u64 key) { return entry.key < key; });
+  if (it != end && it->key == key) {
+    if ((u64)it->first_record + it->n_records > module->n_records)
+      return nullptr;
+    *is_new = false;
+    return it;
+  }
+  auto found = module->new_entries.find(key);
+  if (found == module->new_entries.end())
+    return nullptr;
+  *is_new = true;
+  return &found->second;
+}
+
+bool DiskCachedSymbolizer::Lookup(DataInfo *info) {
+  Module *module = GetModule(info->module);
+  if (!module->has_identity)
+    return false;
+  bool is_new = false;
+  const DiskCacheEntry *entry =
+      Find(module, MakeKey(info->module_offset, true), &is_new);
+  if (!entry || entry->n_records != 1)
+    return false;
+  const DiskCacheRecord *records =
+      is_new ? module->new_records.data() : module->records;
+  const char *strings = is_new ? module->new_strings.data() : module->strings;
+  uptr strings_size = is_new ? module->new_strings.size() : module->strings_size;
+
+  const DiskCacheRecord &record = records[entry->first_record];
+  const char *name, *file;
+  if (!GetString(strings, strings_size, record.name, &name) ||
+      !GetString(strings, strings_size, record.file, &file))
+    return false;
+  info->name  = CopyResultString(info->strings, name);
+  info->file  = CopyResultString(info->strings, file);
+  info->line  = record.line;
+  info->start = record.start;
+  info->size  = record.size;
+  return true;
+}
+
+bool DiskCachedSymbolizer::Lookup(AddrInfo *info) {
+  Module *module = GetModule(info->module);
+  if (!module->has_identity)
+    return false;
+  bool is_new = false;
+  const DiskCacheEntry *entry =
+      Find(module, MakeKey(info->module_offset, false), &is_new);
+  if (!entry)
+    return false;
+  const DiskCacheRecord *records =
+      is_new ? module->new_records.data() : module->records;
+  const char *strings = is_new ? module->new_strings.data() : module->strings;
+  uptr strings_size = is_new ? module->new_strings.size() : module->strings_size;
+
+  // Check all the frames before handing out any of them.
+  for (uptr i = 0; i < entry->n_records; ++i) {
+    const DiskCacheRecord &record = records[entry->first_record + i];
+    const char *func, *file;
+    if (!GetString(strings, strings_size, record.name, &func) ||
+        !GetString(strings, strings_size, record.file, &file))
+      return false;
+  }
+  for (uptr i = 0; i < entry->n_records; ++i) {
+    const DiskCacheRecord &record = records[entry->first_record + i];
+    const char *func = nullptr, *file = nullptr;
+    GetString(strings, strings_size, record.name, &func);
+    GetString(strings, strings_size, record.file, &file);
+    FrameDat frame;
+    frame.func = CopyResultString(info->strings, func);
+    frame.file = CopyResultString(info->strings, file);
+    frame.lin  = record.line;
+    frame.col  = record.column;
+    info->frames.push_back(frame);
+  }
+  return true;
+}
+
+u32 DiskCachedSymbolizer::AddString(Module *module, const char *str) {
+  if (!str)
+    return kDiskCacheNoString;
+  u32 offset = module->new_strings.size();
+  module->new_strings.insert(module->new_strings.end(), str,
+                             str + std::strlen(str) + 1);
+  return offset;
+}
+
+void DiskCachedSymbolizer::Insert(const DataInfo &info) {
+  Module *module = GetModule(info.module);
+  if (!module->has_identity || (!info.name && !info.file))
+    return;
+  u64 key = MakeKey(info.module_offset, true);
+  bool is_new = false;
+  if (Find(module, key, &is_new))
+    return;
+  DiskCacheRecord record;
+  record.name   = AddString(module, info.name);
+  record.file   = AddString(module, info.file);
+  record.line   = info.line;
+  record.column = 0;
+  record.start  = info.start;
+  record.size   = info.size;
+  DiskCacheEntry &entry = module->new_entries[key];
+  entry.key = key;
+  entry.first_record = module->new_records.size();
+  entry.n_records = 1;
+  module->new_records.push_back(record);
+  NoteInserted(module);
+}
+
+void DiskCachedSymbolizer::Insert(const AddrInfo &info, uptr first_frame) {
+  Module *module = GetModule(info.module);
+  if (!module->has_identity)
+    return;
+  bool found = false;
+  for (uptr i = first_frame; i < info.frames.size() && !found; ++i)
+    found = info.frames[i].func || info.frames[i].file;
+  if (!found)
+    return;
+  u64 key = MakeKey(info.module_offset, false);
+  bool is_new = false;
+  if (Find(module, key, &is_new))
+    return;
+  DiskCacheEntry &entry = module->new_entries[key];
+  entry.key = key;
+  entry.first_record = module->new_records.size();
+  entry.n_records = info.frames.size() - first_frame;
+  for (uptr i = first_frame; i < info.frames.size(); ++i) {
+    DiskCacheRecord record;
+    record.name   = AddString(module, info.frames[i].func);
+    record.file   = AddString(module, info.frames[i].file);
+    record.line   = info.frames[i].lin;
+    record.column = info.frames[i].col;
+    record.start  = 0;
+    record.size   = 0;
+    module->new_records.push_back(record);
+  }
+  NoteInserted(module);
+}
+
+void DiskCachedSymbolizer::NoteInserted(Module *module) {
+  if (module->new_entries.size() >= kFlushThreshold)
+    Flush(module);
+}
+
+bool DiskCachedSymbolizer::Flush(Module *module) {
+  if (module->new_entries.empty())
+    return true;
+  // Others may have written the file since it was mapped.
+  MapFile(module);
+
+  std::vector<DiskCacheEntry> entries;
+  std::vector<DiskCacheRecord> records;
+  std::vector<char> strings;
+  std::unordered_map<std::string, u32> string_offsets;
+  auto copy_string = [&](const char *src, uptr src_size, u32 offset,
+                         u32 *copied) {
+    const char *str;
+    if (!GetString(src, src_size, offset, &str))
+      return false;
+    if (!str) {
+      *copied = kDiskCacheNoString;
+      return true;
+    }
+    // File names are shared by many frames.
+    auto inserted = string_offsets.insert(std::make_pair(
+        std::string(str), (u32)strings.size()));
+    if (inserted.second)
+      strings.insert(strings.end(), str, str + std::strlen(str) + 1);
+    *copied = inserted.first->second;
+    return true;
+  };
+  auto copy_entry = [&](const DiskCacheEntry &entry,
+                        const DiskCacheRecord *src_records,
+                        const char *src, uptr src_size) {
+    DiskCacheEntry copy = entry;
+    copy.first_record = records.size();
+    for (uptr i = 0; i < entry.n_records; ++i) {
+      DiskCacheRecord record = src_records[entry.first_record + i];
+      if (!copy_string(src, src_size, record.name, &record.name) ||
+          !copy_string(src, src_size, record.file, &record.file)) {
+        records.resize(copy.first_record);
+        return;
+      }
+      records.push_back(record);
+    }
+    entries.push_back(copy);
+  };
+
+  // Merge both sorted lists, preferring what's already in the file.
+  uptr i = 0;
+  auto it = module->new_entries.begin();
+  while (i < module->n_entries || it != module->new_entries.end()) {
+    bool from_file = it == module->new_entries.end() ||
+                     (i < module->n_entries &&
+                      module->entries[i].key <= it->first);
+    if (from_file) {
+      if (it != module->new_entries.end() &&
+          module->entries[i].key == it->first)
+        ++it;
+      const DiskCacheEntry &entry = module->entries[i++];
+      if ((u64)entry.first_record + entry.n_records <= module->n_records)
+        copy_entry(entry, module->records, module->strings,
+                   module->strings_size);
+    } else {
+      copy_entry(it->second, module->new_records.data(),
+                 module->new_strings.data(), module->new_strings.size());
+      ++it;
+    }
+  }
+
+  module->new_entries.clear();
+  module->new_records.clear();
+  module->new_strings.clear();
+
+  DiskCacheHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, kDiskCacheMagic, sizeof(kDiskCacheMagic));
+  header.version      = kDiskCacheVersion;
+  header.header_size  = sizeof(DiskCacheHeader);
+  header.n_entries    = entries.size();
+  header.n_records    = records.size();
+  header.strings_size = strings.size();
+  std::memcpy(header.identity, module->identity, sizeof(header.identity));
+  header.producer_hash = producer_hash_;
+  std::strncpy(header.producer, producer_, sizeof(header.producer) - 1);
+
+  const FileChunk chunks[] = {
+      {&header, sizeof(header)},
+      {entries.data(), entries.size() * sizeof(entries[0])},
+      {records.data(), records.size() * sizeof(records[0])},
+      {strings.data(), strings.size()}};
+  char path[4096];
+  GetPath(module, kDiskCacheSuffix, path, sizeof(path));
+  if (!WriteFileAtomically(path, chunks, sizeof(chunks) / sizeof(chunks[0]))) {
+    SAYSTH("WARNING: Can't write the cache file\n");
+    return false;
+  }
+  MapFile(module);
+  return true;
+}
+
+} // namespace SANSYMTOOL_NS
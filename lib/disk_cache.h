@@ -0,0 +1,137 @@
+//===-- disk_cache.h ------------------------------------------------------===//
+//
+// Based on the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file declares a symbolizer tool keeping results of another one
+// in files, so that they survive the process.
+//===----------------------------------------------------------------------===//
+
+#ifndef SANSYMTOOL_HEAD_DISK_CACHE_H
+#define SANSYMTOOL_HEAD_DISK_CACHE_H
+
+#include "in_process_symbolizer.h"
+
+#include <map>
+
+namespace SANSYMTOOL_NS
+{
+
+// Layout of a cache file, all in host byte order:
+//   DiskCacheHeader
+//   DiskCacheEntry  entries[n_entries], sorted by key
+//   DiskCacheRecord records[n_records]
+//   char            strings[strings_size]
+// An entry is a data result with a single record, or a code
+// result with a record for each frame. Strings are referred
+// to by offset, where kDiskCacheNoString stands for nullptr.
+static const u32 kDiskCacheVersion = 2;
+static const u32 kDiskCacheNoString = ~0U;
+static const uptr kDiskCacheMaxIdentity = 160;
+static const uptr kDiskCacheMaxProducer = 512;
+
+struct DiskCacheHeader {
+  char magic[8];
+  u32  version;
+  u32  header_size;
+  u64  n_entries;
+  u64  n_records;
+  u64  strings_size;
+  char identity[kDiskCacheMaxIdentity];
+  // What the results came from, see DiskCachedSymbolizer, truncated,
+  // and its hash, which is also in the file name.
+  u64  producer_hash;
+  char producer[kDiskCacheMaxProducer];
+};
+
+struct DiskCacheEntry {
+  u64 key;  // module_offset << 1 | is_data
+  u32 first_record;
+  u32 n_records;
+};
+
+struct DiskCacheRecord {
+  u32 name;  // Function name for code
+  u32 file;
+  u32 line;
+  u32 column;
+  u64 start;
+  u64 size;
+};
+
+// There is a file for each module and producer of results, named
+// after GetModuleIdentity and a hash of the producer, so a rebuilt
+// module never meets results of its old self, nor results of another
+// symbolizer or of other settings. Files are mapped read-only and
+// never written in place. New results are kept in memory, then merged
+// with the latest file into a new one which replaces it by rename. So
+// the cache can be shared by many processes, at worst losing some
+// results when they write at the same time.
+// Only successful requests are cached, and not those with neither a
+// name nor a file, which a debug file showing up later may change.
+// Completion-based requests go straight to the wrapped tool.
+class DiskCachedSymbolizer final : public InProcessSymbolizer {
+ public:
+  // Takes ownership of |tool|. |dir| is created if missing.
+  // |producer| tells everything the results of |tool| depend on
+  // besides the module, e.g. which symbolizer binary it runs and
+  // where it looks for debug files.
+  DiskCachedSymbolizer(SymbolizerTool *tool, const char *dir,
+                       const char *producer);
+  ~DiskCachedSymbolizer() override;
+
+  // Writes out all the new results.
+  void StopTheWorld() override;
+
+ private:
+  // Results of a module, from its file and from this process.
+  struct Module {
+    char *name;
+    char identity[kDiskCacheMaxIdentity];
+    bool has_identity;
+    // The file as last mapped, or nullptr.
+    const u8 *map;
+    uptr map_size;
+    const DiskCacheEntry *entries;
+    uptr n_entries;
+    const DiskCacheRecord *records;
+    uptr n_records;
+    const char *strings;
+    uptr strings_size;
+    // New results in the same form, by key.
+    std::map<u64, DiskCacheEntry> new_entries;
+    std::vector<DiskCacheRecord> new_records;
+    std::vector<char> new_strings;
+  };
+
+  Module *GetModule(const char *module_name);
+  void GetPath(const Module *module, const char *suffix,
+               char *buffer, uptr size) const;
+  void MapFile(Module *module);
+  void UnmapFile(Module *module);
+  const DiskCacheEntry *Find(Module *module, u64 key, bool *is_new);
+
+  // On a hit, fill in the result.
+  bool Lookup(DataInfo *info) override;
+  bool Lookup(AddrInfo *info) override;
+  void Insert(const DataInfo &info) override;
+  void Insert(const AddrInfo &info, uptr first_frame) override;
+  u32 AddString(Module *module, const char *str);
+  void NoteInserted(Module *module);
+
+  bool Flush(Module *module);
+
+  char *dir_;
+  char *producer_;
+  u64 producer_hash_;
+  std::vector<Module *> modules_;
+  // Results kept in memory for a module before it's written out.
+  static const uptr kFlushThreshold = 4096;
+};
+
+} // namespace SANSYMTOOL_NS
+
+#endif // SANSYMTOOL_HEAD_DISK_CACHE_H
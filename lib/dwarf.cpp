@@ -0,0 +1,626 @@
+//===-- dwarf.cpp ---------------------------------------------------------===//
+//
+// Based on the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file gives implementation of the basic DWARF reading pieces.
+//===----------------------------------------------------------------------===//
+
+#include "dwarf.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+
+#if SANSYMTOOL_ZLIB
+#include <zlib.h>
+#endif // SANSYMTOOL_ZLIB
+#if SANSYMTOOL_ZSTD
+#include <zstd.h>
+#endif // SANSYMTOOL_ZSTD
+
+#if SANITIZER_POSIX
+
+#include <elf.h>
+#include <unistd.h>
+
+#ifndef ELFCOMPRESS_ZSTD
+#define ELFCOMPRESS_ZSTD 2
+#endif
+
+#else // SANITIZER_POSIX
+#error ONLY SUPPORT POSIX NOW
+#endif // SANITIZER_POSIX
+
+namespace SANSYMTOOL_NS
+{
+
+const u8 *DwarfReader::Skip(u64 n) {
+  if (!ok_ || n > size_ - offset_) {
+    ok_ = false;
+    return nullptr;
+  }
+  const u8 *p = data_ + offset_;
+  offset_ += n;
+  return p;
+}
+
+u64 DwarfReader::UNum(uptr n) {
+  const u8 *p = Skip(n);
+  if (!p)
+    return 0;
+  u64 value = 0;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  for (uptr i = 0; i < n; ++i)
+    value |= (u64)p[i] << (8 * i);
+#else
+  for (uptr i = 0; i < n; ++i)
+    value = value << 8 | p[i];
+#endif
+  return value;
+}
+
+u8 DwarfReader::U8() { return UNum(1); }
+u16 DwarfReader::U16() { return UNum(2); }
+u32 DwarfReader::U32() { return UNum(4); }
+u64 DwarfReader::U64() { return UNum(8); }
+
+u64 DwarfReader::ULEB() {
+  u64 value = 0;
+  for (uptr shift = 0; ok_; shift += 7) {
+    if (offset_ >= size_) {
+      ok_ = false;
+      break;
+    }
+    u8 byte = data_[offset_++];
+    if (shift < 64)
+      value |= (u64)(byte & 0x7f) << shift;
+    if (!(byte & 0x80))
+      return value;
+  }
+  return 0;
+}
+
+s64 DwarfReader::SLEB() {
+  u64 value = 0;
+  for (uptr shift = 0; ok_; shift += 7) {
+    if (offset_ >= size_) {
+      ok_ = false;
+      break;
+    }
+    u8 byte = data_[offset_++];
+    if (shift < 64)
+      value |= (u64)(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      if (shift + 7 < 64 && (byte & 0x40))
+        value |= ~0ULL << (shift + 7);
+      return (s64)value;
+    }
+  }
+  return 0;
+}
+
+const char *DwarfReader::CStr() {
+  if (!ok_ || offset_ >= size_) {
+    ok_ = false;
+    return nullptr;
+  }
+  const char *str = (const char *)data_ + offset_;
+  const void *nul = std::memchr(str, '\0', size_ - offset_);
+  if (!nul) {
+    ok_ = false;
+    return nullptr;
+  }
+  offset_ = (const u8 *)nul - data_ + 1;
+  return str;
+}
+
+u64 DwarfReader::UnitLength(bool *is_64) {
+  u32 length = U32();
+  if (length < 0xfffffff0) {
+    *is_64 = false;
+    return length;
+  }
+  if (length == 0xffffffff) {
+    *is_64 = true;
+    return U64();
+  }
+  ok_ = false;
+  return 0;
+}
+
+static const char *SectionString(const DwarfSection &section, u64 offset) {
+  if (offset >= section.size)
+    return nullptr;
+  const char *str = (const char *)section.data + offset;
+  return std::memchr(str, '\0', section.size - offset) ? str : nullptr;
+}
+
+// In the order of DwarfSections::Kind.
+static const char *const kSectionNames[] = {
+  ".debug_info",
+  ".debug_abbrev",
+  ".debug_line",
+  ".debug_line_str",
+  ".debug_str",
+  ".debug_str_offsets",
+  ".debug_addr",
+  ".debug_ranges",
+  ".debug_rnglists",
+};
+
+DwarfSections::DwarfSections() : elf_(nullptr) {
+  std::memset(entries_, 0, sizeof(entries_));
+}
+
+DwarfSections::~DwarfSections() {
+  for (uptr i = 0; i < kNumKinds; ++i)
+    Release(&entries_[i]);
+}
+
+bool DwarfSections::Load(const ElfFile &elf, const char *spill_prefix) {
+  elf_ = &elf;
+  spill_prefix_ = spill_prefix ? spill_prefix : "";
+  for (uptr i = 0; i < kNumKinds; ++i) {
+    Entry &entry = entries_[i];
+    Release(&entry);
+    entry.section = elf.FindSection(kSectionNames[i]);
+    entry.gnu_compressed = false;
+    if (!entry.section) {
+      // The name of the older format is ".zdebug_*".
+      std::string name = std::string(".z") + (kSectionNames[i] + 1);
+      entry.section = elf.FindSection(name.c_str());
+      entry.gnu_compressed = entry.section != nullptr;
+    }
+  }
+  return entries_[kInfo].section && entries_[kLine].section;
+}
+
+const DwarfSection &DwarfSections::Get(Kind kind) const {
+  Entry &entry = entries_[kind];
+  if (entry.read || !entry.section)
+    return entry.view;
+  entry.read = true;
+  if (entry.gnu_compressed || (entry.section->flags & SHF_COMPRESSED)) {
+    Inflate(kind, &entry);
+  } else if (const u8 *data = elf_->SectionData(*entry.section)) {
+    entry.view.data = data;
+    entry.view.size = entry.section->size;
+  }
+  return entry.view;
+}
+
+bool DwarfSections::Inflate(Kind kind, Entry *entry) const {
+  const u8 *data = elf_->SectionData(*entry->section);
+  uptr size = entry->section->size;
+  if (!data)
+    return false;
+  u32 type;
+  u64 inflated_size = 0;
+  uptr header_size;
+  if (entry->gnu_compressed) {
+    // "ZLIB", then the size in big-endian.
+    header_size = 12;
+    if (size < header_size || std::memcmp(data, "ZLIB", 4))
+      return false;
+    for (uptr i = 4; i < header_size; ++i)
+      inflated_size = inflated_size << 8 | data[i];
+    type = ELFCOMPRESS_ZLIB;
+  } else if (elf_->is_64()) {
+    Elf64_Chdr chdr;
+    header_size = sizeof(chdr);
+    if (size < header_size)
+      return false;
+    std::memcpy(&chdr, data, sizeof(chdr));
+    type = chdr.ch_type;
+    inflated_size = chdr.ch_size;
+  } else {
+    Elf32_Chdr chdr;
+    header_size = sizeof(chdr);
+    if (size < header_size)
+      return false;
+    std::memcpy(&chdr, data, sizeof(chdr));
+    type = chdr.ch_type;
+    inflated_size = chdr.ch_size;
+  }
+  uptr compressed_size = size - header_size;
+  if (inflated_size == 0 || inflated_size > (u64)~(uptr)0)
+    return false;
+
+  // A spill file is named after the module, so its size is all there
+  // is to check.
+  std::string spill_path;
+  if (!spill_prefix_.empty()) {
+    spill_path = spill_prefix_ + kSectionNames[kind];
+    if (MapSpillFile(spill_path, inflated_size, entry))
+      return true;
+  }
+
+  u8 *buffer = nullptr;
+  bool ok = false;
+  switch (type) {
+#if SANSYMTOOL_ZLIB
+    case ELFCOMPRESS_ZLIB: {
+      // Deflate makes data 1032 times larger at most, so a larger
+      // size is a broken header rather than something to allocate.
+      if (inflated_size / 1032 > compressed_size)
+        return false;
+      buffer = (u8 *)std::malloc(inflated_size);
+      uLongf length = inflated_size;
+      ok = buffer &&
+           uncompress(buffer, &length, data + header_size,
+                      compressed_size) == Z_OK &&
+           length == inflated_size;
+      break;
+    }
+#endif // SANSYMTOOL_ZLIB
+#if SANSYMTOOL_ZSTD
+    case ELFCOMPRESS_ZSTD: {
+      // Same as above, where an RLE block of 4 bytes gives 128 KiB.
+      if (inflated_size / 32768 > compressed_size)
+        return false;
+      buffer = (u8 *)std::malloc(inflated_size);
+      size_t length = buffer ? ZSTD_decompress(buffer, inflated_size,
+                                                data + header_size,
+                                                compressed_size)
+                             : 0;
+      ok = buffer && !ZSTD_isError(length) && length == inflated_size;
+      break;
+    }
+#endif // SANSYMTOOL_ZSTD
+    default: {
+      // Contexts on other threads may get here at the same time.
+      static std::atomic<bool> warned(false);
+      if (!warned.exchange(true, std::memory_order_relaxed)) {
+        SAYSTH("WARNING: Debug sections compressed in an unsupported way, "
+               "taken as missing\n");
+      }
+      return false;
+    }
+  }
+  if (!ok) {
+    std::free(buffer);
+    return false;
+  }
+
+  // Pages of the spill file can be dropped and read back by the
+  // kernel, unlike the buffer.
+  FileChunk chunk = {buffer, (uptr)inflated_size};
+  if (!spill_path.empty() &&
+      WriteFileAtomically(spill_path.c_str(), &chunk, 1) &&
+      MapSpillFile(spill_path, inflated_size, entry)) {
+    std::free(buffer);
+    return true;
+  }
+  entry->buffer = buffer;
+  entry->view.data = buffer;
+  entry->view.size = inflated_size;
+  return true;
+}
+
+bool DwarfSections::MapSpillFile(const std::string &path, uptr size,
+                                 Entry *entry) const {
+  uptr map_size = 0;
+  const void *map = MapFileToMemory(path.c_str(), &map_size);
+  if (!map)
+    return false;
+  if (map_size != size) {
+    UnmapFromMemory(map, map_size);
+    return false;
+  }
+  entry->map = map;
+  entry->map_size = map_size;
+  entry->view.data = (const u8 *)map;
+  entry->view.size = map_size;
+  return true;
+}
+
+void DwarfSections::Release(Entry *entry) const {
+  std::free(entry->buffer);
+  if (entry->map)
+    UnmapFromMemory(entry->map, entry->map_size);
+  entry->buffer = nullptr;
+  entry->map = nullptr;
+  entry->map_size = 0;
+  entry->view.data = nullptr;
+  entry->view.size = 0;
+  entry->read = false;
+}
+
+void DwarfSections::ReleaseUnreferenced() {
+  for (uptr i = 0; i < kNumKinds; ++i) {
+    Entry &entry = entries_[i];
+    if (i == kInfo || i == kStr || i == kLineStr)
+      continue;
+    if (entry.buffer || entry.map)
+      Release(&entry);
+  }
+}
+
+bool DwarfUnit::ReadHeader(DwarfReader *reader) {
+  offset = reader->offset();
+  u64 length = reader->UnitLength(&is_64);
+  if (!reader->ok() || length > reader->size() - reader->offset())
+    return false;
+  end = reader->offset() + length;
+  version = reader->U16();
+  if (version < 2 || version > 5)
+    return false;
+  if (version >= 5) {
+    unit_type = reader->U8();
+    address_size = reader->U8();
+    abbrev_offset = reader->Offset(is_64);
+    if (unit_type == DW_UT_skeleton || unit_type == DW_UT_split_compile) {
+      reader->Skip(8);  // dwo_id
+    } else if (unit_type == DW_UT_type || unit_type == DW_UT_split_type) {
+      reader->Skip(8);  // type_signature
+      reader->Offset(is_64);
+    }
+  } else {
+    unit_type = DW_UT_compile;
+    abbrev_offset = reader->Offset(is_64);
+    address_size = reader->U8();
+  }
+  die_offset = reader->offset();
+  str_offsets_base = 0;
+  addr_base = 0;
+  rnglists_base = 0;
+  base_address = 0;
+  bool ok = reader->ok() && die_offset <= end &&
+            (address_size == 4 || address_size == 8);
+  reader->Seek(end);
+  return ok;
+}
+
+bool DwarfAbbrevTable::Parse(const DwarfSection &abbrev, u64 offset) {
+  abbrevs_.clear();
+  if (offset >= abbrev.size)
+    return false;
+  DwarfReader reader(abbrev.data, abbrev.size, offset);
+  while (true) {
+    u64 code = reader.ULEB();
+    if (code == 0 || !reader.ok())
+      break;
+    abbrevs_.push_back(DwarfAbbrev());
+    DwarfAbbrev &entry = abbrevs_.back();
+    entry.code = code;
+    entry.tag = reader.ULEB();
+    entry.has_children = reader.U8() != 0;
+    while (reader.ok()) {
+      DwarfAttrSpec spec;
+      spec.attr = reader.ULEB();
+      spec.form = reader.ULEB();
+      spec.implicit_const = 0;
+      if (spec.attr == 0 && spec.form == 0)
+        break;
+      if (spec.form == DW_FORM_implicit_const)
+        spec.implicit_const = reader.SLEB();
+      entry.specs.push_back(spec);
+    }
+  }
+  if (!reader.ok())
+    return false;
+
+  sequential_ = true;
+  for (uptr i = 0; i < abbrevs_.size() && sequential_; ++i)
+    sequential_ = abbrevs_[i].code == i + 1;
+  if (!sequential_)
+    std::sort(abbrevs_.begin(), abbrevs_.end(),
+              [](const DwarfAbbrev &a, const DwarfAbbrev &b) {
+                return a.code < b.code;
+              });
+  return true;
+}
+
+const DwarfAbbrev *DwarfAbbrevTable::Get(u64 code) const {
+  if (sequential_)
+    return code - 1 < abbrevs_.size() ? &abbrevs_[code - 1] : nullptr;
+  auto it = std::lower_bound(
+      abbrevs_.begin(), abbrevs_.end(), code,
+      [](const DwarfAbbrev &abbrev, u64 code) { return abbrev.code < code; });
+  return it != abbrevs_.end() && it->code == code ? &*it : nullptr;
+}
+
+bool ReadFormValue(DwarfReader *reader, const DwarfUnit &unit, u32 form,
+                   s64 implicit_const, DwarfFormValue *value) {
+  value->form = form;
+  value->value = 0;
+  value->str = nullptr;
+  switch (form) {
+    case DW_FORM_addr:
+      value->value = reader->UNum(unit.address_size);
+      break;
+    case DW_FORM_block1:
+      value->value = reader->U8();
+      reader->Skip(value->value);
+      break;
+    case DW_FORM_block2:
+      value->value = reader->U16();
+      reader->Skip(value->value);
+      break;
+    case DW_FORM_block4:
+      value->value = reader->U32();
+      reader->Skip(value->value);
+      break;
+    case DW_FORM_block:
+    case DW_FORM_exprloc:
+      value->value = reader->ULEB();
+      reader->Skip(value->value);
+      break;
+    case DW_FORM_data1:
+    case DW_FORM_ref1:
+    case DW_FORM_flag:
+    case DW_FORM_strx1:
+    case DW_FORM_addrx1:
+      value->value = reader->U8();
+      break;
+    case DW_FORM_data2:
+    case DW_FORM_ref2:
+    case DW_FORM_strx2:
+    case DW_FORM_addrx2:
+      value->value = reader->U16();
+      break;
+    case DW_FORM_strx3:
+    case DW_FORM_addrx3:
+      value->value = reader->UNum(3);
+      break;
+    case DW_FORM_data4:
+    case DW_FORM_ref4:
+    case DW_FORM_ref_sup4:
+    case DW_FORM_strx4:
+    case DW_FORM_addrx4:
+      value->value = reader->U32();
+      break;
+    case DW_FORM_data8:
+    case DW_FORM_ref8:
+    case DW_FORM_ref_sig8:
+    case DW_FORM_ref_sup8:
+      value->value = reader->U64();
+      break;
+    case DW_FORM_data16:
+      reader->Skip(16);
+      break;
+    case DW_FORM_string:
+      value->str = reader->CStr();
+      break;
+    case DW_FORM_sdata:
+      value->value = (u64)reader->SLEB();
+      break;
+    case DW_FORM_udata:
+    case DW_FORM_ref_udata:
+    case DW_FORM_strx:
+    case DW_FORM_addrx:
+    case DW_FORM_loclistx:
+    case DW_FORM_rnglistx:
+    case DW_FORM_GNU_addr_index:
+    case DW_FORM_GNU_str_index:
+      value->value = reader->ULEB();
+      break;
+    case DW_FORM_strp:
+    case DW_FORM_line_strp:
+    case DW_FORM_sec_offset:
+    case DW_FORM_strp_sup:
+    case DW_FORM_GNU_ref_alt:
+    case DW_FORM_GNU_strp_alt:
+      value->value = reader->Offset(unit.is_64);
+      break;
+    case DW_FORM_ref_addr:
+      value->value = unit.version <= 2 ? reader->UNum(unit.address_size)
+                                       : reader->Offset(unit.is_64);
+      break;
+    case DW_FORM_flag_present:
+      value->value = 1;
+      break;
+    case DW_FORM_implicit_const:
+      value->value = (u64)implicit_const;
+      break;
+    case DW_FORM_indirect: {
+      u32 actual = reader->ULEB();
+      if (actual == DW_FORM_indirect || actual == DW_FORM_implicit_const)
+        return false;
+      return ReadFormValue(reader, unit, actual, 0, value);
+    }
+    default:
+      return false;
+  }
+  return reader->ok();
+}
+
+const char *GetFormString(const DwarfSections &sections, const DwarfUnit &unit,
+                          const DwarfFormValue &value) {
+  switch (value.form) {
+    case DW_FORM_string:
+      return value.str;
+    case DW_FORM_strp:
+      return SectionString(sections.str(), value.value);
+    case DW_FORM_line_strp:
+      return SectionString(sections.line_str(), value.value);
+    case DW_FORM_strx:
+    case DW_FORM_strx1:
+    case DW_FORM_strx2:
+    case DW_FORM_strx3:
+    case DW_FORM_strx4:
+    case DW_FORM_GNU_str_index: {
+      const DwarfSection &str_offsets = sections.str_offsets();
+      u64 size = unit.OffsetSize();
+      u64 entry = unit.str_offsets_base + value.value * size;
+      if (value.value > str_offsets.size / size ||
+          entry > str_offsets.size - size)
+        return nullptr;
+      DwarfReader reader(str_offsets.data, str_offsets.size, entry);
+      return SectionString(sections.str(), reader.UNum(size));
+    }
+    default:
+      return nullptr;
+  }
+}
+
+bool GetFormAddress(const DwarfSections &sections, const DwarfUnit &unit,
+                    const DwarfFormValue &value, u64 *address) {
+  switch (value.form) {
+    case DW_FORM_addr:
+      *address = value.value;
+      return true;
+    case DW_FORM_addrx:
+    case DW_FORM_addrx1:
+    case DW_FORM_addrx2:
+    case DW_FORM_addrx3:
+    case DW_FORM_addrx4:
+    case DW_FORM_GNU_addr_index: {
+      const DwarfSection &addr = sections.addr();
+      u64 size = unit.address_size;
+      u64 entry = unit.addr_base + value.value * size;
+      if (value.value > addr.size / size || entry > addr.size - size)
+        return false;
+      DwarfReader reader(addr.data, addr.size, entry);
+      *address = reader.UNum(size);
+      return true;
+    }
+    default:
+      return false;
+  }
+}
+
+bool ReadUnitDie(const DwarfSections &sections, DwarfUnit *unit,
+                 const DwarfAbbrevTable &abbrevs, const char **comp_dir,
+                 const char **name, u64 *stmt_list) {
+  *comp_dir = nullptr;
+  *name = nullptr;
+  *stmt_list = ~0ULL;
+  DwarfReader reader(sections.info().data, unit->end, unit->die_offset);
+  const DwarfAbbrev *abbrev = abbrevs.Get(reader.ULEB());
+  if (!abbrev)
+    return false;
+
+  // Strings may be given by index before the base of the index.
+  DwarfFormValue comp_dir_value, name_value, low_pc_value;
+  comp_dir_value.form = name_value.form = low_pc_value.form = 0;
+  for (const DwarfAttrSpec &spec : abbrev->specs) {
+    DwarfFormValue value;
+    if (!ReadFormValue(&reader, *unit, spec.form, spec.implicit_const, &value))
+      return false;
+    switch (spec.attr) {
+      case DW_AT_comp_dir:         comp_dir_value = value; break;
+      case DW_AT_name:             name_value = value; break;
+      case DW_AT_low_pc:           low_pc_value = value; break;
+      case DW_AT_stmt_list:        *stmt_list = value.value; break;
+      case DW_AT_str_offsets_base: unit->str_offsets_base = value.value; break;
+      case DW_AT_addr_base:
+      case DW_AT_GNU_addr_base:    unit->addr_base = value.value; break;
+      case DW_AT_rnglists_base:    unit->rnglists_base = value.value; break;
+    }
+  }
+  if (comp_dir_value.form)
+    *comp_dir = GetFormString(sections, *unit, comp_dir_value);
+  if (name_value.form)
+    *name = GetFormString(sections, *unit, name_value);
+  if (low_pc_value.form)
+    GetFormAddress(sections, *unit, low_pc_value, &unit->base_address);
+  return true;
+}
+
+} // namespace SANSYMTOOL_NS
@@ -0,0 +1,306 @@
+//===-- dwarf.h -----------------------------------------------------------===//
+//
+// Based on the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file declares the basic pieces for reading DWARF 2 to 5 from
+// the sections of a mapped ELF file: a cursor, unit headers, abbrevs
+// and attribute values.
+//===----------------------------------------------------------------------===//
+
+#ifndef SANSYMTOOL_HEAD_DWARF_H
+#define SANSYMTOOL_HEAD_DWARF_H
+
+#include "common.h"
+#include "elf_file.h"
+
+#include <string>
+#include <vector>
+
+namespace SANSYMTOOL_NS
+{
+
+// Only the constants used here. See the DWARF 5 standard, chapter 7.
+enum {
+  DW_TAG_lexical_block      = 0x0b,
+  DW_TAG_compile_unit       = 0x11,
+  DW_TAG_inlined_subroutine = 0x1d,
+  DW_TAG_subprogram         = 0x2e,
+  DW_TAG_partial_unit       = 0x3c,
+  DW_TAG_skeleton_unit      = 0x4a,
+};
+
+enum {
+  DW_AT_name              = 0x03,
+  DW_AT_stmt_list         = 0x10,
+  DW_AT_low_pc            = 0x11,
+  DW_AT_high_pc           = 0x12,
+  DW_AT_comp_dir          = 0x1b,
+  DW_AT_abstract_origin   = 0x31,
+  DW_AT_specification     = 0x47,
+  DW_AT_entry_pc          = 0x52,
+  DW_AT_ranges            = 0x55,
+  DW_AT_call_column       = 0x57,
+  DW_AT_call_file         = 0x58,
+  DW_AT_call_line         = 0x59,
+  DW_AT_linkage_name      = 0x6e,
+  DW_AT_str_offsets_base  = 0x72,
+  DW_AT_addr_base         = 0x73,
+  DW_AT_rnglists_base     = 0x74,
+  DW_AT_MIPS_linkage_name = 0x2007,
+  DW_AT_GNU_ranges_base   = 0x2132,
+  DW_AT_GNU_addr_base     = 0x2133,
+};
+
+enum {
+  DW_FORM_addr           = 0x01,
+  DW_FORM_block2         = 0x03,
+  DW_FORM_block4         = 0x04,
+  DW_FORM_data2          = 0x05,
+  DW_FORM_data4          = 0x06,
+  DW_FORM_data8          = 0x07,
+  DW_FORM_string         = 0x08,
+  DW_FORM_block          = 0x09,
+  DW_FORM_block1         = 0x0a,
+  DW_FORM_data1          = 0x0b,
+  DW_FORM_flag           = 0x0c,
+  DW_FORM_sdata          = 0x0d,
+  DW_FORM_strp           = 0x0e,
+  DW_FORM_udata          = 0x0f,
+  DW_FORM_ref_addr       = 0x10,
+  DW_FORM_ref1           = 0x11,
+  DW_FORM_ref2           = 0x12,
+  DW_FORM_ref4           = 0x13,
+  DW_FORM_ref8           = 0x14,
+  DW_FORM_ref_udata      = 0x15,
+  DW_FORM_indirect       = 0x16,
+  DW_FORM_sec_offset     = 0x17,
+  DW_FORM_exprloc        = 0x18,
+  DW_FORM_flag_present   = 0x19,
+  DW_FORM_strx           = 0x1a,
+  DW_FORM_addrx          = 0x1b,
+  DW_FORM_ref_sup4       = 0x1c,
+  DW_FORM_strp_sup       = 0x1d,
+  DW_FORM_data16         = 0x1e,
+  DW_FORM_line_strp      = 0x1f,
+  DW_FORM_ref_sig8       = 0x20,
+  DW_FORM_implicit_const = 0x21,
+  DW_FORM_loclistx       = 0x22,
+  DW_FORM_rnglistx       = 0x23,
+  DW_FORM_ref_sup8       = 0x24,
+  DW_FORM_strx1          = 0x25,
+  DW_FORM_strx2          = 0x26,
+  DW_FORM_strx3          = 0x27,
+  DW_FORM_strx4          = 0x28,
+  DW_FORM_addrx1         = 0x29,
+  DW_FORM_addrx2         = 0x2a,
+  DW_FORM_addrx3         = 0x2b,
+  DW_FORM_addrx4         = 0x2c,
+  DW_FORM_GNU_addr_index = 0x1f01,
+  DW_FORM_GNU_str_index  = 0x1f02,
+  DW_FORM_GNU_ref_alt    = 0x1f20,
+  DW_FORM_GNU_strp_alt   = 0x1f21,
+};
+
+enum {
+  DW_UT_compile       = 0x01,
+  DW_UT_type          = 0x02,
+  DW_UT_partial       = 0x03,
+  DW_UT_skeleton      = 0x04,
+  DW_UT_split_compile = 0x05,
+  DW_UT_split_type    = 0x06,
+};
+
+// Bounds-checked cursor over a section, in host byte order.
+// Reading past the end returns zeros and makes ok() false,
+// so callers only need to check it once in a while.
+class DwarfReader {
+ public:
+  DwarfReader(const u8 *data, uptr size, uptr offset = 0)
+      : data_(data), size_(size), offset_(offset), ok_(offset <= size) {}
+
+  bool ok() const { return ok_; }
+  bool AtEnd() const { return !ok_ || offset_ >= size_; }
+  uptr offset() const { return offset_; }
+  uptr size() const { return size_; }
+  const u8 *data() const { return data_; }
+  void Seek(uptr offset) {
+    offset_ = offset;
+    ok_ = ok_ && offset <= size_;
+  }
+  // Returns nullptr if there aren't |n| bytes left.
+  const u8 *Skip(u64 n);
+
+  u8 U8();
+  u16 U16();
+  u32 U32();
+  u64 U64();
+  // An unsigned integer of |n| bytes, n <= 8.
+  u64 UNum(uptr n);
+  u64 ULEB();
+  s64 SLEB();
+  // Returns nullptr if the string isn't terminated in the section.
+  const char *CStr();
+
+  // Reads an initial length field, and tells if the unit is in
+  // 64-bit DWARF. Returns 0 for a reserved or truncated value.
+  u64 UnitLength(bool *is_64);
+  u64 Offset(bool is_64) { return is_64 ? U64() : U32(); }
+
+ private:
+  const u8 *data_;
+  uptr size_;
+  uptr offset_;
+  bool ok_;
+};
+
+struct DwarfSection {
+  const u8 *data;
+  uptr size;
+};
+
+// The sections of a module taking part in symbolizing, each one read
+// on first use. Compressed ones, with SHF_COMPRESSED or named
+// .zdebug_*, are inflated then, so only what a build touches costs
+// memory. zlib is understood if the library is built with it, and
+// zstd likewise. With a spill prefix, an inflated section is written
+// to "<prefix><name>" and mapped from there, so the next process
+// using it maps it instead of inflating it again. Missing sections,
+// and ones which can't be inflated, are left empty.
+class DwarfSections {
+ public:
+  DwarfSections();
+  ~DwarfSections();
+  DwarfSections(const DwarfSections &) = delete;
+  DwarfSections &operator=(const DwarfSections &) = delete;
+
+  // Returns false if |elf| has no .debug_info or no .debug_line.
+  // |elf| must outlive the sections. |spill_prefix| can be nullptr.
+  bool Load(const ElfFile &elf, const char *spill_prefix);
+
+  const DwarfSection &info() const { return Get(kInfo); }
+  const DwarfSection &abbrev() const { return Get(kAbbrev); }
+  const DwarfSection &line() const { return Get(kLine); }
+  const DwarfSection &line_str() const { return Get(kLineStr); }
+  const DwarfSection &str() const { return Get(kStr); }
+  const DwarfSection &str_offsets() const { return Get(kStrOffsets); }
+  const DwarfSection &addr() const { return Get(kAddr); }
+  const DwarfSection &ranges() const { return Get(kRanges); }
+  const DwarfSection &rnglists() const { return Get(kRnglists); }
+
+  // Frees what was inflated of all but the sections holding strings,
+  // which names in a built DwarfInlineTree point into.
+  void ReleaseUnreferenced();
+
+ private:
+  enum Kind {
+    kInfo, kAbbrev, kLine, kLineStr, kStr, kStrOffsets, kAddr, kRanges,
+    kRnglists, kNumKinds
+  };
+
+  struct Entry {
+    const ElfFile::Section *section;
+    bool gnu_compressed;  // .zdebug_*
+    bool read;
+    DwarfSection view;
+    // Where |view| is when it's inflated, one or the other.
+    u8 *buffer;
+    const void *map;
+    uptr map_size;
+  };
+
+  const DwarfSection &Get(Kind kind) const;
+  // Inflates |entry| into its buffer, or maps its spill file.
+  bool Inflate(Kind kind, Entry *entry) const;
+  // Maps the spill file at |path| if it's |size| bytes long.
+  bool MapSpillFile(const std::string &path, uptr size, Entry *entry) const;
+  void Release(Entry *entry) const;
+
+  const ElfFile *elf_;
+  std::string spill_prefix_;
+  // Sections are read from const methods, like the mapped ones.
+  mutable Entry entries_[kNumKinds];
+};
+
+// Header of a unit in .debug_info, with the bases taken from
+// its unit DIE once it's read.
+struct DwarfUnit {
+  uptr offset;      // Of the header in .debug_info
+  uptr die_offset;  // Of the unit DIE
+  uptr end;         // Of the next unit
+  u16  version;
+  u8   unit_type;
+  u8   address_size;
+  bool is_64;
+  u64  abbrev_offset;
+  u64  str_offsets_base;
+  u64  addr_base;
+  u64  rnglists_base;
+  u64  base_address;  // DW_AT_low_pc of the unit DIE
+
+  // Parses the header at the start of |reader|, which is left at the
+  // end of the unit. Returns false if it's broken or can't be read.
+  bool ReadHeader(DwarfReader *reader);
+  uptr OffsetSize() const { return is_64 ? 8 : 4; }
+};
+
+struct DwarfAttrSpec {
+  u32 attr;
+  u32 form;
+  s64 implicit_const;
+};
+
+struct DwarfAbbrev {
+  u64  code;
+  u32  tag;
+  bool has_children;
+  std::vector<DwarfAttrSpec> specs;
+};
+
+// The abbreviation table of a unit, by abbreviation code.
+class DwarfAbbrevTable {
+ public:
+  DwarfAbbrevTable() : sequential_(true) {}
+  bool Parse(const DwarfSection &abbrev, u64 offset);
+  // Returns nullptr for an unknown code.
+  const DwarfAbbrev *Get(u64 code) const;
+
+ private:
+  std::vector<DwarfAbbrev> abbrevs_;
+  // Codes are usually 1, 2, 3, ... so most are found by index.
+  bool sequential_;
+};
+
+// An attribute value as it is in the DIE. Strings and
+// addresses given by index are resolved separately.
+struct DwarfFormValue {
+  u32 form;
+  u64 value;        // Integers, offsets, references and indexes
+  const char *str;  // DW_FORM_string
+};
+
+// Reads a value of |form| into |value|. Returns false if it's
+// unknown or truncated, after which |reader| can't be used.
+bool ReadFormValue(DwarfReader *reader, const DwarfUnit &unit, u32 form,
+                   s64 implicit_const, DwarfFormValue *value);
+
+// Returns the string of a string form, or nullptr.
+const char *GetFormString(const DwarfSections &sections, const DwarfUnit &unit,
+                          const DwarfFormValue &value);
+// Gets the address of DW_FORM_addr or an indexed address form.
+bool GetFormAddress(const DwarfSections &sections, const DwarfUnit &unit,
+                    const DwarfFormValue &value, u64 *address);
+
+// Reads the unit DIE of |unit|, setting its bases and base address,
+// and gives the attributes of it needed to decode its line table.
+// Missing ones are nullptr or ~0.
+bool ReadUnitDie(const DwarfSections &sections, DwarfUnit *unit,
+                 const DwarfAbbrevTable &abbrevs, const char **comp_dir,
+                 const char **name, u64 *stmt_list);
+
+} // namespace SANSYMTOOL_NS
+
+#endif // SANSYMTOOL_HEAD_DWARF_H
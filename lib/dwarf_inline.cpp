@@ -0,0 +1,498 @@
+//===-- dwarf_inline.cpp --------------------------------------------------===//
+//
+// Based on the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file gives implementation of the inlined call tree.
+//===----------------------------------------------------------------------===//
+
+#include "dwarf_inline.h"
+
+#include <algorithm>
+#include <map>
+#include <unordered_map>
+
+#if SANITIZER_POSIX
+
+#include <elf.h>
+
+#else // SANITIZER_POSIX
+#error ONLY SUPPORT POSIX NOW
+#endif // SANITIZER_POSIX
+
+namespace SANSYMTOOL_NS
+{
+
+enum {
+  DW_RLE_end_of_list    = 0x00,
+  DW_RLE_base_addressx  = 0x01,
+  DW_RLE_startx_endx    = 0x02,
+  DW_RLE_startx_length  = 0x03,
+  DW_RLE_offset_pair    = 0x04,
+  DW_RLE_base_address   = 0x05,
+  DW_RLE_start_end      = 0x06,
+  DW_RLE_start_length   = 0x07,
+};
+
+static const u32 kNoNode = ~0U;
+// Deepest chain of DW_AT_abstract_origin and DW_AT_specification.
+static const int kMaxNameDepth = 8;
+// Roots may overlap, e.g. for nested functions.
+static const int kMaxOverlaps = 8;
+
+typedef std::vector<std::pair<u64, u64>> AddressRanges;
+
+// The attributes of a DIE used here. A zero form means it's missing.
+struct DieAttrs {
+  DwarfFormValue name;
+  DwarfFormValue linkage_name;
+  DwarfFormValue abstract_origin;
+  DwarfFormValue specification;
+  DwarfFormValue low_pc;
+  DwarfFormValue high_pc;
+  DwarfFormValue ranges;
+  DwarfFormValue call_file;
+  DwarfFormValue call_line;
+  DwarfFormValue call_column;
+};
+
+static bool ReadDie(DwarfReader *reader, const DwarfUnit &unit,
+                    const DwarfAbbrev &abbrev, DieAttrs *attrs) {
+  DwarfFormValue *slots[] = {
+      &attrs->name,    &attrs->linkage_name, &attrs->abstract_origin,
+      &attrs->specification, &attrs->low_pc, &attrs->high_pc,
+      &attrs->ranges,  &attrs->call_file,    &attrs->call_line,
+      &attrs->call_column};
+  for (DwarfFormValue *slot : slots)
+    slot->form = 0;
+  for (const DwarfAttrSpec &spec : abbrev.specs) {
+    DwarfFormValue value;
+    if (!ReadFormValue(reader, unit, spec.form, spec.implicit_const, &value))
+      return false;
+    DwarfFormValue *slot = nullptr;
+    switch (spec.attr) {
+      case DW_AT_name:              slot = &attrs->name; break;
+      case DW_AT_linkage_name:
+      case DW_AT_MIPS_linkage_name: slot = &attrs->linkage_name; break;
+      case DW_AT_abstract_origin:   slot = &attrs->abstract_origin; break;
+      case DW_AT_specification:     slot = &attrs->specification; break;
+      case DW_AT_low_pc:            slot = &attrs->low_pc; break;
+      case DW_AT_high_pc:           slot = &attrs->high_pc; break;
+      case DW_AT_ranges:            slot = &attrs->ranges; break;
+      case DW_AT_call_file:         slot = &attrs->call_file; break;
+      case DW_AT_call_line:         slot = &attrs->call_line; break;
+      case DW_AT_call_column:       slot = &attrs->call_column; break;
+    }
+    if (slot)
+      *slot = value;
+  }
+  return true;
+}
+
+class DwarfInlineTree::Builder {
+ public:
+  Builder(const ElfFile &elf, const DwarfSections &sections,
+          const DwarfLineTable &lines, DwarfInlineTree *tree);
+  void Run();
+
+ private:
+  struct Unit {
+    DwarfUnit header;
+    u64 stmt_list;
+    const DwarfAbbrevTable *abbrevs;
+  };
+
+  const DwarfAbbrevTable *GetAbbrevs(u64 offset);
+  const Unit *FindUnit(u64 offset) const;
+  void WalkUnit(const Unit &unit);
+  bool ReadRanges(const Unit &unit, const DieAttrs &attrs,
+                  AddressRanges *ranges) const;
+  bool ReadRangeList(const Unit &unit, const DwarfFormValue &value,
+                     AddressRanges *ranges) const;
+  const char *GetName(const Unit &unit, const DieAttrs &attrs);
+  void ResolveNames(const Unit &unit, const DieAttrs &attrs, int depth,
+                    const char **linkage_name, const char **name);
+  bool InText(u64 address) const;
+
+  const DwarfSections &sections_;
+  const DwarfLineTable &lines_;
+  DwarfInlineTree *tree_;
+  std::vector<std::pair<u64, u64>> text_;
+  std::vector<Unit> units_;
+  // Stable addresses, as units keep pointers to them.
+  std::map<u64, DwarfAbbrevTable> abbrevs_;
+  // Names of DIEs referred to by others, as many inlined calls share
+  // a single abstract origin.
+  std::unordered_map<u64, std::pair<const char *, const char *>> names_;
+  std::vector<std::vector<Range>> children_;
+};
+
+DwarfInlineTree::Builder::Builder(const ElfFile &elf,
+                                  const DwarfSections &sections,
+                                  const DwarfLineTable &lines,
+                                  DwarfInlineTree *tree)
+    : sections_(sections), lines_(lines), tree_(tree) {
+  for (uptr i = 0; i < elf.NumSections(); ++i) {
+    const ElfFile::Section &section = elf.GetSection(i);
+    if ((section.flags & SHF_EXECINSTR) && (section.flags & SHF_ALLOC))
+      text_.push_back(std::make_pair(section.addr, section.size));
+  }
+}
+
+bool DwarfInlineTree::Builder::InText(u64 address) const {
+  for (uptr i = 0; i < text_.size(); ++i)
+    if (address - text_[i].first < text_[i].second)
+      return true;
+  return false;
+}
+
+const DwarfAbbrevTable *DwarfInlineTree::Builder::GetAbbrevs(u64 offset) {
+  auto it = abbrevs_.find(offset);
+  if (it != abbrevs_.end())
+    return &it->second;
+  DwarfAbbrevTable &abbrevs = abbrevs_[offset];
+  return abbrevs.Parse(sections_.abbrev(), offset) ? &abbrevs : nullptr;
+}
+
+const DwarfInlineTree::Builder::Unit *
+DwarfInlineTree::Builder::FindUnit(u64 offset) const {
+  auto it = std::upper_bound(
+      units_.begin(), units_.end(), offset,
+      [](u64 offset, const Unit &unit) { return offset < unit.header.offset; });
+  if (it == units_.begin())
+    return nullptr;
+  --it;
+  return offset >= it->header.die_offset && offset < it->header.end ? &*it
+                                                                     : nullptr;
+}
+
+void DwarfInlineTree::Builder::Run() {
+  // All units are found first, for references across them.
+  DwarfReader reader(sections_.info().data, sections_.info().size);
+  while (!reader.AtEnd()) {
+    Unit unit;
+    if (!unit.header.ReadHeader(&reader)) {
+      if (!reader.ok())
+        break;
+      continue;
+    }
+    u8 type = unit.header.unit_type;
+    if (type != DW_UT_compile && type != DW_UT_partial &&
+        type != DW_UT_skeleton)
+      continue;
+    unit.abbrevs = GetAbbrevs(unit.header.abbrev_offset);
+    const char *comp_dir, *name;
+    if (!unit.abbrevs ||
+        !ReadUnitDie(sections_, &unit.header, *unit.abbrevs, &comp_dir, &name,
+                     &unit.stmt_list))
+      continue;
+    units_.push_back(unit);
+  }
+  for (uptr i = 0; i < units_.size(); ++i)
+    WalkUnit(units_[i]);
+
+  // Lay out children of each node next to each other.
+  auto by_low = [](const Range &a, const Range &b) { return a.low < b.low; };
+  for (uptr i = 0; i < tree_->nodes_.size(); ++i) {
+    std::vector<Range> &children = children_[i];
+    std::sort(children.begin(), children.end(), by_low);
+    tree_->nodes_[i].first_child = tree_->child_ranges_.size();
+    tree_->nodes_[i].n_children = children.size();
+    tree_->child_ranges_.insert(tree_->child_ranges_.end(), children.begin(),
+                                children.end());
+    std::vector<Range>().swap(children);
+  }
+  std::sort(tree_->roots_.begin(), tree_->roots_.end(), by_low);
+  tree_->nodes_.shrink_to_fit();
+  tree_->roots_.shrink_to_fit();
+  std::vector<u64> lows(tree_->roots_.size());
+  for (uptr i = 0; i < lows.size(); ++i)
+    lows[i] = tree_->roots_[i].low;
+  tree_->root_index_.Build(lows.data(), lows.size());
+}
+
+void DwarfInlineTree::Builder::WalkUnit(const Unit &unit) {
+  const DwarfUnit &header = unit.header;
+  DwarfReader reader(sections_.info().data, header.end, header.die_offset);
+  // The node each open DIE puts its children in.
+  std::vector<u32> context;
+  AddressRanges ranges;
+  while (reader.ok() && reader.offset() < header.end) {
+    u64 code = reader.ULEB();
+    if (code == 0) {
+      if (context.empty())
+        break;
+      context.pop_back();
+      continue;
+    }
+    const DwarfAbbrev *abbrev = unit.abbrevs->Get(code);
+    DieAttrs attrs;
+    if (!abbrev || !ReadDie(&reader, header, *abbrev, &attrs))
+      return;
+
+    u32 parent = context.empty() ? kNoNode : context.back();
+    u32 node = parent;
+    bool is_subprogram = abbrev->tag == DW_TAG_subprogram;
+    if (is_subprogram || abbrev->tag == DW_TAG_inlined_subroutine) {
+      ranges.clear();
+      ReadRanges(unit, attrs, &ranges);
+      if (is_subprogram) {
+        // Roots left over from discarded functions are dropped.
+        AddressRanges::iterator end = std::remove_if(
+            ranges.begin(), ranges.end(),
+            [this](const std::pair<u64, u64> &range) {
+              return !InText(range.first);
+            });
+        ranges.erase(end, ranges.end());
+      }
+      // Declarations and abstract instances have no code.
+      node = kNoNode;
+      if (!ranges.empty() && (is_subprogram || parent != kNoNode)) {
+        node = tree_->nodes_.size();
+        tree_->nodes_.push_back(Node());
+        children_.push_back(std::vector<Range>());
+        Frame &frame = tree_->nodes_.back().frame;
+        frame.name = GetName(unit, attrs);
+        frame.call_file = nullptr;
+        frame.call_line = 0;
+        frame.call_column = 0;
+        if (!is_subprogram) {
+          if (attrs.call_file.form)
+            frame.call_file =
+                lines_.UnitFileName(unit.stmt_list, attrs.call_file.value);
+          frame.call_line = attrs.call_line.value;
+          frame.call_column = attrs.call_column.value;
+        }
+        std::vector<Range> &siblings =
+            is_subprogram ? tree_->roots_ : children_[parent];
+        for (uptr i = 0; i < ranges.size(); ++i) {
+          Range range = {ranges[i].first, ranges[i].second, node};
+          siblings.push_back(range);
+        }
+      }
+    }
+    if (abbrev->has_children)
+      context.push_back(node);
+  }
+}
+
+bool DwarfInlineTree::Builder::ReadRanges(const Unit &unit,
+                                          const DieAttrs &attrs,
+                                          AddressRanges *ranges) const {
+  if (attrs.ranges.form)
+    return ReadRangeList(unit, attrs.ranges, ranges);
+  u64 low, high;
+  if (!attrs.low_pc.form || !attrs.high_pc.form ||
+      !GetFormAddress(sections_, unit.header, attrs.low_pc, &low))
+    return false;
+  // DW_AT_high_pc is an offset from DW_AT_low_pc unless it's an address.
+  if (!GetFormAddress(sections_, unit.header, attrs.high_pc, &high))
+    high = low + attrs.high_pc.value;
+  if (low < high)
+    ranges->push_back(std::make_pair(low, high));
+  return true;
+}
+
+bool DwarfInlineTree::Builder::ReadRangeList(const Unit &unit,
+                                             const DwarfFormValue &value,
+                                             AddressRanges *ranges) const {
+  const DwarfUnit &header = unit.header;
+  u64 base = header.base_address;
+  uptr address_size = header.address_size;
+  if (header.version < 5) {
+    const DwarfSection &section = sections_.ranges();
+    DwarfReader reader(section.data, section.size, value.value);
+    u64 max_address = address_size == 8 ? ~0ULL : 0xffffffffULL;
+    while (reader.ok()) {
+      u64 start = reader.UNum(address_size);
+      u64 end = reader.UNum(address_size);
+      if (!reader.ok() || (start == 0 && end == 0))
+        break;
+      if (start == max_address)
+        base = end;
+      else if (start < end)
+        ranges->push_back(std::make_pair(base + start, base + end));
+    }
+    return reader.ok();
+  }
+
+  const DwarfSection &section = sections_.rnglists();
+  u64 offset = value.value;
+  if (value.form == DW_FORM_rnglistx) {
+    // Offsets in the table are from the base.
+    uptr offset_size = header.OffsetSize();
+    DwarfReader table(section.data, section.size,
+                      header.rnglists_base + value.value * offset_size);
+    offset = header.rnglists_base + table.UNum(offset_size);
+    if (!table.ok())
+      return false;
+  }
+  DwarfReader reader(section.data, section.size, offset);
+  auto address_at = [&](u64 index, u64 *address) {
+    DwarfFormValue entry;
+    entry.form = DW_FORM_addrx;
+    entry.value = index;
+    return GetFormAddress(sections_, header, entry, address);
+  };
+  while (reader.ok()) {
+    u64 start = 0, end = 0;
+    switch (reader.U8()) {
+      case DW_RLE_end_of_list:
+        return reader.ok();
+      case DW_RLE_base_addressx:
+        address_at(reader.ULEB(), &base);
+        continue;
+      case DW_RLE_startx_endx:
+        if (!address_at(reader.ULEB(), &start) ||
+            !address_at(reader.ULEB(), &end))
+          continue;
+        break;
+      case DW_RLE_startx_length:
+        if (!address_at(reader.ULEB(), &start))
+          continue;
+        end = start + reader.ULEB();
+        break;
+      case DW_RLE_offset_pair:
+        start = base + reader.ULEB();
+        end = base + reader.ULEB();
+        break;
+      case DW_RLE_base_address:
+        base = reader.UNum(address_size);
+        continue;
+      case DW_RLE_start_end:
+        start = reader.UNum(address_size);
+        end = reader.UNum(address_size);
+        break;
+      case DW_RLE_start_length:
+        start = reader.UNum(address_size);
+        end = start + reader.ULEB();
+        break;
+      default:
+        return false;
+    }
+    if (reader.ok() && start < end)
+      ranges->push_back(std::make_pair(start, end));
+  }
+  return false;
+}
+
+const char *DwarfInlineTree::Builder::GetName(const Unit &unit,
+                                              const DieAttrs &attrs) {
+  const char *linkage_name = nullptr, *name = nullptr;
+  ResolveNames(unit, attrs, 0, &linkage_name, &name);
+  return linkage_name ? linkage_name : name;
+}
+
+// Looks for the names of a DIE, then of the DIEs it refers to, just
+// like llvm-symbolizer does. The first ones found are kept.
+void DwarfInlineTree::Builder::ResolveNames(const Unit &unit,
+                                            const DieAttrs &attrs, int depth,
+                                            const char **linkage_name,
+                                            const char **name) {
+  if (!*linkage_name && attrs.linkage_name.form)
+    *linkage_name = GetFormString(sections_, unit.header, attrs.linkage_name);
+  if (!*name && attrs.name.form)
+    *name = GetFormString(sections_, unit.header, attrs.name);
+  if (*linkage_name || depth >= kMaxNameDepth)
+    return;
+
+  for (const DwarfFormValue *ref : {&attrs.abstract_origin,
+                                    &attrs.specification}) {
+    u64 offset;
+    switch (ref->form) {
+      case DW_FORM_ref1:
+      case DW_FORM_ref2:
+      case DW_FORM_ref4:
+      case DW_FORM_ref8:
+      case DW_FORM_ref_udata:
+        offset = unit.header.offset + ref->value;
+        break;
+      case DW_FORM_ref_addr:
+        offset = ref->value;
+        break;
+      default:
+        continue;
+    }
+    auto cached = names_.find(offset);
+    if (cached == names_.end()) {
+      const char *ref_linkage_name = nullptr, *ref_name = nullptr;
+      const Unit *ref_unit = FindUnit(offset);
+      if (ref_unit) {
+        DwarfReader reader(sections_.info().data, ref_unit->header.end, offset);
+        const DwarfAbbrev *abbrev = ref_unit->abbrevs->Get(reader.ULEB());
+        DieAttrs ref_attrs;
+        if (abbrev && ReadDie(&reader, ref_unit->header, *abbrev, &ref_attrs))
+          ResolveNames(*ref_unit, ref_attrs, depth + 1, &ref_linkage_name,
+                       &ref_name);
+      }
+      cached = names_.insert(std::make_pair(
+          offset, std::make_pair(ref_linkage_name, ref_name))).first;
+    }
+    if (!*linkage_name)
+      *linkage_name = cached->second.first;
+    if (!*name)
+      *name = cached->second.second;
+    if (*linkage_name)
+      return;
+  }
+}
+
+void DwarfInlineTree::Build(const ElfFile &elf, const DwarfSections &sections,
+                            const DwarfLineTable &lines) {
+  nodes_.clear();
+  roots_.clear();
+  root_index_.Clear();
+  child_ranges_.clear();
+  Builder builder(elf, sections, lines, this);
+  builder.Run();
+}
+
+const DwarfInlineTree::Range *
+DwarfInlineTree::FindRange(const Range *begin, const Range *end, u64 address) {
+  const Range *above = std::upper_bound(
+      begin, end, address,
+      [](u64 address, const Range &range) { return address < range.low; });
+  return FindRangeBelow(begin, above, address);
+}
+
+const DwarfInlineTree::Range *
+DwarfInlineTree::FindRangeBelow(const Range *begin, const Range *above,
+                                u64 address) {
+  const Range *it = above;
+  for (int i = 0; i < kMaxOverlaps && it != begin; ++i) {
+    --it;
+    if (address < it->high)
+      return it;
+  }
+  return nullptr;
+}
+
+bool DwarfInlineTree::Lookup(u64 address, std::vector<Frame> *stack) const {
+  stack->clear();
+  const Range *range = FindRangeBelow(
+      roots_.data(), roots_.data() + root_index_.UpperBound(address), address);
+  while (range) {
+    const Node &node = nodes_[range->node];
+    stack->push_back(node.frame);
+    const Range *children = child_ranges_.data() + node.first_child;
+    range = FindRange(children, children + node.n_children, address);
+  }
+  std::reverse(stack->begin(), stack->end());
+  return !stack->empty();
+}
+
+void DwarfInlineTree::GetBoundaries(std::vector<u64> *addresses) const {
+  for (uptr i = 0; i < roots_.size(); ++i) {
+    addresses->push_back(roots_[i].low);
+    addresses->push_back(roots_[i].high);
+  }
+  for (uptr i = 0; i < child_ranges_.size(); ++i) {
+    addresses->push_back(child_ranges_[i].low);
+    addresses->push_back(child_ranges_[i].high);
+  }
+}
+
+} // namespace SANSYMTOOL_NS
@@ -0,0 +1,89 @@
+//===-- dwarf_inline.h ----------------------------------------------------===//
+//
+// Based on the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file declares a tree of functions and their inlined calls
+// built from .debug_info.
+//===----------------------------------------------------------------------===//
+
+#ifndef SANSYMTOOL_HEAD_DWARF_INLINE_H
+#define SANSYMTOOL_HEAD_DWARF_INLINE_H
+
+#include "address_index.h"
+#include "dwarf.h"
+#include "dwarf_line.h"
+
+namespace SANSYMTOOL_NS
+{
+
+// Every DW_TAG_subprogram with code is the root of a tree, whose
+// nodes are its DW_TAG_inlined_subroutine DIEs, nested as in the
+// source. Lexical blocks are looked through. Each node keeps the
+// address ranges of its children sorted, so finding the inlining
+// stack of an address is a search at each level: through an
+// AddressIndex for the functions, and a binary search below them.
+class DwarfInlineTree {
+ public:
+  // A function in the stack of an address.
+  struct Frame {
+    const char *name;  // Linkage name if there is one, or nullptr
+    // Where it's inlined in the next frame, or nothing for the last.
+    const char *call_file;
+    u32 call_line;
+    u32 call_column;
+  };
+
+  DwarfInlineTree() {}
+  DwarfInlineTree(const DwarfInlineTree &) = delete;
+  DwarfInlineTree &operator=(const DwarfInlineTree &) = delete;
+
+  // Names point into |sections| and call files into |lines|,
+  // so both must outlive the tree. Like in DwarfLineTable,
+  // functions not in an executable section of |elf| are dropped.
+  void Build(const ElfFile &elf, const DwarfSections &sections,
+             const DwarfLineTable &lines);
+  bool empty() const { return roots_.empty(); }
+
+  // Fills |stack| with the functions at |address|, innermost first.
+  // Returns false if it's in no function.
+  bool Lookup(u64 address, std::vector<Frame> *stack) const;
+
+  // Appends where every function and inlined call starts and ends.
+  void GetBoundaries(std::vector<u64> *addresses) const;
+
+ private:
+  struct Range {
+    u64 low;
+    u64 high;
+    u32 node;
+  };
+  struct Node {
+    Frame frame;
+    u32 first_child;  // In child_ranges_
+    u32 n_children;
+  };
+
+  class Builder;
+
+  // Returns the range in [begin, end) containing |address|, or nullptr.
+  static const Range *FindRange(const Range *begin, const Range *end,
+                                u64 address);
+  // Same, with |above| the first range in [begin, end) starting
+  // after |address|.
+  static const Range *FindRangeBelow(const Range *begin, const Range *above,
+                                     u64 address);
+
+  std::vector<Node> nodes_;
+  std::vector<Range> roots_;
+  // Over the lows of |roots_|.
+  AddressIndex root_index_;
+  std::vector<Range> child_ranges_;
+};
+
+} // namespace SANSYMTOOL_NS
+
+#endif // SANSYMTOOL_HEAD_DWARF_INLINE_H
@@ -0,0 +1,366 @@
+//===-- dwarf_line.cpp ----------------------------------------------------===//
+//
+// Based on the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file gives implementation of the .debug_line decoder.
+//===----------------------------------------------------------------------===//
+
+#include "dwarf_line.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if SANITIZER_POSIX
+
+#include <elf.h>
+
+#else // SANITIZER_POSIX
+#error ONLY SUPPORT POSIX NOW
+#endif // SANITIZER_POSIX
+
+namespace SANSYMTOOL_NS
+{
+
+enum {
+  DW_LNS_copy               = 0x01,
+  DW_LNS_advance_pc         = 0x02,
+  DW_LNS_advance_line       = 0x03,
+  DW_LNS_set_file           = 0x04,
+  DW_LNS_set_column         = 0x05,
+  DW_LNS_const_add_pc       = 0x08,
+  DW_LNS_fixed_advance_pc   = 0x09,
+  DW_LNE_end_sequence       = 0x01,
+  DW_LNE_set_address        = 0x02,
+  DW_LNCT_path              = 0x01,
+  DW_LNCT_directory_index   = 0x02,
+};
+
+// File of a row whose file index isn't in the file table.
+static const u32 kNoFile = ~0U;
+
+struct DwarfLineTable::Builder {
+  const DwarfSections *sections;
+  // Address ranges of executable sections.
+  std::vector<std::pair<u64, u64>> text;
+  // Rows of all the sequences, and where each sequence starts.
+  std::vector<u64> addresses;
+  std::vector<Row> rows;
+  std::vector<uptr> sequences;
+  std::unordered_map<std::string, u32> files;
+
+  bool InText(u64 address) const {
+    for (uptr i = 0; i < text.size(); ++i)
+      if (address - text[i].first < text[i].second)
+        return true;
+    return false;
+  }
+};
+
+static bool IsAbsolute(const char *path) { return path && path[0] == '/'; }
+
+u32 DwarfLineTable::InternFile(Builder *builder, const std::string &path) {
+  auto inserted = builder->files.insert(
+      std::make_pair(path, (u32)file_offsets_.size()));
+  if (inserted.second) {
+    file_offsets_.push_back(file_names_.size());
+    file_names_.insert(file_names_.end(), path.begin(), path.end());
+    file_names_.push_back('\0');
+  }
+  return inserted.first->second;
+}
+
+void DwarfLineTable::Build(const ElfFile &elf, const DwarfSections &sections) {
+  Builder builder;
+  builder.sections = &sections;
+  for (uptr i = 0; i < elf.NumSections(); ++i) {
+    const ElfFile::Section &section = elf.GetSection(i);
+    if ((section.flags & SHF_EXECINSTR) && (section.flags & SHF_ALLOC))
+      builder.text.push_back(std::make_pair(section.addr, section.size));
+  }
+
+  DwarfReader reader(sections.info().data, sections.info().size);
+  DwarfAbbrevTable abbrevs;
+  u64 abbrev_offset = ~0ULL;
+  while (!reader.AtEnd()) {
+    DwarfUnit unit;
+    if (!unit.ReadHeader(&reader)) {
+      // The rest can't be found without the length of this one.
+      if (!reader.ok())
+        break;
+      continue;
+    }
+    if (unit.unit_type != DW_UT_compile && unit.unit_type != DW_UT_partial &&
+        unit.unit_type != DW_UT_skeleton)
+      continue;
+    // Units usually share a single abbreviation table.
+    if (unit.abbrev_offset != abbrev_offset) {
+      abbrev_offset = unit.abbrev_offset;
+      if (!abbrevs.Parse(sections.abbrev(), abbrev_offset)) {
+        abbrev_offset = ~0ULL;
+        continue;
+      }
+    }
+    const char *comp_dir, *name;
+    u64 stmt_list;
+    if (!ReadUnitDie(sections, &unit, abbrevs, &comp_dir, &name, &stmt_list) ||
+        stmt_list == ~0ULL || unit_files_.count(stmt_list))
+      continue;
+    DecodeProgram(&builder, unit, stmt_list, comp_dir);
+  }
+
+  // Sequences are put in order as a whole, while
+  // the rows of each one are already in order.
+  std::vector<uptr> order(builder.sequences.size());
+  for (uptr i = 0; i < order.size(); ++i)
+    order[i] = i;
+  std::stable_sort(order.begin(), order.end(), [&](uptr a, uptr b) {
+    return builder.addresses[builder.sequences[a]] <
+           builder.addresses[builder.sequences[b]];
+  });
+  addresses_.clear();
+  rows_.clear();
+  addresses_.reserve(builder.addresses.size());
+  rows_.reserve(builder.rows.size());
+  for (uptr i = 0; i < order.size(); ++i) {
+    uptr begin = builder.sequences[order[i]];
+    uptr end = order[i] + 1 < builder.sequences.size()
+                   ? builder.sequences[order[i] + 1]
+                   : builder.addresses.size();
+    addresses_.insert(addresses_.end(), builder.addresses.begin() + begin,
+                      builder.addresses.begin() + end);
+    rows_.insert(rows_.end(), builder.rows.begin() + begin,
+                 builder.rows.begin() + end);
+  }
+  index_.Build(addresses_.data(), addresses_.size());
+  file_names_.shrink_to_fit();
+}
+
+bool DwarfLineTable::DecodeProgram(Builder *builder, const DwarfUnit &unit,
+                                   u64 offset, const char *comp_dir) {
+  const DwarfSection &section = builder->sections->line();
+  if (offset >= section.size)
+    return false;
+  DwarfReader reader(section.data, section.size, offset);
+  DwarfUnit line_unit = unit;
+  u64 length = reader.UnitLength(&line_unit.is_64);
+  if (!reader.ok() || length > section.size - reader.offset())
+    return false;
+  // Nothing of the table is read beyond its end.
+  uptr end = reader.offset() + length;
+  reader = DwarfReader(section.data, end, reader.offset());
+
+  line_unit.version = reader.U16();
+  if (line_unit.version < 2 || line_unit.version > 5)
+    return false;
+  if (line_unit.version >= 5) {
+    line_unit.address_size = reader.U8();
+    reader.U8();  // segment_selector_size
+  }
+  u64 header_length = reader.Offset(line_unit.is_64);
+  uptr program = reader.offset() + header_length;
+  u8 min_inst_length = reader.U8();
+  if (line_unit.version >= 4)
+    reader.U8();  // maximum_operations_per_instruction
+  reader.U8();    // default_is_stmt
+  s8 line_base = (s8)reader.U8();
+  u8 line_range = reader.U8();
+  u8 opcode_base = reader.U8();
+  const u8 *opcode_lengths = opcode_base ? reader.Skip(opcode_base - 1) : nullptr;
+  if (!reader.ok() || line_range == 0 || opcode_base == 0)
+    return false;
+
+  std::vector<const char *> dirs;
+  std::vector<std::pair<const char *, u64>> files;
+  if (line_unit.version < 5) {
+    // Index 0 is the compilation directory for directories, and
+    // nothing for files.
+    dirs.push_back(comp_dir);
+    files.push_back(std::make_pair(nullptr, 0));
+    while (const char *dir = reader.CStr()) {
+      if (!*dir)
+        break;
+      dirs.push_back(dir);
+    }
+    while (const char *file = reader.CStr()) {
+      if (!*file)
+        break;
+      u64 dir = reader.ULEB();
+      reader.ULEB();  // mtime
+      reader.ULEB();  // length
+      files.push_back(std::make_pair(file, dir));
+    }
+  } else {
+    // Both tables come with their own format, which only
+    // matters here for paths and directory indexes.
+    for (int table = 0; table < 2 && reader.ok(); ++table) {
+      std::vector<std::pair<u64, u64>> format(reader.U8());
+      for (uptr i = 0; i < format.size(); ++i) {
+        format[i].first = reader.ULEB();
+        format[i].second = reader.ULEB();
+      }
+      u64 count = reader.ULEB();
+      for (u64 i = 0; i < count && reader.ok(); ++i) {
+        const char *path = nullptr;
+        u64 dir = 0;
+        for (uptr j = 0; j < format.size(); ++j) {
+          DwarfFormValue value;
+          if (!ReadFormValue(&reader, line_unit, format[j].second, 0, &value))
+            return false;
+          if (format[j].first == DW_LNCT_path)
+            path = GetFormString(*builder->sections, line_unit, value);
+          else if (format[j].first == DW_LNCT_directory_index)
+            dir = value.value;
+        }
+        if (table == 0)
+          dirs.push_back(path);
+        else
+          files.push_back(std::make_pair(path, dir));
+      }
+    }
+  }
+  if (!reader.ok())
+    return false;
+
+  // Make the paths of all the files.
+  std::vector<u32> &file_ids = unit_files_[offset];
+  file_ids.resize(files.size(), kNoFile);
+  for (uptr i = 0; i < files.size(); ++i) {
+    const char *name = files[i].first;
+    if (!name)
+      continue;
+    std::string path;
+    const char *dir = files[i].second < dirs.size() ? dirs[files[i].second]
+                                                    : nullptr;
+    if (!IsAbsolute(name) && dir && *dir) {
+      if (!IsAbsolute(dir) && comp_dir && *comp_dir) {
+        path = comp_dir;
+        path += '/';
+      }
+      path += dir;
+      path += '/';
+    }
+    path += name;
+    file_ids[i] = InternFile(builder, path);
+  }
+
+  // Run the state machine.
+  reader.Seek(program);
+  u64 address = 0;
+  u64 file = 1;
+  u64 line = 1;
+  u64 column = 0;
+  uptr sequence = builder->addresses.size();
+  bool sequence_ok = true;
+  auto emit_row = [&](bool end_sequence) {
+    if (builder->addresses.size() > sequence &&
+        address < builder->addresses.back())
+      sequence_ok = false;
+    Row row;
+    row.file = file < file_ids.size() ? file_ids[file] : kNoFile;
+    row.line = (u32)line;
+    row.column = column > 0xffff ? 0xffff : (u16)column;
+    row.end_sequence = end_sequence;
+    builder->addresses.push_back(address);
+    builder->rows.push_back(row);
+    if (!end_sequence)
+      return;
+    // Keep the sequence only if it's in order and in text.
+    if (sequence_ok && builder->InText(builder->addresses[sequence])) {
+      builder->sequences.push_back(sequence);
+    } else {
+      builder->addresses.resize(sequence);
+      builder->rows.resize(sequence);
+    }
+    sequence = builder->addresses.size();
+    sequence_ok = true;
+    address = 0;
+    file = 1;
+    line = 1;
+    column = 0;
+  };
+
+  while (reader.ok() && reader.offset() < end) {
+    u8 opcode = reader.U8();
+    if (opcode >= opcode_base) {
+      u8 adjusted = opcode - opcode_base;
+      address += (u64)(adjusted / line_range) * min_inst_length;
+      line += line_base + adjusted % line_range;
+      emit_row(false);
+      continue;
+    }
+    switch (opcode) {
+      case 0: {
+        u64 len = reader.ULEB();
+        uptr next = reader.offset() + len;
+        if (len == 0 || len > end - reader.offset()) {
+          reader.Skip(len);
+          break;
+        }
+        u8 sub_opcode = reader.U8();
+        if (sub_opcode == DW_LNE_end_sequence)
+          emit_row(true);
+        else if (sub_opcode == DW_LNE_set_address && len - 1 <= 8)
+          address = reader.UNum(len - 1);
+        reader.Seek(next);
+        break;
+      }
+      case DW_LNS_copy:
+        emit_row(false);
+        break;
+      case DW_LNS_advance_pc:
+        address += reader.ULEB() * min_inst_length;
+        break;
+      case DW_LNS_advance_line:
+        line += reader.SLEB();
+        break;
+      case DW_LNS_set_file:
+        file = reader.ULEB();
+        break;
+      case DW_LNS_set_column:
+        column = reader.ULEB();
+        break;
+      case DW_LNS_const_add_pc:
+        address += (u64)((255 - opcode_base) / line_range) * min_inst_length;
+        break;
+      case DW_LNS_fixed_advance_pc:
+        address += reader.U16();
+        break;
+      default:
+        // Skip the operands of the others, known or not.
+        for (u8 i = 0; i < opcode_lengths[opcode - 1]; ++i)
+          reader.ULEB();
+        break;
+    }
+  }
+  // Drop a sequence left without its end.
+  builder->addresses.resize(sequence);
+  builder->rows.resize(sequence);
+  return reader.ok();
+}
+
+bool DwarfLineTable::Lookup(u64 address, const char **file, u32 *line,
+                            u32 *column) const {
+  uptr above = index_.UpperBound(address);
+  if (above == 0)
+    return false;
+  const Row &row = rows_[above - 1];
+  if (row.end_sequence)
+    return false;
+  *file = FileName(row.file);
+  *line = row.line;
+  *column = row.column;
+  return true;
+}
+
+const char *DwarfLineTable::UnitFileName(u64 stmt_list, u64 index) const {
+  auto it = unit_files_.find(stmt_list);
+  if (it == unit_files_.end() || index >= it->second.size())
+    return nullptr;
+  return FileName(it->second[index]);
+}
+
+} // namespace SANSYMTOOL_NS
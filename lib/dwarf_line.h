@@ -0,0 +1,81 @@
+//===-- dwarf_line.h ------------------------------------------------------===//
+//
+// Based on the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file declares an address to line table decoded from .debug_line.
+//===----------------------------------------------------------------------===//
+
+#ifndef SANSYMTOOL_HEAD_DWARF_LINE_H
+#define SANSYMTOOL_HEAD_DWARF_LINE_H
+
+#include "address_index.h"
+#include "dwarf.h"
+
+#include <string>
+#include <unordered_map>
+
+namespace SANSYMTOOL_NS
+{
+
+// Rows of the line tables of all the units in a module, sorted by
+// address. Addresses are kept apart from the rest of the rows, so
+// that searching them touches as little memory as possible. File
+// names are made absolute like llvm-symbolizer does, and each one
+// is kept once for the whole module.
+class DwarfLineTable {
+ public:
+  DwarfLineTable() {}
+  DwarfLineTable(const DwarfLineTable &) = delete;
+  DwarfLineTable &operator=(const DwarfLineTable &) = delete;
+
+  // Decodes the line table of every unit in |sections|. Sequences
+  // not starting in an executable section of |elf| are dropped,
+  // as they are left over from discarded functions.
+  void Build(const ElfFile &elf, const DwarfSections &sections);
+  bool empty() const { return addresses_.empty(); }
+  uptr NumRows() const { return addresses_.size(); }
+  u64 RowAddress(uptr i) const { return addresses_[i]; }
+
+  // Finds the row covering |address|. Returns false if there is none.
+  // |file| stays valid as long as the table, or is nullptr if unknown.
+  bool Lookup(u64 address, const char **file, u32 *line, u32 *column) const;
+
+  // Returns the name of file |index| of the unit whose line table is
+  // at |stmt_list|, as used by DW_AT_call_file, or nullptr.
+  const char *UnitFileName(u64 stmt_list, u64 index) const;
+
+ private:
+  struct Row {
+    u32 file;
+    u32 line;
+    u16 column;
+    u16 end_sequence;
+  };
+
+  // What's needed while building.
+  struct Builder;
+
+  bool DecodeProgram(Builder *builder, const DwarfUnit &unit,
+                     u64 offset, const char *comp_dir);
+  u32 InternFile(Builder *builder, const std::string &path);
+  const char *FileName(u32 file) const {
+    return file < file_offsets_.size() ? &file_names_[file_offsets_[file]]
+                                       : nullptr;
+  }
+
+  std::vector<u64> addresses_;
+  AddressIndex index_;
+  std::vector<Row> rows_;
+  std::vector<char> file_names_;
+  std::vector<u32> file_offsets_;
+  // Files of each unit, by the offset of its line table.
+  std::unordered_map<u64, std::vector<u32>> unit_files_;
+};
+
+} // namespace SANSYMTOOL_NS
+
+#endif // SANSYMTOOL_HEAD_DWARF_LINE_H
@@ -0,0 +1,176 @@
+//===-- elf_file.cpp ------------------------------------------------------===//
+//
+// Based on the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file gives implementation of the minimal ELF reader.
+//===----------------------------------------------------------------------===//
+
+#include "elf_file.h"
+
+#include <cstdio>
+#include <cstring>
+
+#if SANITIZER_POSIX
+
+#include <elf.h>
+#include <sys/stat.h>
+
+#else // SANITIZER_POSIX
+#error ONLY SUPPORT POSIX NOW
+#endif // SANITIZER_POSIX
+
+namespace SANSYMTOOL_NS
+{
+
+ElfFile::ElfFile() : data_(nullptr), size_(0), is_64_(false) {}
+
+ElfFile::~ElfFile() { Close(); }
+
+void ElfFile::Close() {
+  UnmapFromMemory(data_, size_);
+  data_ = nullptr;
+  size_ = 0;
+  sections_.clear();
+}
+
+bool ElfFile::Open(const char *path) {
+  Close();
+  uptr size = 0;
+  const u8 *data = (const u8 *)MapFileToMemory(path, &size);
+  if (!data)
+    return false;
+  data_ = data;
+  size_ = size;
+
+  bool ok = false;
+  if (size_ >= EI_NIDENT && !std::memcmp(data_, ELFMAG, SELFMAG)) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    bool native = data_[EI_DATA] == ELFDATA2LSB;
+#else
+    bool native = data_[EI_DATA] == ELFDATA2MSB;
+#endif
+    if (native && data_[EI_CLASS] == ELFCLASS64) {
+      is_64_ = true;
+      ok = ReadSections<Elf64_Ehdr, Elf64_Shdr>();
+    } else if (native && data_[EI_CLASS] == ELFCLASS32) {
+      is_64_ = false;
+      ok = ReadSections<Elf32_Ehdr, Elf32_Shdr>();
+    }
+  }
+  if (!ok)
+    Close();
+  return ok;
+}
+
+template <typename Ehdr, typename Shdr>
+bool ElfFile::ReadSections() {
+  if (size_ < sizeof(Ehdr))
+    return false;
+  const Ehdr *ehdr = (const Ehdr *)data_;
+  if (ehdr->e_shoff == 0 || ehdr->e_shentsize != sizeof(Shdr))
+    return false;
+  if (ehdr->e_shoff > size_ ||
+      (u64)ehdr->e_shnum * sizeof(Shdr) > size_ - ehdr->e_shoff)
+    return false;
+  const Shdr *shdrs = (const Shdr *)(data_ + ehdr->e_shoff);
+  if (ehdr->e_shstrndx >= ehdr->e_shnum)
+    return false;
+  const Shdr &strtab = shdrs[ehdr->e_shstrndx];
+  if (strtab.sh_offset > size_ || strtab.sh_size > size_ - strtab.sh_offset)
+    return false;
+  const char *names = (const char *)data_ + strtab.sh_offset;
+
+  sections_.resize(ehdr->e_shnum);
+  for (uptr i = 0; i < sections_.size(); ++i) {
+    const Shdr &shdr = shdrs[i];
+    Section &section = sections_[i];
+    // Names must be terminated within the string table.
+    section.name = "";
+    if (shdr.sh_name < strtab.sh_size &&
+        std::memchr(names + shdr.sh_name, '\0',
+                    strtab.sh_size - shdr.sh_name))
+      section.name = names + shdr.sh_name;
+    section.type    = shdr.sh_type;
+    section.flags   = shdr.sh_flags;
+    section.addr    = shdr.sh_addr;
+    section.offset  = shdr.sh_offset;
+    section.size    = shdr.sh_size;
+    section.link    = shdr.sh_link;
+    section.info    = shdr.sh_info;
+    section.entsize = shdr.sh_entsize;
+  }
+  return true;
+}
+
+const ElfFile::Section *ElfFile::FindSection(const char *name) const {
+  for (uptr i = 0; i < sections_.size(); ++i)
+    if (0 == std::strcmp(sections_[i].name, name))
+      return &sections_[i];
+  return nullptr;
+}
+
+const u8 *ElfFile::SectionData(const Section &section) const {
+  if (section.type == SHT_NOBITS || section.type == SHT_NULL)
+    return nullptr;
+  if (section.offset > size_ || section.size > size_ - section.offset)
+    return nullptr;
+  return data_ + section.offset;
+}
+
+uptr ElfFile::GetBuildId(u8 *id, uptr size) const {
+  // Nhdr is the same for both classes.
+  for (uptr i = 0; i < sections_.size(); ++i) {
+    if (sections_[i].type != SHT_NOTE)
+      continue;
+    const u8 *note = SectionData(sections_[i]);
+    if (!note)
+      continue;
+    const u8 *end = note + sections_[i].size;
+    while ((uptr)(end - note) >= sizeof(Elf64_Nhdr)) {
+      const Elf64_Nhdr *nhdr = (const Elf64_Nhdr *)note;
+      uptr name_size = (nhdr->n_namesz + 3) & ~3U;
+      uptr desc_size = (nhdr->n_descsz + 3) & ~3U;
+      const u8 *name = note + sizeof(Elf64_Nhdr);
+      if ((uptr)(end - name) < name_size + desc_size)
+        break;
+      const u8 *desc = name + name_size;
+      if (nhdr->n_type == NT_GNU_BUILD_ID && nhdr->n_namesz == 4 &&
+          !std::memcmp(name, "GNU", 4)) {
+        if (nhdr->n_descsz == 0 || nhdr->n_descsz > size)
+          return 0;
+        std::memcpy(id, desc, nhdr->n_descsz);
+        return nhdr->n_descsz;
+      }
+      note = desc + desc_size;
+    }
+  }
+  return 0;
+}
+
+bool GetModuleIdentity(const char *path, char *buffer, uptr size) {
+  CHECK_GT(size, 0);
+  ElfFile elf;
+  u8 id[64];
+  uptr id_size = elf.Open(path) ? elf.GetBuildId(id, sizeof(id)) : 0;
+  if (id_size && size > 2 * id_size + 1) {
+    buffer[0] = 'b';
+    for (uptr i = 0; i < id_size; ++i)
+      std::snprintf(buffer + 1 + 2 * i, 3, "%02x", id[i]);
+    return true;
+  }
+
+  struct stat st;
+  if (stat(path, &st))
+    return false;
+  int len = std::snprintf(
+      buffer, size, "s%llx-m%llx.%lx-i%llx-d%llx", (u64)st.st_size,
+      (u64)st.st_mtim.tv_sec, (unsigned long)st.st_mtim.tv_nsec,
+      (u64)st.st_ino, (u64)st.st_dev);
+  return len > 0 && (uptr)len < size;
+}
+
+} // namespace SANSYMTOOL_NS
@@ -0,0 +1,81 @@
+//===-- elf_file.h --------------------------------------------------------===//
+//
+// Based on the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file declares a minimal reader of ELF files, for the parts of the
+// tool working on modules directly instead of through a symbolizer.
+//===----------------------------------------------------------------------===//
+
+#ifndef SANSYMTOOL_HEAD_ELF_FILE_H
+#define SANSYMTOOL_HEAD_ELF_FILE_H
+
+#include "common.h"
+
+#include <vector>
+
+namespace SANSYMTOOL_NS
+{
+
+// Read-only view of an ELF file mapped into memory. Both ELF32 and
+// ELF64 are understood, but only in the byte order of the host.
+// Section headers of both classes are converted to ElfFile::Section.
+class ElfFile {
+ public:
+  struct Section {
+    const char *name;
+    u32 type;
+    u64 flags;
+    u64 addr;
+    u64 offset;
+    u64 size;
+    u32 link;
+    u32 info;
+    u64 entsize;
+  };
+
+  ElfFile();
+  ~ElfFile();
+  ElfFile(const ElfFile &) = delete;
+  ElfFile &operator=(const ElfFile &) = delete;
+
+  // Returns false if |path| can't be mapped or isn't a valid ELF file.
+  bool Open(const char *path);
+  void Close();
+  bool IsOpen() const { return data_ != nullptr; }
+
+  bool is_64() const { return is_64_; }
+  const u8 *data() const { return data_; }
+  uptr size() const { return size_; }
+
+  uptr NumSections() const { return sections_.size(); }
+  const Section &GetSection(uptr i) const { return sections_[i]; }
+  const Section *FindSection(const char *name) const;
+  // Returns nullptr for a section without contents in the file.
+  const u8 *SectionData(const Section &section) const;
+
+  // Copies the NT_GNU_BUILD_ID note into |id|.
+  // Returns its length, or 0 if there is none.
+  uptr GetBuildId(u8 *id, uptr size) const;
+
+ private:
+  template <typename Ehdr, typename Shdr>
+  bool ReadSections();
+
+  const u8 *data_;
+  uptr size_;
+  bool is_64_;
+  std::vector<Section> sections_;
+};
+
+// Fills in a name for the content of the module at |path|, which
+// changes whenever it's rebuilt: its build-id if there is one, or
+// else its size, mtime and inode. Returns false if it isn't readable.
+bool GetModuleIdentity(const char *path, char *buffer, uptr size);
+
+} // namespace SANSYMTOOL_NS
+
+#endif // SANSYMTOOL_HEAD_ELF_FILE_H
@@ -0,0 +1,265 @@
+//===-- elf_symbolizer.cpp ------------------------------------------------===//
+//
+// Based on the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file gives implementation of the ELF symbol table symbolizer.
+//===----------------------------------------------------------------------===//
+
+#include "elf_symbolizer.h"
+#include "disk_cache.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#if SANITIZER_POSIX
+
+#include <elf.h>
+
+#else // SANITIZER_POSIX
+#error ONLY SUPPORT POSIX NOW
+#endif // SANITIZER_POSIX
+
+namespace SANSYMTOOL_NS
+{
+
+ElfSymbolizer::ElfSymbolizer(SymbolizerTool *next_tool, const char *debug_dir,
+                             const char *spill_dir)
+    : InProcessSymbolizer(next_tool),
+      debug_dir_(debug_dir && debug_dir[0] ? strdup(debug_dir) : nullptr),
+      spill_dir_(spill_dir && spill_dir[0] ? strdup(spill_dir) : nullptr) {}
+
+ElfSymbolizer::~ElfSymbolizer() {
+  std::free(debug_dir_);
+  std::free(spill_dir_);
+}
+
+ElfSymbolizer::Module *ElfSymbolizer::GetModule(const char *module_name) {
+  if (Module *module = modules_.Find(module_name))
+    return module;
+
+  // A module which can't be read is kept too, with no symbols.
+  Module *module = modules_.Add(module_name);
+  module->names = &module->elf;
+  module->dwarf = &module->elf;
+  if (module->elf.Open(module_name)) {
+    // .dynsym is a subset of .symtab, so it's only used without the latter.
+    const ElfFile::Section *symtab = nullptr, *dynsym = nullptr;
+    for (uptr i = 0; i < module->elf.NumSections(); ++i) {
+      const ElfFile::Section &section = module->elf.GetSection(i);
+      if (section.type == SHT_SYMTAB)
+        symtab = &section;
+      else if (section.type == SHT_DYNSYM && !dynsym)
+        dynsym = &section;
+    }
+    bool has_dwarf = module->elf.FindSection(".debug_info") != nullptr;
+    if ((!symtab || !has_dwarf) &&
+        OpenDebugFile(module_name, module->elf, debug_dir_, &module->debug)) {
+      for (uptr i = 0; i < module->debug.NumSections() && !symtab; ++i) {
+        if (module->debug.GetSection(i).type == SHT_SYMTAB) {
+          symtab = &module->debug.GetSection(i);
+          module->names = &module->debug;
+        }
+      }
+      if (!has_dwarf)
+        module->dwarf = &module->debug;
+    }
+    const ElfFile::Section *table = symtab ? symtab : dynsym;
+    if (table && module->names->is_64())
+      ReadSymbols<Elf64_Sym>(module, *module->names, *table);
+    else if (table)
+      ReadSymbols<Elf32_Sym>(module, *module->names, *table);
+  }
+  if (module->symbols.empty()) {
+    module->elf.Close();
+    module->debug.Close();
+  }
+  return module;
+}
+
+template <typename Sym>
+void ElfSymbolizer::ReadSymbols(Module *module, const ElfFile &elf,
+                                const ElfFile::Section &table) {
+  if (table.entsize != sizeof(Sym) || table.link >= elf.NumSections())
+    return;
+  const Sym *syms = (const Sym *)elf.SectionData(table);
+  const ElfFile::Section &strtab = elf.GetSection(table.link);
+  const char *strings = (const char *)elf.SectionData(strtab);
+  if (!syms || !strings || strtab.offset > ~0U)
+    return;
+
+  uptr n = table.size / sizeof(Sym);
+  u32 file = 0;
+  for (uptr i = 0; i < n; ++i) {
+    const Sym &sym = syms[i];
+    // The name must be terminated within the string table.
+    u32 name = 0;
+    if (sym.st_name != 0 && sym.st_name < strtab.size &&
+        strtab.offset + sym.st_name <= ~0U &&
+        std::memchr(strings + sym.st_name, '\0', strtab.size - sym.st_name))
+      name = (u32)(strtab.offset + sym.st_name);
+    int type = ELF64_ST_TYPE(sym.st_info);
+    if (type == STT_FILE) {
+      file = name;
+      continue;
+    }
+    if (name == 0)
+      continue;
+    if (type != STT_FUNC && type != STT_OBJECT && type != STT_GNU_IFUNC &&
+        type != STT_NOTYPE)
+      continue;
+    if (sym.st_shndx == SHN_UNDEF || sym.st_shndx == SHN_ABS)
+      continue;
+    Symbol symbol;
+    symbol.start = sym.st_value;
+    symbol.size  = sym.st_size > ~0U ? ~0U : (u32)sym.st_size;
+    symbol.name  = name;
+    symbol.file  = ELF64_ST_BIND(sym.st_info) == STB_LOCAL ? file : 0;
+    module->symbols.push_back(symbol);
+  }
+
+  // Of aliases at the same address, keep the one with the largest
+  // size, or else the last one in the table, as llvm-symbolizer does.
+  std::vector<Symbol> &symbols = module->symbols;
+  std::stable_sort(symbols.begin(), symbols.end(),
+                   [](const Symbol &a, const Symbol &b) {
+                     return a.start < b.start ||
+                            (a.start == b.start && a.size < b.size);
+                   });
+  uptr kept = 0;
+  for (uptr i = 0; i < symbols.size(); ++i) {
+    if (i + 1 < symbols.size() && symbols[i + 1].start == symbols[i].start)
+      continue;
+    symbols[kept++] = symbols[i];
+  }
+  symbols.resize(kept);
+  symbols.shrink_to_fit();
+
+  std::vector<u64> starts(symbols.size());
+  for (uptr i = 0; i < symbols.size(); ++i)
+    starts[i] = symbols[i].start;
+  module->symbol_index.Build(starts.data(), starts.size());
+}
+
+const ElfSymbolizer::Symbol *ElfSymbolizer::Find(const Module *module,
+                                                 uptr offset) const {
+  uptr above = module->symbol_index.UpperBound(offset);
+  if (above == 0)
+    return nullptr;
+  // A symbol without a size reaches up to the next one.
+  const Symbol &symbol = module->symbols[above - 1];
+  if (symbol.size != 0 && offset - symbol.start >= symbol.size)
+    return nullptr;
+  return &symbol;
+}
+
+void ElfSymbolizer::LoadDwarf(Module *module) {
+  if (module->dwarf_loaded)
+    return;
+  module->dwarf_loaded = true;
+  // Spill files are named after the module, like the disk cache.
+  std::string spill_prefix;
+  char identity[kDiskCacheMaxIdentity];
+  if (spill_dir_ &&
+      GetModuleIdentity(module->name, identity, sizeof(identity))) {
+    spill_prefix = spill_dir_;
+    spill_prefix += '/';
+    spill_prefix += identity;
+  }
+  DwarfSections &sections = module->sections;
+  if (sections.Load(*module->dwarf,
+                    spill_prefix.empty() ? nullptr : spill_prefix.c_str())) {
+    module->lines.Build(*module->dwarf, sections);
+    module->inlines.Build(*module->dwarf, sections, module->lines);
+    sections.ReleaseUnreferenced();
+  }
+  module->lines_undecoded = module->lines.NumRows() == 0 &&
+                            module->dwarf->FindSection(".debug_line");
+}
+
+bool ElfSymbolizer::GetBoundaries(const char *module_name,
+                                  std::vector<u64> *offsets) {
+  Module *module = GetModule(module_name);
+  if (module->symbols.empty())
+    return false;
+  // A symbol without a size ends where the next one starts.
+  for (uptr i = 0; i < module->symbols.size(); ++i) {
+    const Symbol &symbol = module->symbols[i];
+    offsets->push_back(symbol.start);
+    if (symbol.size)
+      offsets->push_back(symbol.start + symbol.size);
+  }
+  LoadDwarf(module);
+  for (uptr i = 0; i < module->lines.NumRows(); ++i)
+    offsets->push_back(module->lines.RowAddress(i));
+  module->inlines.GetBoundaries(offsets);
+  return true;
+}
+
+bool ElfSymbolizer::Lookup(DataInfo *info) {
+  Module *module = GetModule(info->module);
+  const Symbol *symbol = Find(module, info->module_offset);
+  if (!symbol)
+    return false;
+  // The declaration's file and line are only in DW_TAG_variable, which
+  // |next| reads.
+  if (next && module->dwarf->FindSection(".debug_info"))
+    return false;
+  info->file  = nullptr;
+  info->line  = 0;
+  info->name  = CopyResultString(
+      info->strings, (const char *)module->names->data() + symbol->name);
+  info->start = symbol->start;
+  info->size  = symbol->size;
+  return true;
+}
+
+bool ElfSymbolizer::Lookup(AddrInfo *info) {
+  Module *module = GetModule(info->module);
+  const Symbol *symbol = Find(module, info->module_offset);
+  if (!symbol)
+    return false;
+  LoadDwarf(module);
+  if (module->lines_undecoded && next)
+    return false;
+  const char *file = nullptr;
+  u32 line = 0, column = 0;
+  module->lines.Lookup(info->module_offset, &file, &line, &column);
+  const char *data = (const char *)module->names->data();
+
+  // Like llvm-symbolizer, the outermost function is named after its
+  // symbol, whose STT_FILE stands in for a missing file.
+  DwarfInlineTree::Frame outermost;
+  outermost.name = data + symbol->name;
+  if (!module->inlines.Lookup(info->module_offset, &stack_))
+    stack_.clear();
+#if !SANSYMTOOL_LLVMSYMBOLIZER_INLINES
+  stack_.clear();
+#endif
+  if (stack_.empty())
+    stack_.push_back(outermost);
+  stack_.back().name = outermost.name;
+
+  // Each frame is where the one before it is inlined.
+  for (uptr i = 0; i < stack_.size(); ++i) {
+    if (!file && i + 1 == stack_.size() && symbol->file)
+      file = data + symbol->file;
+    FrameDat frame;
+    frame.func = CopyResultString(info->strings, stack_[i].name);
+    frame.file = CopyResultString(info->strings, file);
+    frame.lin  = line;
+    frame.col  = column;
+    info->frames.push_back(frame);
+    file   = stack_[i].call_file;
+    line   = stack_[i].call_line;
+    column = stack_[i].call_column;
+  }
+  return true;
+}
+
+} // namespace SANSYMTOOL_NS
@@ -0,0 +1,109 @@
+//===-- elf_symbolizer.h --------------------------------------------------===//
+//
+// Based on the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file declares a symbolizer tool reading ELF symbol tables
+// in process, without any subprocess.
+//===----------------------------------------------------------------------===//
+
+#ifndef SANSYMTOOL_HEAD_ELF_SYMBOLIZER_H
+#define SANSYMTOOL_HEAD_ELF_SYMBOLIZER_H
+
+#include "in_process_symbolizer.h"
+#include "address_index.h"
+#include "debug_file.h"
+#include "dwarf_inline.h"
+#include "dwarf_line.h"
+#include "elf_file.h"
+
+namespace SANSYMTOOL_NS
+{
+
+// Finds the function or object containing an offset from .symtab,
+// or from .dynsym if the module is stripped. Names are given as they
+// are in the table. For code, file, line and column come from
+// .debug_line if the module has it, and inlined frames from
+// .debug_info, both decoded on first use. A module stripped of
+// either has them read from its separate debug file instead, if
+// OpenDebugFile finds one in |debug_dir| or next to the module.
+// Compressed DWARF is inflated while decoding, and only what names
+// point into is kept afterwards, spilled to files in |spill_dir| if
+// it's given, so later processes map it instead of inflating it.
+// Symbols, rows and functions are searched through an AddressIndex.
+// Like in llvm-symbolizer, inlined functions are named from DWARF and
+// the outermost one from its symbol.
+// What it can't find is passed on to the |next| tool in the chain,
+// batched requests as a single batch of the misses. So is code in a
+// module with a line table it can't decode, which the tool may still
+// give file and line for, and data in a module with .debug_info, for
+// the file and line of its declaration. Completion-based requests go
+// straight to |next|.
+class ElfSymbolizer final : public InProcessSymbolizer {
+ public:
+  // Takes ownership of |next_tool|, which can be nullptr.
+  // |debug_dir| can be nullptr for kDefaultDebugFileDir, and
+  // |spill_dir| to keep inflated sections in memory.
+  ElfSymbolizer(SymbolizerTool *next_tool, const char *debug_dir,
+                const char *spill_dir);
+  ~ElfSymbolizer() override;
+
+  // Appends the offsets in |module_name| where answers may change:
+  // where symbols start and end, where rows of the line table start,
+  // and where functions and inlined calls start and end. Between two
+  // of them, every offset gets the same answer. Returns false if the
+  // module has no symbols.
+  bool GetBoundaries(const char *module_name, std::vector<u64> *offsets);
+
+ private:
+  // 24 bytes for each symbol, sorted by |start|.
+  struct Symbol {
+    u64 start;
+    u32 size;
+    u32 name;  // Offset of the name in |names| of the module
+    u32 file;  // Same for the STT_FILE before a local symbol, or 0
+  };
+
+  struct Module {
+    char *name;
+    ElfFile elf;
+    // Not open unless the module is stripped and it's been found.
+    ElfFile debug;
+    // Either of the above, holding the symbol table and the DWARF.
+    const ElfFile *names;
+    const ElfFile *dwarf;
+    std::vector<Symbol> symbols;
+    // Over the starts of |symbols|.
+    AddressIndex symbol_index;
+    bool dwarf_loaded;
+    // It has a .debug_line which couldn't be decoded, e.g. compressed
+    // in a way this build can't inflate.
+    bool lines_undecoded;
+    DwarfSections sections;
+    DwarfLineTable lines;
+    DwarfInlineTree inlines;
+  };
+
+  Module *GetModule(const char *module_name);
+  template <typename Sym>
+  static void ReadSymbols(Module *module, const ElfFile &elf,
+                          const ElfFile::Section &table);
+  const Symbol *Find(const Module *module, uptr offset) const;
+  void LoadDwarf(Module *module);
+
+  bool Lookup(DataInfo *info) override;
+  bool Lookup(AddrInfo *info) override;
+
+  char *debug_dir_;
+  char *spill_dir_;
+  ModuleCache<Module> modules_;
+  // Reused by every lookup.
+  std::vector<DwarfInlineTree::Frame> stack_;
+};
+
+} // namespace SANSYMTOOL_NS
+
+#endif // SANSYMTOOL_HEAD_ELF_SYMBOLIZER_H
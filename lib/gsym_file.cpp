@@ -0,0 +1,336 @@
+//===-- gsym_file.cpp -----------------------------------------------------===//
+//
+// Based on the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file gives implementation of the GSYM reader. The decoding follows
+// GsymReader.cpp, FunctionInfo.cpp, LineTable.cpp and InlineInfo.cpp in
+// llvm/lib/DebugInfo/GSYM.
+//===----------------------------------------------------------------------===//
+
+#include "gsym_file.h"
+#include "dwarf.h"
+
+#include <algorithm>
+
+namespace SANSYMTOOL_NS
+{
+
+static const u32 kGsymMagic = 0x4753594d;  // 'GSYM'
+static const u16 kGsymVersion = 1;
+
+// FunctionInfo::InfoType
+enum {
+  kInfoEndOfList  = 0,
+  kInfoLineTable  = 1,
+  kInfoInlineInfo = 2,
+};
+
+// Line table opcodes, LineTable.h
+enum {
+  kLineEndSequence  = 0x00,
+  kLineSetFile      = 0x01,
+  kLineAdvancePC    = 0x02,
+  kLineAdvanceLine  = 0x03,
+  kLineFirstSpecial = 0x04,
+};
+
+// Inline info nests as deep as the source does, so anything
+// deeper than this is taken as a corrupted file.
+static const u32 kMaxInlineDepth = 256;
+
+static uptr AlignUp(uptr offset, uptr alignment) {
+  return (offset + alignment - 1) / alignment * alignment;
+}
+
+GsymFile::GsymFile()
+    : data_(nullptr), size_(0), header_(nullptr), addresses_(nullptr),
+      info_offsets_(nullptr), files_(nullptr), n_files_(0) {}
+
+GsymFile::~GsymFile() { Close(); }
+
+void GsymFile::Close() {
+  UnmapFromMemory(data_, size_);
+  data_ = nullptr;
+  size_ = 0;
+  header_ = nullptr;
+  addresses_ = nullptr;
+  info_offsets_ = nullptr;
+  files_ = nullptr;
+  n_files_ = 0;
+}
+
+bool GsymFile::Open(const char *path) {
+  Close();
+  uptr size = 0;
+  const u8 *data = (const u8 *)MapFileToMemory(path, &size);
+  if (!data)
+    return false;
+  data_ = data;
+  size_ = size;
+
+  // Same layout as GsymReader::parse: the header, the address table
+  // aligned to its entries, then the offsets of FunctionInfo and the
+  // file table, both aligned to 4 bytes. The mapping is page aligned,
+  // so the tables can be used in place.
+  const Header *header = (const Header *)data_;
+  bool ok = size_ >= sizeof(Header) && header->magic == kGsymMagic &&
+            header->version == kGsymVersion &&
+            header->uuid_size <= sizeof(header->uuid);
+  u8 addr_off_size = ok ? header->addr_off_size : 0;
+  ok = ok && (addr_off_size == 1 || addr_off_size == 2 ||
+              addr_off_size == 4 || addr_off_size == 8);
+  uptr offset = ok ? AlignUp(sizeof(Header), addr_off_size) : 0;
+  uptr n = ok ? header->num_addresses : 0;
+  ok = ok && n != 0 && offset <= size_ && n <= (size_ - offset) / addr_off_size;
+  if (ok) {
+    addresses_ = data_ + offset;
+    offset = AlignUp(offset + n * addr_off_size, 4);
+    ok = offset <= size_ && n <= (size_ - offset) / sizeof(u32);
+  }
+  if (ok) {
+    info_offsets_ = (const u32 *)(data_ + offset);
+    offset += n * sizeof(u32);
+    ok = size_ - offset >= sizeof(u32);
+  }
+  if (ok) {
+    n_files_ = *(const u32 *)(data_ + offset);
+    offset += sizeof(u32);
+    ok = n_files_ <= (size_ - offset) / sizeof(FileEntry);
+    files_ = (const FileEntry *)(data_ + offset);
+  }
+  // A terminated string table keeps every string in it terminated.
+  ok = ok && header->strtab_size != 0 && header->strtab_offset <= size_ &&
+       header->strtab_size <= size_ - header->strtab_offset &&
+       data_[header->strtab_offset + header->strtab_size - 1] == '\0';
+
+  if (!ok) {
+    Close();
+    return false;
+  }
+  header_ = header;
+  return true;
+}
+
+const u8 *GsymFile::uuid() const { return header_ ? header_->uuid : nullptr; }
+
+uptr GsymFile::uuid_size() const { return header_ ? header_->uuid_size : 0; }
+
+u64 GsymFile::AddressAt(uptr index) const {
+  switch (header_->addr_off_size) {
+    case 1: return ((const u8 *)addresses_)[index];
+    case 2: return ((const u16 *)addresses_)[index];
+    case 4: return ((const u32 *)addresses_)[index];
+    default: return ((const u64 *)addresses_)[index];
+  }
+}
+
+sptr GsymFile::FindAddress(u64 address) const {
+  if (address < header_->base_address)
+    return -1;
+  u64 offset = address - header_->base_address;
+  // upper_bound over the entries of whatever size they are.
+  uptr begin = 0, end = header_->num_addresses;
+  while (begin < end) {
+    uptr mid = begin + (end - begin) / 2;
+    if (offset < AddressAt(mid))
+      end = mid;
+    else
+      begin = mid + 1;
+  }
+  return (sptr)begin - 1;
+}
+
+const char *GsymFile::GetString(u32 offset) const {
+  if (offset >= header_->strtab_size)
+    return nullptr;
+  return (const char *)data_ + header_->strtab_offset + offset;
+}
+
+bool GsymFile::SetFile(u32 index, Frame *frame) const {
+  if (index >= n_files_)
+    return false;
+  frame->dir  = GetString(files_[index].dir);
+  frame->base = GetString(files_[index].base);
+  return files_[index].dir != 0 || files_[index].base != 0;
+}
+
+// Runs the line table of the function at |function| up to the
+// last row not above |address|, like LineTable::lookup.
+bool GsymFile::LookupLine(DwarfReader *reader, u64 function, u64 address,
+                          Frame *frame) const {
+  s64 min_delta = reader->SLEB();
+  s64 max_delta = reader->SLEB();
+  u64 first_line = reader->ULEB();
+  if (!reader->ok() || max_delta < min_delta)
+    return false;
+  s64 line_range = max_delta - min_delta + 1;
+
+  u64 row_address = function;
+  u32 row_file = 1;
+  u32 row_line = (u32)first_line;
+  u32 found_file = 0;  // None yet
+  u32 found_line = 0;
+  while (true) {
+    u8 op = reader->U8();
+    if (!reader->ok() || op == kLineEndSequence)
+      break;
+    if (op == kLineSetFile) {
+      row_file = (u32)reader->ULEB();
+      continue;
+    }
+    if (op == kLineAdvanceLine) {
+      row_line += (u32)reader->SLEB();
+      continue;
+    }
+    if (op == kLineAdvancePC) {
+      row_address += reader->ULEB();
+    } else {
+      u8 adjusted = op - kLineFirstSpecial;
+      row_line += (u32)(min_delta + adjusted % line_range);
+      row_address += adjusted / line_range;
+    }
+    // A row is pushed.
+    if (!reader->ok() || address < row_address)
+      break;
+    found_file = row_file;
+    found_line = row_line;
+    if (address == row_address)
+      break;
+  }
+  if (found_file == 0)
+    return false;
+  SetFile(found_file, frame);
+  frame->line = found_line;
+  return true;
+}
+
+// Skips an InlineInfo with its children.
+// Returns false for the empty one ending a list of siblings.
+bool GsymFile::SkipInline(DwarfReader *reader, u32 depth) {
+  u64 n_ranges = reader->ULEB();
+  if (!reader->ok() || n_ranges == 0 || depth > kMaxInlineDepth)
+    return false;
+  for (u64 i = 0; i < n_ranges && reader->ok(); ++i) {
+    reader->ULEB();
+    reader->ULEB();
+  }
+  bool has_children = reader->U8() != 0;
+  reader->U32();   // Name
+  reader->ULEB();  // Call file
+  reader->ULEB();  // Call line
+  if (has_children)
+    while (SkipInline(reader, depth + 1)) {}
+  return reader->ok();
+}
+
+// Decodes an InlineInfo whose ranges are relative to |base|, like
+// InlineInfo::lookup. If it contains |address|, the innermost frame
+// on |stack| is renamed after it and its call site pushed as the
+// next one, after doing the same for the children containing it.
+// Returns true for that, or for the end of a list of siblings.
+bool GsymFile::LookupInline(DwarfReader *reader, u64 base, u64 address,
+                            u32 depth, std::vector<Frame> *stack) const {
+  u64 n_ranges = reader->ULEB();
+  if (!reader->ok() || n_ranges == 0 || depth > kMaxInlineDepth)
+    return true;
+  u64 first_start = 0;
+  bool contains = false;
+  for (u64 i = 0; i < n_ranges && reader->ok(); ++i) {
+    u64 start = base + reader->ULEB();
+    u64 size = reader->ULEB();
+    if (i == 0)
+      first_start = start;
+    contains = contains || (address >= start && address - start < size);
+  }
+  bool has_children = reader->U8() != 0;
+  u32 name = reader->U32();
+  u32 call_file = (u32)reader->ULEB();
+  u32 call_line = (u32)reader->ULEB();
+  if (!reader->ok())
+    return true;
+  if (!contains) {
+    if (has_children)
+      while (SkipInline(reader, depth + 1)) {}
+    return false;
+  }
+
+  // Children are relative to the start of the first range.
+  if (has_children)
+    while (!LookupInline(reader, first_start, address, depth + 1, stack)) {}
+
+  Frame caller;
+  if (SetFile(call_file, &caller)) {
+    caller.name = stack->back().name;
+    caller.line = call_line;
+    stack->back().name = GetString(name);
+    stack->push_back(caller);
+  }
+  return true;
+}
+
+bool GsymFile::Lookup(u64 address, std::vector<Frame> *stack) const {
+  stack->clear();
+  if (!header_)
+    return false;
+  sptr index = FindAddress(address);
+  if (index < 0)
+    return false;
+  u64 function = header_->base_address + AddressAt(index);
+
+  DwarfReader reader(data_, size_, info_offsets_[index]);
+  // A function without a size, as taken from a symbol table,
+  // reaches up to the next one.
+  u32 size = reader.U32();
+  const char *name = GetString(reader.U32());
+  if (!reader.ok() || !name || (size != 0 && address - function >= size))
+    return false;
+
+  // Pick the parts needed out of the list of InfoType chunks.
+  const u8 *lines = nullptr, *inlines = nullptr;
+  uptr lines_size = 0, inlines_size = 0;
+  while (true) {
+    u32 type = reader.U32();
+    u32 length = reader.U32();
+    const u8 *chunk = reader.Skip(length);
+    if (!chunk || type == kInfoEndOfList)
+      break;
+    if (type == kInfoLineTable) {
+      lines = chunk;
+      lines_size = length;
+    } else if (type == kInfoInlineInfo) {
+      inlines = chunk;
+      inlines_size = length;
+    }
+  }
+
+  Frame frame;
+  frame.name = name;
+  frame.dir  = nullptr;
+  frame.base = nullptr;
+  frame.line = 0;
+  // Without a line table, or a row for the address, only the name
+  // is known. GsymReader fails in the latter case.
+  bool has_line = false;
+  if (lines) {
+    DwarfReader line_reader(lines, lines_size);
+    has_line = LookupLine(&line_reader, function, address, &frame);
+  }
+  stack->push_back(frame);
+  if (!has_line || !inlines)
+    return true;
+
+  DwarfReader inline_reader(inlines, inlines_size);
+  LookupInline(&inline_reader, function, address, 0, stack);
+  if (!inline_reader.ok()) {
+    // Truncated, so keep only what the line table says.
+    stack->clear();
+    stack->push_back(frame);
+  }
+  return true;
+}
+
+} // namespace SANSYMTOOL_NS
@@ -0,0 +1,105 @@
+//===-- gsym_file.h -------------------------------------------------------===//
+//
+// Based on the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file declares a reader of GSYM files, as made by llvm-gsymutil.
+// The format is described in llvm/include/llvm/DebugInfo/GSYM/*.h.
+//===----------------------------------------------------------------------===//
+
+#ifndef SANSYMTOOL_HEAD_GSYM_FILE_H
+#define SANSYMTOOL_HEAD_GSYM_FILE_H
+
+#include "common.h"
+
+#include <vector>
+
+namespace SANSYMTOOL_NS
+{
+
+class DwarfReader;
+
+// Read-only view of a GSYM file mapped into memory. The header,
+// address table and file table are used in place, so opening one
+// costs nothing but the mapping, whatever the size of the module.
+// A lookup is a binary search of the address table, then decoding
+// the line table and inline info of that single function, the way
+// GsymReader::lookup does. Only version 1 in host byte order is
+// understood.
+class GsymFile {
+ public:
+  // One function in the stack of an address, innermost first.
+  // Strings point into the mapped file. The location is where
+  // the address is for the first frame, and where the one before
+  // is inlined for the others.
+  struct Frame {
+    const char *name;
+    const char *dir;   // nullptr or empty if unknown
+    const char *base;  // Same
+    u32 line;
+  };
+
+  GsymFile();
+  ~GsymFile();
+  GsymFile(const GsymFile &) = delete;
+  GsymFile &operator=(const GsymFile &) = delete;
+
+  // Returns false if |path| can't be mapped or isn't a valid GSYM file.
+  bool Open(const char *path);
+  void Close();
+  bool IsOpen() const { return data_ != nullptr; }
+
+  // Build-id of the module it was made from, if it was recorded.
+  const u8 *uuid() const;
+  uptr uuid_size() const;
+
+  // Fills |stack| with the functions at |address|.
+  // Returns false if it's in no function.
+  bool Lookup(u64 address, std::vector<Frame> *stack) const;
+
+ private:
+  // Exactly as in the file.
+  struct Header {
+    u32 magic;
+    u16 version;
+    u8  addr_off_size;
+    u8  uuid_size;
+    u64 base_address;
+    u32 num_addresses;
+    u32 strtab_offset;
+    u32 strtab_size;
+    u8  uuid[20];
+  };
+  struct FileEntry {
+    u32 dir;
+    u32 base;
+  };
+
+  // Index of the last address not above |address|, or -1.
+  sptr FindAddress(u64 address) const;
+  u64 AddressAt(uptr index) const;
+  const char *GetString(u32 offset) const;
+  // Sets the location of |frame| to file |index|. Returns false if
+  // there is no such file, or if it has no name, like index 0.
+  bool SetFile(u32 index, Frame *frame) const;
+  bool LookupLine(DwarfReader *reader, u64 function, u64 address,
+                  Frame *frame) const;
+  bool LookupInline(DwarfReader *reader, u64 base, u64 address, u32 depth,
+                    std::vector<Frame> *stack) const;
+  static bool SkipInline(DwarfReader *reader, u32 depth);
+
+  const u8 *data_;
+  uptr size_;
+  const Header *header_;
+  const u8 *addresses_;
+  const u32 *info_offsets_;
+  const FileEntry *files_;
+  u32 n_files_;
+};
+
+} // namespace SANSYMTOOL_NS
+
+#endif // SANSYMTOOL_HEAD_GSYM_FILE_H
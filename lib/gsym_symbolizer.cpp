@@ -0,0 +1,94 @@
+//===-- gsym_symbolizer.cpp -----------------------------------------------===//
+//
+// Based on the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file gives implementation of the GSYM symbolizer.
+//===----------------------------------------------------------------------===//
+
+#include "gsym_symbolizer.h"
+#include "elf_file.h"
+
+#include <cstdlib>
+#include <cstring>
+
+namespace SANSYMTOOL_NS
+{
+
+GsymSymbolizer::GsymSymbolizer(SymbolizerTool *next_tool, const char *dir)
+    : InProcessSymbolizer(next_tool),
+      dir_(dir && dir[0] ? strdup(dir) : nullptr) {}
+
+GsymSymbolizer::~GsymSymbolizer() { std::free(dir_); }
+
+GsymSymbolizer::Module *GsymSymbolizer::GetModule(const char *module_name) {
+  if (Module *module = modules_.Find(module_name))
+    return module;
+
+  // A module without a GSYM file is kept too.
+  Module *module = modules_.Add(module_name);
+  OpenGsym(module);
+  return module;
+}
+
+bool GsymSymbolizer::OpenGsym(Module *module) {
+  path_ = module->name;
+  path_ += ".gsym";
+  if (!module->gsym.Open(path_.c_str()) && dir_) {
+    path_ = dir_;
+    path_ += '/';
+    path_ += StripModuleName(module->name);
+    path_ += ".gsym";
+    module->gsym.Open(path_.c_str());
+  }
+  if (!module->gsym.IsOpen())
+    return false;
+
+  // A stale GSYM file would give wrong answers rather than none.
+  uptr uuid_size = module->gsym.uuid_size();
+  if (uuid_size) {
+    ElfFile elf;
+    u8 build_id[64];
+    uptr size = elf.Open(module->name)
+                    ? elf.GetBuildId(build_id, sizeof(build_id)) : 0;
+    if (size && (size != uuid_size ||
+                 std::memcmp(build_id, module->gsym.uuid(), size))) {
+      SAYSTH("WARNING: GSYM file doesn't match the module, ignored\n");
+      module->gsym.Close();
+      return false;
+    }
+  }
+  return true;
+}
+
+bool GsymSymbolizer::Lookup(AddrInfo *info) {
+  Module *module = GetModule(info->module);
+  if (!module->gsym.Lookup(info->module_offset, &stack_))
+    return false;
+  for (uptr i = 0; i < stack_.size(); ++i) {
+    const GsymFile::Frame &gsym_frame = stack_[i];
+    // The file is "dir/base" as llvm-gsymutil prints it.
+    path_.clear();
+    if (gsym_frame.dir && gsym_frame.dir[0]) {
+      path_ = gsym_frame.dir;
+      if (path_.back() != '/')
+        path_ += '/';
+    }
+    if (gsym_frame.base)
+      path_ += gsym_frame.base;
+    FrameDat frame;
+    frame.func = CopyResultString(info->strings, gsym_frame.name);
+    frame.file = path_.empty() ? nullptr
+                               : CopyResultString(info->strings, path_.data(),
+                                                  path_.size());
+    frame.lin  = gsym_frame.line;
+    frame.col  = 0;
+    info->frames.push_back(frame);
+  }
+  return true;
+}
+
+} // namespace SANSYMTOOL_NS
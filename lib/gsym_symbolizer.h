@@ -0,0 +1,59 @@
+//===-- gsym_symbolizer.h -------------------------------------------------===//
+//
+// Based on the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file declares a symbolizer tool reading GSYM files in process.
+//===----------------------------------------------------------------------===//
+
+#ifndef SANSYMTOOL_HEAD_GSYM_SYMBOLIZER_H
+#define SANSYMTOOL_HEAD_GSYM_SYMBOLIZER_H
+
+#include "in_process_symbolizer.h"
+#include "gsym_file.h"
+
+#include <string>
+
+namespace SANSYMTOOL_NS
+{
+
+// Answers code requests from the GSYM file of a module, made by
+// llvm-gsymutil: "<module>.gsym" next to it, or else the one of the
+// same name in |dir|. A GSYM file recording a UUID different from
+// the build-id of the module is ignored. Names and lines are the
+// ones stored in the file, and there are no columns.
+// Modules without a GSYM file, offsets not in any function and data
+// requests are passed on to the |next| tool in the chain, batched
+// requests as a single batch of the misses. Completion-based
+// requests go straight to |next|.
+class GsymSymbolizer final : public InProcessSymbolizer {
+ public:
+  // Takes ownership of |next_tool|, which can be nullptr.
+  // |dir| can be nullptr to only look next to the modules.
+  GsymSymbolizer(SymbolizerTool *next_tool, const char *dir);
+  ~GsymSymbolizer() override;
+
+ private:
+  struct Module {
+    char *name;
+    GsymFile gsym;
+  };
+
+  Module *GetModule(const char *module_name);
+  bool OpenGsym(Module *module);
+  bool Lookup(DataInfo *info) override { return false; }
+  bool Lookup(AddrInfo *info) override;
+
+  char *dir_;
+  ModuleCache<Module> modules_;
+  // Reused by every lookup.
+  std::vector<GsymFile::Frame> stack_;
+  std::string path_;
+};
+
+} // namespace SANSYMTOOL_NS
+
+#endif // SANSYMTOOL_HEAD_GSYM_SYMBOLIZER_H
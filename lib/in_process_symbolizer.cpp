@@ -0,0 +1,112 @@
+//===-- in_process_symbolizer.cpp -----------------------------------------===//
+//
+// Based on the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file gives implementation of the base of in-process symbolizers.
+//===----------------------------------------------------------------------===//
+
+#include "in_process_symbolizer.h"
+
+namespace SANSYMTOOL_NS
+{
+
+InProcessSymbolizer::InProcessSymbolizer(SymbolizerTool *next_tool)
+    : last_timed_out_(false) {
+  next = next_tool;
+}
+
+InProcessSymbolizer::~InProcessSymbolizer() { delete next; }
+
+void InProcessSymbolizer::StopTheWorld() {
+  if (next)
+    next->StopTheWorld();
+}
+
+bool InProcessSymbolizer::SymbolizeData(DataInfo *info) {
+  last_timed_out_ = false;
+  if (Lookup(info))
+    return true;
+  if (!next)
+    return false;
+  bool ok = next->SymbolizeData(info);
+  last_timed_out_ = next->LastRequestTimedOut();
+  if (ok)
+    Insert(*info);
+  return ok;
+}
+
+bool InProcessSymbolizer::SymbolizeAddr(AddrInfo *info) {
+  last_timed_out_ = false;
+  // Frames already in |info| are not part of this result.
+  uptr first_frame = info->frames.size();
+  if (Lookup(info))
+    return true;
+  if (!next)
+    return false;
+  bool ok = next->SymbolizeAddr(info);
+  last_timed_out_ = next->LastRequestTimedOut();
+  if (ok)
+    Insert(*info, first_frame);
+  return ok;
+}
+
+bool InProcessSymbolizer::SymbolizeDataBatch(DataInfo *infos, uptr n) {
+  last_timed_out_ = false;
+  std::vector<uptr> missed;
+  for (uptr i = 0; i < n; ++i)
+    if (!Lookup(&infos[i]))
+      missed.push_back(i);
+  if (missed.empty())
+    return true;
+  if (!next)
+    return false;
+
+  std::vector<DataInfo> requests(missed.size());
+  for (uptr i = 0; i < missed.size(); ++i)
+    requests[i] = infos[missed[i]];
+  bool ok = next->SymbolizeDataBatch(requests.data(), requests.size());
+  last_timed_out_ = next->LastRequestTimedOut();
+  // Results are handed over even on failure, like |next| does.
+  for (uptr i = 0; i < missed.size(); ++i) {
+    if (ok)
+      Insert(requests[i]);
+    infos[missed[i]] = requests[i];
+  }
+  return ok;
+}
+
+bool InProcessSymbolizer::SymbolizeAddrBatch(AddrInfo *infos, uptr n) {
+  last_timed_out_ = false;
+  std::vector<uptr> missed;
+  for (uptr i = 0; i < n; ++i)
+    if (!Lookup(&infos[i]))
+      missed.push_back(i);
+  if (missed.empty())
+    return true;
+  if (!next)
+    return false;
+
+  std::vector<AddrInfo> requests(missed.size());
+  for (uptr i = 0; i < missed.size(); ++i) {
+    requests[i].module        = infos[missed[i]].module;
+    requests[i].module_offset = infos[missed[i]].module_offset;
+    requests[i].module_arch   = infos[missed[i]].module_arch;
+    requests[i].strings       = infos[missed[i]].strings;
+  }
+  bool ok = next->SymbolizeAddrBatch(requests.data(), requests.size());
+  last_timed_out_ = next->LastRequestTimedOut();
+  for (uptr i = 0; i < missed.size(); ++i) {
+    if (ok)
+      Insert(requests[i], 0);
+    std::vector<FrameDat> &frames = infos[missed[i]].frames;
+    frames.insert(frames.end(), requests[i].frames.begin(),
+                  requests[i].frames.end());
+  }
+  return ok;
+}
+
+} // namespace SANSYMTOOL_NS
@@ -0,0 +1,125 @@
+//===-- in_process_symbolizer.h -------------------------------------------===//
+//
+// Based on the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file declares what symbolizer tools answering from files read
+// in process have in common.
+//===----------------------------------------------------------------------===//
+
+#ifndef SANSYMTOOL_HEAD_IN_PROCESS_SYMBOLIZER_H
+#define SANSYMTOOL_HEAD_IN_PROCESS_SYMBOLIZER_H
+
+#include "symbolizer.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+namespace SANSYMTOOL_NS
+{
+
+// The modules a tool has looked at, by name. |Module| has a
+// |char *name|, and is made on first use and kept until the cache is
+// destroyed, whether or not there was anything to read for it, so
+// it's never tried again. A stack has a handful of modules, so they
+// are just compared in turn, the one found last first.
+template <typename Module>
+class ModuleCache {
+ public:
+  ModuleCache() : last_(nullptr) {}
+  ~ModuleCache() {
+    for (uptr i = 0; i < modules_.size(); ++i) {
+      std::free(modules_[i]->name);
+      delete modules_[i];
+    }
+  }
+  ModuleCache(const ModuleCache &) = delete;
+  ModuleCache &operator=(const ModuleCache &) = delete;
+
+  // Returns nullptr if |name| hasn't been added.
+  Module *Find(const char *name) {
+    if (last_ && 0 == std::strcmp(last_->name, name))
+      return last_;
+    for (uptr i = 0; i < modules_.size(); ++i) {
+      if (0 == std::strcmp(modules_[i]->name, name)) {
+        last_ = modules_[i];
+        return last_;
+      }
+    }
+    return nullptr;
+  }
+
+  // Adds an empty module named |name|, for the caller to open.
+  Module *Add(const char *name) {
+    Module *module = new Module();
+    module->name = strdup(name);
+    modules_.push_back(module);
+    last_ = module;
+    return module;
+  }
+
+ private:
+  std::vector<Module *> modules_;
+  Module *last_;
+};
+
+// Base of the tools answering what they can in process, from files
+// they read or from results kept by a cache. Whatever their Lookup
+// doesn't answer is passed on to the |next| tool in the chain,
+// batched requests as a single batch of the misses, so |next| still
+// sees them together, and what it answers is given to Insert.
+// Completion-based requests go straight to |next|.
+class InProcessSymbolizer : public SymbolizerTool {
+ public:
+  // Deletes |next|.
+  ~InProcessSymbolizer() override;
+
+  bool SymbolizeData(DataInfo *info) override;
+  bool SymbolizeAddr(AddrInfo *info) override;
+
+  bool SymbolizeDataBatch(DataInfo *infos, uptr n) override;
+  bool SymbolizeAddrBatch(AddrInfo *infos, uptr n) override;
+
+  fd_t GetCompletionFd() override {
+    return next ? next->GetCompletionFd() : kInvalidFd;
+  }
+  bool SubmitData(const DataInfo &info, u64 ticket) override {
+    return next && next->SubmitData(info, ticket);
+  }
+  bool SubmitAddr(const AddrInfo &info, u64 ticket) override {
+    return next && next->SubmitAddr(info, ticket);
+  }
+  bool PollCompletion(u64 *ticket, bool *is_data, bool *ok,
+                      DataInfo *data, AddrInfo *addr) override {
+    return next && next->PollCompletion(ticket, is_data, ok, data, addr);
+  }
+
+  bool LastRequestTimedOut() const override { return last_timed_out_; }
+
+  void StopTheWorld() override;
+
+ protected:
+  // Takes ownership of |next_tool|, which can be nullptr.
+  explicit InProcessSymbolizer(SymbolizerTool *next_tool);
+
+  // Answers |info| in process, returning false to pass it on to
+  // |next|, in which case |info| must be left as it was given.
+  virtual bool Lookup(DataInfo *info) = 0;
+  virtual bool Lookup(AddrInfo *info) = 0;
+  // Called with what |next| answered successfully, for caches to keep
+  // a copy of. For code, the result is made of the frames starting
+  // at |first_frame|.
+  virtual void Insert(const DataInfo &info) {}
+  virtual void Insert(const AddrInfo &info, uptr first_frame) {}
+
+ private:
+  bool last_timed_out_;
+};
+
+} // namespace SANSYMTOOL_NS
+
+#endif // SANSYMTOOL_HEAD_IN_PROCESS_SYMBOLIZER_H
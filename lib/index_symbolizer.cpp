@@ -0,0 +1,62 @@
+//===-- index_symbolizer.cpp ----------------------------------------------===//
+//
+// Based on the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file gives implementation of the index file symbolizer.
+//===----------------------------------------------------------------------===//
+
+#include "index_symbolizer.h"
+#include "elf_file.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+namespace SANSYMTOOL_NS
+{
+
+IndexSymbolizer::IndexSymbolizer(SymbolizerTool *next_tool, const char *dir)
+    : InProcessSymbolizer(next_tool),
+      dir_(dir && dir[0] ? strdup(dir) : nullptr) {}
+
+IndexSymbolizer::~IndexSymbolizer() { std::free(dir_); }
+
+IndexSymbolizer::Module *IndexSymbolizer::GetModule(const char *module_name) {
+  if (Module *module = modules_.Find(module_name))
+    return module;
+
+  // A module without an index is kept too.
+  Module *module = modules_.Add(module_name);
+  OpenIndex(module);
+  return module;
+}
+
+bool IndexSymbolizer::OpenIndex(Module *module) {
+  std::string path = module->name;
+  path += kSymbolIndexSuffix;
+  if (!module->index.Open(path.c_str()) && dir_) {
+    path = dir_;
+    path += '/';
+    path += StripModuleName(module->name);
+    path += kSymbolIndexSuffix;
+    module->index.Open(path.c_str());
+  }
+  if (!module->index.IsOpen())
+    return false;
+
+  // A stale index would give wrong answers rather than none.
+  char identity[kSymbolIndexMaxIdentity];
+  if (!GetModuleIdentity(module->name, identity, sizeof(identity)) ||
+      std::strcmp(identity, module->index.identity())) {
+    SAYSTH("WARNING: Index file doesn't match the module, ignored\n");
+    module->index.Close();
+    return false;
+  }
+  return true;
+}
+
+} // namespace SANSYMTOOL_NS
@@ -0,0 +1,58 @@
+//===-- index_symbolizer.h ------------------------------------------------===//
+//
+// Based on the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file declares a symbolizer tool reading index files made
+// by sansymtool-index.
+//===----------------------------------------------------------------------===//
+
+#ifndef SANSYMTOOL_HEAD_INDEX_SYMBOLIZER_H
+#define SANSYMTOOL_HEAD_INDEX_SYMBOLIZER_H
+
+#include "in_process_symbolizer.h"
+#include "symbol_index.h"
+
+namespace SANSYMTOOL_NS
+{
+
+// Answers requests from the index file of a module: "<module>.ssti"
+// next to it, or else the one of the same name in |dir|. An index
+// made from a different build of the module is ignored. Answers are
+// the ones the indexed tool gave, for code and for data.
+// Modules without an index and offsets it has no answer for are
+// passed on to the |next| tool in the chain, batched requests as a
+// single batch of the misses. Completion-based requests go straight
+// to |next|.
+class IndexSymbolizer final : public InProcessSymbolizer {
+ public:
+  // Takes ownership of |next_tool|, which can be nullptr.
+  // |dir| can be nullptr to only look next to the modules.
+  IndexSymbolizer(SymbolizerTool *next_tool, const char *dir);
+  ~IndexSymbolizer() override;
+
+ private:
+  struct Module {
+    char *name;
+    SymbolIndex index;
+  };
+
+  Module *GetModule(const char *module_name);
+  bool OpenIndex(Module *module);
+  bool Lookup(DataInfo *info) override {
+    return GetModule(info->module)->index.Lookup(info);
+  }
+  bool Lookup(AddrInfo *info) override {
+    return GetModule(info->module)->index.Lookup(info);
+  }
+
+  char *dir_;
+  ModuleCache<Module> modules_;
+};
+
+} // namespace SANSYMTOOL_NS
+
+#endif // SANSYMTOOL_HEAD_INDEX_SYMBOLIZER_H
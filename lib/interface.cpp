@@ -8,16 +8,27 @@
 //
 // This file gives implementation of the functions in public interface header.
 //
-// Some internal global variables are here for usage only in this file.
+// The state behind it is kept in contexts, so that the functions taking
+// a handle are reentrant, and the ones without use a default context.
 //===----------------------------------------------------------------------===//
 
 #include "sanitizer_symbolizer_tool.h"
 
 #include "use_llvm_symbolizer.h"
+#include "use_llvm_library.h"
 #include "use_addr2line.h"
+#include "cached_symbolizer.h"
+#include "demangle.h"
+#include "disk_cache.h"
+#include "elf_symbolizer.h"
+#include "gsym_symbolizer.h"
+#include "index_symbolizer.h"
+#include "symbolizer_service.h"
 
 #include <cstring>
 #include <cstdlib>
+#include <string>
+#include <vector>
 
 #if SANITIZER_POSIX
 
@@ -45,7 +56,8 @@ typedef enum
 {
   run_nothing,
   run_llvm_symbolizer,
-  run_addr2line
+  run_addr2line,
+  run_llvm_library
 } ToolCode;
 
 typedef enum
@@ -59,35 +71,95 @@ typedef enum
   err_unsupported_tool,
   err_symbolize_failed,
   err_has_nullptr,
-  err_outofbound
+  err_outofbound,
+  yes_poll_done,
+  err_not_ready,
+  err_timeout
 } RetCode;
 
-static struct SANSYMTOOL_NS::DataInfo * pDataInfoBuf = nullptr;
-static struct SANSYMTOOL_NS::AddrInfo * pAddrInfoBuf = nullptr;
-
-static SANSYMTOOL_NS::SymbolizerTool * pSanSymTool = nullptr;
-static ToolCode RunningThisTool = run_nothing;
-
+// All the state behind the public interface. Each context is on its
+// own, so different contexts can be used on different threads at the
+// same time, while one context must be used by one thread at a time.
+// The functions without a handle use DefaultCtx.
+struct SanSymTool_ctx {
+  // Entries of data results. A single request uses the first one,
+  // while a batched request uses one per offset.
+  std::vector<SANSYMTOOL_NS::DataInfo> * pDataInfoBuf = nullptr;
+  struct SANSYMTOOL_NS::AddrInfo * pAddrInfoBuf = nullptr;
+  // Interns all the strings of the results above, which then
+  // stay valid until SanSymToolFini, whatever is freed.
+  SANSYMTOOL_NS::StringTable * pStrings = nullptr;
+
+  SANSYMTOOL_NS::SymbolizerTool * pSanSymTool = nullptr;
+  // Same as pSanSymTool if the result cache is enabled
+  SANSYMTOOL_NS::CachedSymbolizer * pSanSymCache = nullptr;
+  ToolCode RunningThisTool = run_nothing;
+
+  // Demangles names of the following results if nonzero
+  int DemangleNames = 0;
+  SANSYMTOOL_NS::Demangler * pDemangler = nullptr;
+
+  // Tickets of completion-based requests, never reused
+  SANSYMTOOL_NS::u64 NextTicket = 1;
+};
+
+static struct SanSymTool_ctx DefaultCtx;
+
+
+// What results of the tool depend on besides the module: which tool
+// it is, the binary it runs, as named and as built, and where debug
+// files are looked for. Results of the disk cache are kept apart by it.
+static std::string CacheProducer(ToolCode tool, const char * path, const struct SanSymTool_options * opts) {
+  static const char *const kToolNames[] = {"", "llvm-symbolizer", "addr2line", "llvm-library"};
+  std::string producer = kToolNames[tool];
+  if (tool != run_llvm_library) {
+    char identity[SANSYMTOOL_NS::kDiskCacheMaxIdentity];
+    producer += '\n';
+    producer += path;
+    producer += '\n';
+    if (SANSYMTOOL_NS::GetModuleIdentity(path, identity, sizeof(identity))) { producer += identity; }
+  }
+  producer += '\n';
+  if (opts->debug_file_dir) { producer += opts->debug_file_dir; }
+  return producer;
+}
 
-int SanSymToolInit(const char * path) {
+int SanSymToolInit(struct SanSymTool_ctx * ctx, const char * path, const struct SanSymTool_options * opts) {
+  struct SanSymTool_options defaults;
+  std::memset(&defaults, 0, sizeof(defaults));
+  if (!opts) { opts = &defaults; }
 
 #if SANITIZER_POSIX
-  if (access(path, X_OK)) { return (int) err_path_not_executable; }
-
   const char *binary_name = path ? SANSYMTOOL_NS::StripModuleName(path) : "";
 
   static const char kLLVMSymbolizerPrefix[] = "llvm-symbolizer";
-  if (path && path[0] == '\0') {
+  if (opts->use_llvm_library) {
+    // Nothing is launched, so the path is never looked at.
+#if SANSYMTOOL_LLVM_SYMBOLIZE
+    ctx->RunningThisTool = run_llvm_library;
+    ctx->pSanSymTool = new SANSYMTOOL_NS::LLVMLibrarySymbolizer(opts->debug_file_dir);
+#else // SANSYMTOOL_LLVM_SYMBOLIZE
+    return (int) err_unsupported_tool;
+#endif // SANSYMTOOL_LLVM_SYMBOLIZE
+
+  } else if (access(path, X_OK)) {
+    return (int) err_path_not_executable;
+
+  } else if (path && path[0] == '\0') {
     return (int) err_path_corrupted;
 
   } else if (!std::strncmp(binary_name, kLLVMSymbolizerPrefix, 
                             std::strlen(kLLVMSymbolizerPrefix))) {
-    RunningThisTool = run_llvm_symbolizer;
-    pSanSymTool = new SANSYMTOOL_NS::LLVMSymbolizer(path);
+    ctx->RunningThisTool = run_llvm_symbolizer;
+    ctx->pSanSymTool = new SANSYMTOOL_NS::LLVMSymbolizer(path, opts->n_shards,
+                                                        opts->use_posix_spawn != 0,
+                                                        opts->timeout_ms);
 
   } else if (!std::strcmp(binary_name, "addr2line")) {
-    RunningThisTool = run_addr2line;
-    pSanSymTool = new SANSYMTOOL_NS::Addr2LinePool(path);
+    ctx->RunningThisTool = run_addr2line;
+    ctx->pSanSymTool = new SANSYMTOOL_NS::Addr2LinePool(path,
+                                                       opts->use_posix_spawn != 0,
+                                                       opts->timeout_ms);
 
   } else if (path) {
     return (int) err_unsupported_tool;
@@ -100,78 +172,147 @@ int SanSymToolInit(const char * path) {
 # endif // SANITIZER_WINDOWS
 #endif // SANITIZER_POSIX
 
-  pDataInfoBuf = new SANSYMTOOL_NS::DataInfo();
-  pAddrInfoBuf = new SANSYMTOOL_NS::AddrInfo();
+  if (ctx->pSanSymTool && opts->cache_dir && opts->cache_dir[0]) {
+    ctx->pSanSymTool = new SANSYMTOOL_NS::DiskCachedSymbolizer(ctx->pSanSymTool, opts->cache_dir,
+                                                               CacheProducer(ctx->RunningThisTool, path, opts).c_str());
+  }
+  if (ctx->pSanSymTool && opts->cache_size) {
+    ctx->pSanSymCache = new SANSYMTOOL_NS::CachedSymbolizer(ctx->pSanSymTool, opts->cache_size);
+    ctx->pSanSymTool = ctx->pSanSymCache;
+  }
+  if (ctx->pSanSymTool && opts->use_elf_symtab) {
+    // Symbol tables are tried before anything else but GSYM and index files.
+    ctx->pSanSymTool = new SANSYMTOOL_NS::ElfSymbolizer(ctx->pSanSymTool, opts->debug_file_dir,
+                                                        opts->cache_dir);
+  }
+  if (ctx->pSanSymTool && opts->use_gsym) {
+    ctx->pSanSymTool = new SANSYMTOOL_NS::GsymSymbolizer(ctx->pSanSymTool, opts->gsym_dir);
+  }
+  if (ctx->pSanSymTool && opts->use_index) {
+    ctx->pSanSymTool = new SANSYMTOOL_NS::IndexSymbolizer(ctx->pSanSymTool, opts->index_dir);
+  }
+
+  ctx->pDataInfoBuf = new std::vector<SANSYMTOOL_NS::DataInfo>();
+  ctx->pAddrInfoBuf = new SANSYMTOOL_NS::AddrInfo();
+  ctx->pStrings = new SANSYMTOOL_NS::StringTable();
+  ctx->pAddrInfoBuf->strings = ctx->pStrings;
+  ctx->pDemangler = new SANSYMTOOL_NS::Demangler();
+  ctx->DemangleNames = opts->demangle;
   return (int) yes_init_done;
 }
 
-void SanSymToolFreeDataRes(void) {
-  if (pDataInfoBuf) {
-    if (pDataInfoBuf->file) { 
-      std::free(pDataInfoBuf->file);
-      pDataInfoBuf->file = nullptr;
-    }
-    if (pDataInfoBuf->name) {
-      std::free(pDataInfoBuf->name);
-      pDataInfoBuf->name = nullptr;
-    }
+// Tells a hung symbolizer apart from other failures
+static RetCode SymbolizeFailure(struct SanSymTool_ctx * ctx) {
+  return ctx->pSanSymTool->LastRequestTimedOut() ? err_timeout : err_symbolize_failed;
+}
+
+// Swaps the name for its demangled copy, if demangling is on.
+static void DemangleName(struct SanSymTool_ctx * ctx, SANSYMTOOL_NS::StringTable * strings, char **name) {
+  if (!(ctx->DemangleNames && ctx->pDemangler && *name)) { return; }
+  if (strings) {
+    *name = const_cast<char *>(ctx->pDemangler->Demangle(*name, strings));
+    return;
+  }
+  const char *demangled = ctx->pDemangler->Demangle(*name);
+  if (demangled != *name) {
+    SANSYMTOOL_NS::FreeResultString(strings, *name);
+    *name = SANSYMTOOL_NS::CopyResultString(strings, demangled);
   }
 }
 
-void SanSymToolFreeAddrRes(void) {
-  if (pAddrInfoBuf) {
-    for (size_t i = 0; i < pAddrInfoBuf->frames.size(); ++i) {
-      struct SANSYMTOOL_NS::FrameDat * pframe = &(pAddrInfoBuf->frames[i]);
-      if (pframe->func) { std::free(pframe->func); }
-      if (pframe->file) { std::free(pframe->file); }
-    }
-    pAddrInfoBuf->frames.clear();
+// Same for the functions of the frames from first on.
+static void DemangleFrames(struct SanSymTool_ctx * ctx, struct SANSYMTOOL_NS::AddrInfo * pinfo, size_t first) {
+  for (size_t i = first; i < pinfo->frames.size(); ++i)
+    DemangleName(ctx, pinfo->strings, &(pinfo->frames[i].func));
+}
+
+// Interned strings are left to SanSymToolFini.
+static void FreeDataInfo(struct SANSYMTOOL_NS::DataInfo * pinfo) {
+  SANSYMTOOL_NS::FreeResultString(pinfo->strings, pinfo->file);
+  SANSYMTOOL_NS::FreeResultString(pinfo->strings, pinfo->name);
+  pinfo->file = nullptr;
+  pinfo->name = nullptr;
+}
+
+static void FreeAddrInfo(struct SANSYMTOOL_NS::AddrInfo * pinfo) {
+  for (size_t i = 0; i < pinfo->frames.size(); ++i) {
+    struct SANSYMTOOL_NS::FrameDat * pframe = &(pinfo->frames[i]);
+    SANSYMTOOL_NS::FreeResultString(pinfo->strings, pframe->func);
+    SANSYMTOOL_NS::FreeResultString(pinfo->strings, pframe->file);
   }
+  pinfo->frames.clear();
 }
 
-void SanSymToolFini(void) {
-  RunningThisTool = run_nothing;
+void SanSymToolFreeDataRes(struct SanSymTool_ctx * ctx) {
+  if (ctx->pDataInfoBuf) {
+    for (size_t i = 0; i < ctx->pDataInfoBuf->size(); ++i)
+      FreeDataInfo(&(*ctx->pDataInfoBuf)[i]);
+    ctx->pDataInfoBuf->clear();
+  }
+}
 
-  if (pSanSymTool) {
-    pSanSymTool->StopTheWorld();
-    delete pSanSymTool;
-    pSanSymTool = nullptr;
+void SanSymToolFreeAddrRes(struct SanSymTool_ctx * ctx) {
+  if (ctx->pAddrInfoBuf) {
+    FreeAddrInfo(ctx->pAddrInfoBuf);
   }
+}
+
+void SanSymToolFini(struct SanSymTool_ctx * ctx) {
+  ctx->RunningThisTool = run_nothing;
 
-  SanSymToolFreeDataRes();
-  if (pDataInfoBuf) {
-    delete pDataInfoBuf;
-    pDataInfoBuf = nullptr;
+  if (ctx->pSanSymTool) {
+    ctx->pSanSymTool->StopTheWorld();
+    delete ctx->pSanSymTool;
+    ctx->pSanSymTool = nullptr;
+    ctx->pSanSymCache = nullptr;
   }
 
-  SanSymToolFreeAddrRes();
-  if (pAddrInfoBuf) {
-    delete pAddrInfoBuf;
-    pAddrInfoBuf = nullptr;
+  SanSymToolFreeDataRes(ctx);
+  if (ctx->pDataInfoBuf) {
+    delete ctx->pDataInfoBuf;
+    ctx->pDataInfoBuf = nullptr;
   }
+
+  SanSymToolFreeAddrRes(ctx);
+  if (ctx->pAddrInfoBuf) {
+    delete ctx->pAddrInfoBuf;
+    ctx->pAddrInfoBuf = nullptr;
+  }
+
+  if (ctx->pStrings) {
+    delete ctx->pStrings;
+    ctx->pStrings = nullptr;
+  }
+
+  if (ctx->pDemangler) {
+    delete ctx->pDemangler;
+    ctx->pDemangler = nullptr;
+  }
+  ctx->DemangleNames = 0;
 }
 
-int SanSymToolSendAddrDat(char *module, unsigned int offset, unsigned long *n_frames) {
-  if (!(pSanSymTool && pAddrInfoBuf)) { return (int) err_has_nullptr; }
+int SanSymToolSendAddrDat(struct SanSymTool_ctx * ctx, char *module, unsigned int offset, unsigned long *n_frames) {
+  if (!(ctx->pSanSymTool && ctx->pAddrInfoBuf)) { return (int) err_has_nullptr; }
 
-  pAddrInfoBuf->module        = module;
-  pAddrInfoBuf->module_offset = offset;
-  pAddrInfoBuf->module_arch   = SANSYMTOOL_NS::kModuleArchUnknown;
+  ctx->pAddrInfoBuf->module        = module;
+  ctx->pAddrInfoBuf->module_offset = offset;
+  ctx->pAddrInfoBuf->module_arch   = SANSYMTOOL_NS::kModuleArchUnknown;
   
-  if (pSanSymTool->SymbolizeAddr(pAddrInfoBuf)) {
-    *n_frames = (pAddrInfoBuf->frames).size();
+  if (ctx->pSanSymTool->SymbolizeAddr(ctx->pAddrInfoBuf)) {
+    DemangleFrames(ctx, ctx->pAddrInfoBuf, 0);
+    *n_frames = (ctx->pAddrInfoBuf->frames).size();
     return (int) yes_send_done;
   } else {
-    return (int) err_symbolize_failed;
+    return (int) SymbolizeFailure(ctx);
   }
 }
 
-int SanSymToolReadAddrDat(unsigned long idx, char **file, char **function, unsigned long *line, unsigned long *column) {
-  if (!(pAddrInfoBuf)) { return (int) err_has_nullptr; }
+int SanSymToolReadAddrDat(struct SanSymTool_ctx * ctx, unsigned long idx, char **file, char **function, unsigned long *line, unsigned long *column) {
+  if (!(ctx->pAddrInfoBuf)) { return (int) err_has_nullptr; }
 
-  if (idx >= (pAddrInfoBuf->frames).size()) { return (int) err_outofbound; }
+  if (idx >= (ctx->pAddrInfoBuf->frames).size()) { return (int) err_outofbound; }
 
-  struct SANSYMTOOL_NS::FrameDat * pframe = &(pAddrInfoBuf->frames[idx]);
+  struct SANSYMTOOL_NS::FrameDat * pframe = &(ctx->pAddrInfoBuf->frames[idx]);
   *file     = pframe->file;
   *function = pframe->func;
   *line     = pframe->lin;
@@ -180,32 +321,377 @@ int SanSymToolReadAddrDat(unsigned long idx, char **file, char **function, unsig
   return (int) yes_read_done;
 }
 
-int SanSymToolSendDataDat(char *module, unsigned int offset) {
-  if (!(pSanSymTool && pDataInfoBuf)) { return (int) err_has_nullptr; }
+int SanSymToolSendAddrBatch(struct SanSymTool_ctx * ctx, char *module, const unsigned int *offsets, unsigned long n, unsigned long *n_frames) {
+  if (!(ctx->pSanSymTool && ctx->pAddrInfoBuf)) { return (int) err_has_nullptr; }
+  if (n && !(module && offsets && n_frames)) { return (int) err_has_nullptr; }
+
+  std::vector<SANSYMTOOL_NS::AddrInfo> infos(n);
+  for (unsigned long i = 0; i < n; ++i) {
+    infos[i].module        = module;
+    infos[i].module_offset = offsets[i];
+    infos[i].module_arch   = SANSYMTOOL_NS::kModuleArchUnknown;
+    infos[i].strings       = ctx->pStrings;
+  }
+
+  if (!ctx->pSanSymTool->SymbolizeAddrBatch(infos.data(), n)) {
+    for (unsigned long i = 0; i < n; ++i) { FreeAddrInfo(&infos[i]); }
+    return (int) SymbolizeFailure(ctx);
+  }
+
+  // Flatten all the frames into the result table,
+  // so that they can be read by SanSymToolReadAddrDat.
+  size_t n_before = ctx->pAddrInfoBuf->frames.size();
+  for (unsigned long i = 0; i < n; ++i) {
+    n_frames[i] = infos[i].frames.size();
+    ctx->pAddrInfoBuf->frames.insert(ctx->pAddrInfoBuf->frames.end(),
+                                     infos[i].frames.begin(), infos[i].frames.end());
+  }
+  DemangleFrames(ctx, ctx->pAddrInfoBuf, n_before);
+  return (int) yes_send_done;
+}
+
+// FNV-1a, so that the same stack hashes the same in every process.
+static unsigned long long HashBytes(unsigned long long hash, const void * data, size_t size) {
+  const unsigned char * bytes = (const unsigned char *) data;
+  for (size_t i = 0; i < size; ++i) {
+    hash ^= bytes[i];
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+// Hashes a frame by its mangled function name, or by its module file
+// name without one, so the hash doesn't depend on demangling, lines or
+// where code is in the module.
+static unsigned long long HashFrame(unsigned long long hash, const struct SANSYMTOOL_NS::FrameDat * pframe, const struct SanSymTool_pc * ppc) {
+  if (pframe->func) {
+    hash = HashBytes(hash, pframe->func, std::strlen(pframe->func));
+  } else {
+    const char *name = SANSYMTOOL_NS::StripModuleName(ppc->module);
+    hash = HashBytes(hash, name, std::strlen(name));
+  }
+  // Keeps "ab" "c" apart from "a" "bc".
+  return HashBytes(hash, "", 1);
+}
+
+int SanSymToolStackSymbolize(struct SanSymTool_ctx * ctx, const struct SanSymTool_pc *pcs, unsigned long n, unsigned long *first_frames, unsigned long hash_frames, unsigned long long *hash) {
+  if (!(ctx->pSanSymTool && ctx->pAddrInfoBuf)) { return (int) err_has_nullptr; }
+  if (!(first_frames)) { return (int) err_has_nullptr; }
+  if (n && !(pcs)) { return (int) err_has_nullptr; }
+  for (unsigned long i = 0; i < n; ++i) {
+    if (!(pcs[i].module)) { return (int) err_has_nullptr; }
+  }
+
+  // Group the PCs by module in the order the modules first show up,
+  // keeping their order within a module. A stack has a handful of
+  // modules, so they are just compared in turn. Then each symbolizer
+  // sees runs of the same module, e.g. addr2line pipelines each run.
+  std::vector<const char *> modules;
+  std::vector<size_t> group(n);
+  for (unsigned long i = 0; i < n; ++i) {
+    size_t m = 0;
+    while (m < modules.size() && 0 != std::strcmp(modules[m], pcs[i].module)) { ++m; }
+    if (m == modules.size()) { modules.push_back(pcs[i].module); }
+    group[i] = m;
+  }
+  std::vector<size_t> order, group_begin;
+  order.reserve(n);
+  for (size_t m = 0; m < modules.size(); ++m) {
+    group_begin.push_back(order.size());
+    for (unsigned long i = 0; i < n; ++i) {
+      if (group[i] == m) { order.push_back(i); }
+    }
+  }
+  group_begin.push_back(n);
+
+  std::vector<SANSYMTOOL_NS::AddrInfo> infos(n);
+  for (unsigned long k = 0; k < n; ++k) {
+    infos[k].module        = pcs[order[k]].module;
+    infos[k].module_offset = pcs[order[k]].offset;
+    infos[k].module_arch   = SANSYMTOOL_NS::kModuleArchUnknown;
+    infos[k].strings       = ctx->pStrings;
+  }
+
+  // A batch fails as a whole. llvm-symbolizer only fails it when the
+  // pipe breaks or it times out, but tools answering one PC at a time
+  // also fail it on a module they can't read. So then each module is
+  // sent again alone, and PCs of the failed ones are left without
+  // frames, since the rest of a crash report is still worth having.
+  // Not after a timeout though, which each module could take again.
+  if (!ctx->pSanSymTool->SymbolizeAddrBatch(infos.data(), n)) {
+    if (ctx->pSanSymTool->LastRequestTimedOut()) { return (int) err_timeout; }
+    size_t n_failed = 0;
+    for (size_t m = 0; m < modules.size(); ++m) {
+      size_t begin = group_begin[m], end = group_begin[m + 1];
+      for (size_t k = begin; k < end; ++k) { FreeAddrInfo(&infos[k]); }
+      if (ctx->pSanSymTool->SymbolizeAddrBatch(&infos[begin], end - begin)) { continue; }
+      for (size_t k = begin; k < end; ++k) { FreeAddrInfo(&infos[k]); }
+      ++n_failed;
+    }
+    if (n_failed == modules.size()) { return (int) SymbolizeFailure(ctx); }
+  }
+
+  // Where each PC's frames end up among those of the whole stack.
+  std::vector<size_t> position(n);
+  for (unsigned long k = 0; k < n; ++k) { position[order[k]] = k; }
+
+  // Flatten the frames back in the order of the stack, hashing the
+  // top ones on the way, before names are demangled.
+  size_t n_before = ctx->pAddrInfoBuf->frames.size();
+  unsigned long long stack_hash = 0xcbf29ce484222325ULL;
+  unsigned long n_hashed = 0;
+  for (unsigned long i = 0; i < n; ++i) {
+    struct SANSYMTOOL_NS::AddrInfo * pinfo = &infos[position[i]];
+    first_frames[i] = ctx->pAddrInfoBuf->frames.size();
+    for (size_t j = 0; j < pinfo->frames.size() && n_hashed < hash_frames; ++j, ++n_hashed)
+      stack_hash = HashFrame(stack_hash, &(pinfo->frames[j]), &pcs[i]);
+    ctx->pAddrInfoBuf->frames.insert(ctx->pAddrInfoBuf->frames.end(),
+                                     pinfo->frames.begin(), pinfo->frames.end());
+  }
+  first_frames[n] = ctx->pAddrInfoBuf->frames.size();
+  if (hash) { *hash = stack_hash; }
+  DemangleFrames(ctx, ctx->pAddrInfoBuf, n_before);
+  return (int) yes_send_done;
+}
+
+int SanSymToolSendDataDat(struct SanSymTool_ctx * ctx, char *module, unsigned int offset) {
+  if (!(ctx->pSanSymTool && ctx->pDataInfoBuf)) { return (int) err_has_nullptr; }
 
-  pDataInfoBuf->module        = module;
-  pDataInfoBuf->module_offset = offset;
-  pDataInfoBuf->module_arch   = SANSYMTOOL_NS::kModuleArchUnknown;
+  ctx->pDataInfoBuf->resize(1);
+  struct SANSYMTOOL_NS::DataInfo * pinfo = &(*ctx->pDataInfoBuf)[0];
+  pinfo->module        = module;
+  pinfo->module_offset = offset;
+  pinfo->module_arch   = SANSYMTOOL_NS::kModuleArchUnknown;
+  pinfo->strings       = ctx->pStrings;
+
+  if (ctx->pSanSymTool->SymbolizeData(pinfo)) {
+    DemangleName(ctx, pinfo->strings, &(pinfo->name));
+    return (int) yes_send_done;
+  } else {
+    return (int) SymbolizeFailure(ctx);
+  }
+}
+
+int SanSymToolSendDataBatch(struct SanSymTool_ctx * ctx, char *module, const unsigned int *offsets, unsigned long n) {
+  if (!(ctx->pSanSymTool && ctx->pDataInfoBuf)) { return (int) err_has_nullptr; }
+  if (n && !(module && offsets)) { return (int) err_has_nullptr; }
+
+  ctx->pDataInfoBuf->resize(n);
+  for (unsigned long i = 0; i < n; ++i) {
+    struct SANSYMTOOL_NS::DataInfo * pinfo = &(*ctx->pDataInfoBuf)[i];
+    pinfo->module        = module;
+    pinfo->module_offset = offsets[i];
+    pinfo->module_arch   = SANSYMTOOL_NS::kModuleArchUnknown;
+    pinfo->strings       = ctx->pStrings;
+  }
 
-  if (pSanSymTool->SymbolizeData(pDataInfoBuf)) {
+  if (ctx->pSanSymTool->SymbolizeDataBatch(ctx->pDataInfoBuf->data(), n)) {
+    for (unsigned long i = 0; i < n; ++i)
+      DemangleName(ctx, ctx->pStrings, &((*ctx->pDataInfoBuf)[i].name));
     return (int) yes_send_done;
   } else {
-    return (int) err_symbolize_failed;
+    SanSymToolFreeDataRes(ctx);
+    return (int) SymbolizeFailure(ctx);
   }
 }
 
-int SanSymToolReadDataDat(char **file, char **name, unsigned long *line, unsigned long *start, unsigned long *size) {
-  if (!(pDataInfoBuf)) { return (int) err_has_nullptr; }
+int SanSymToolReadDataAt(struct SanSymTool_ctx * ctx, unsigned long idx, char **file, char **name, unsigned long *line, unsigned long *start, unsigned long *size) {
+  if (!(ctx->pDataInfoBuf)) { return (int) err_has_nullptr; }
 
-  *file  = pDataInfoBuf->file;
-  *name  = pDataInfoBuf->name;
-  *line  = pDataInfoBuf->line;
-  *start = pDataInfoBuf->start;
-  *size  = pDataInfoBuf->size;
+  if (idx >= ctx->pDataInfoBuf->size()) { return (int) err_outofbound; }
+
+  struct SANSYMTOOL_NS::DataInfo * pinfo = &(*ctx->pDataInfoBuf)[idx];
+  *file  = pinfo->file;
+  *name  = pinfo->name;
+  *line  = pinfo->line;
+  *start = pinfo->start;
+  *size  = pinfo->size;
 
   return (int) yes_read_done;
 }
 
+int SanSymToolReadDataDat(struct SanSymTool_ctx * ctx, char **file, char **name, unsigned long *line, unsigned long *start, unsigned long *size) {
+  return SanSymToolReadDataAt(ctx, 0, file, name, line, start, size);
+}
+
+int SanSymToolAsyncFd(struct SanSymTool_ctx * ctx) {
+  if (!(ctx->pSanSymTool)) { return -1; }
+  return (int) ctx->pSanSymTool->GetCompletionFd();
+}
+
+int SanSymToolSubmitAddr(struct SanSymTool_ctx * ctx, char *module, unsigned int offset, unsigned long *ticket) {
+  if (!(ctx->pSanSymTool && ticket)) { return (int) err_has_nullptr; }
+
+  struct SANSYMTOOL_NS::AddrInfo info;
+  info.module        = module;
+  info.module_offset = offset;
+  info.module_arch   = SANSYMTOOL_NS::kModuleArchUnknown;
+
+  if (!ctx->pSanSymTool->SubmitAddr(info, ctx->NextTicket)) { return (int) err_unsupported_tool; }
+  *ticket = ctx->NextTicket++;
+  return (int) yes_send_done;
+}
+
+int SanSymToolSubmitData(struct SanSymTool_ctx * ctx, char *module, unsigned int offset, unsigned long *ticket) {
+  if (!(ctx->pSanSymTool && ticket)) { return (int) err_has_nullptr; }
+
+  struct SANSYMTOOL_NS::DataInfo info;
+  std::memset(&info, 0, sizeof(info));
+  info.module        = module;
+  info.module_offset = offset;
+  info.module_arch   = SANSYMTOOL_NS::kModuleArchUnknown;
+
+  if (!ctx->pSanSymTool->SubmitData(info, ctx->NextTicket)) { return (int) err_unsupported_tool; }
+  *ticket = ctx->NextTicket++;
+  return (int) yes_send_done;
+}
+
+int SanSymToolPoll(struct SanSymTool_ctx * ctx, unsigned long *ticket, int *is_data, unsigned long *n_frames) {
+  if (!(ctx->pSanSymTool && ctx->pAddrInfoBuf && ctx->pDataInfoBuf)) { return (int) err_has_nullptr; }
+  if (!(ticket && is_data && n_frames)) { return (int) err_has_nullptr; }
+
+  struct SANSYMTOOL_NS::DataInfo data;
+  std::memset(&data, 0, sizeof(data));
+  data.strings = ctx->pStrings;
+  SANSYMTOOL_NS::u64 done = 0;
+  bool is_data_ = false, ok = false;
+  size_t n_before = ctx->pAddrInfoBuf->frames.size();
+  if (!ctx->pSanSymTool->PollCompletion(&done, &is_data_, &ok, &data, ctx->pAddrInfoBuf)) {
+    return (int) err_not_ready;
+  }
+
+  *ticket  = done;
+  *is_data = is_data_;
+  if (!ok) { return (int) err_symbolize_failed; }
+  if (is_data_) {
+    ctx->pDataInfoBuf->resize(1);
+    (*ctx->pDataInfoBuf)[0] = data;
+    DemangleName(ctx, ctx->pStrings, &((*ctx->pDataInfoBuf)[0].name));
+  } else {
+    *n_frames = ctx->pAddrInfoBuf->frames.size() - n_before;
+    DemangleFrames(ctx, ctx->pAddrInfoBuf, n_before);
+  }
+  return (int) yes_poll_done;
+}
+
+void SanSymToolSetDemangle(struct SanSymTool_ctx * ctx, int demangle) {
+  ctx->DemangleNames = demangle;
+}
+
+int SanSymToolCacheStats(struct SanSymTool_ctx * ctx, unsigned long *hits, unsigned long *misses, unsigned long *size) {
+  if (!(hits && misses && size)) { return (int) err_has_nullptr; }
+  if (!(ctx->pSanSymCache)) { return (int) err_unsupported_tool; }
+
+  *hits   = ctx->pSanSymCache->hits();
+  *misses = ctx->pSanSymCache->misses();
+  *size   = ctx->pSanSymCache->size();
+  return (int) yes_read_done;
+}
+
+int SanSymToolCreate(const char * path, const struct SanSymTool_options * opts, struct SanSymTool_ctx ** pctx) {
+  if (!(pctx)) { return (int) err_has_nullptr; }
+
+  struct SanSymTool_ctx * ctx = new SanSymTool_ctx();
+  int ret = SanSymToolInit(ctx, path, opts);
+  if (ret != (int) yes_init_done) {
+    SanSymToolFini(ctx);
+    delete ctx;
+    ctx = nullptr;
+  }
+  *pctx = ctx;
+  return ret;
+}
+
+void SanSymToolDestroy(struct SanSymTool_ctx * ctx) {
+  SanSymToolFini(ctx);
+  delete ctx;
+}
+
+// A context whose tool chain is only used by the service thread,
+// which callers on any thread hand their requests to.
+struct SanSymTool_service {
+  struct SanSymTool_ctx ctx;
+  SANSYMTOOL_NS::SymbolizerService * pService = nullptr;
+};
+
+void SanSymToolServiceDestroy(struct SanSymTool_service * svc) {
+  // The service thread is stopped before its tool is destroyed.
+  if (svc->pService) {
+    delete svc->pService;
+    svc->pService = nullptr;
+  }
+  SanSymToolFini(&svc->ctx);
+  delete svc;
+}
+
+int SanSymToolServiceCreate(const char * path, const struct SanSymTool_options * opts, struct SanSymTool_service ** psvc) {
+  if (!(psvc)) { return (int) err_has_nullptr; }
+
+  struct SanSymTool_service * svc = new SanSymTool_service();
+  int ret = SanSymToolInit(&svc->ctx, path, opts);
+  if (ret == (int) yes_init_done && !svc->ctx.pSanSymTool) { ret = (int) err_has_nullptr; }
+  if (ret == (int) yes_init_done) {
+    svc->pService = new SANSYMTOOL_NS::SymbolizerService(
+        svc->ctx.pSanSymTool, svc->ctx.pStrings,
+        svc->ctx.DemangleNames ? svc->ctx.pDemangler : nullptr);
+    if (!svc->pService->Start()) { ret = (int) err_unsupported_tool; }
+  }
+  if (ret != (int) yes_init_done) {
+    SanSymToolServiceDestroy(svc);
+    svc = nullptr;
+  }
+  *psvc = svc;
+  return ret;
+}
+
+int SanSymToolServiceAddr(struct SanSymTool_service * svc, char *module, unsigned int offset, struct SanSymTool_frame *frames, unsigned long max_frames, unsigned long *n_frames) {
+  if (!(svc && svc->pService && n_frames)) { return (int) err_has_nullptr; }
+  if (max_frames && !(frames)) { return (int) err_has_nullptr; }
+
+  struct SANSYMTOOL_NS::AddrInfo info;
+  info.module        = module;
+  info.module_offset = offset;
+  info.module_arch   = SANSYMTOOL_NS::kModuleArchUnknown;
+
+  bool timed_out = false;
+  if (!svc->pService->SymbolizeAddr(&info, &timed_out)) {
+    return (int) (timed_out ? err_timeout : err_symbolize_failed);
+  }
+
+  // Strings are interned by the service, so they are given as they are.
+  *n_frames = info.frames.size();
+  for (size_t i = 0; i < info.frames.size() && i < max_frames; ++i) {
+    frames[i].file     = info.frames[i].file;
+    frames[i].function = info.frames[i].func;
+    frames[i].line     = info.frames[i].lin;
+    frames[i].column   = info.frames[i].col;
+  }
+  return (int) yes_send_done;
+}
+
+int SanSymToolServiceData(struct SanSymTool_service * svc, char *module, unsigned int offset, char **file, char **name, unsigned long *line, unsigned long *start, unsigned long *size) {
+  if (!(svc && svc->pService)) { return (int) err_has_nullptr; }
+  if (!(file && name && line && start && size)) { return (int) err_has_nullptr; }
+
+  struct SANSYMTOOL_NS::DataInfo info;
+  std::memset(&info, 0, sizeof(info));
+  info.module        = module;
+  info.module_offset = offset;
+  info.module_arch   = SANSYMTOOL_NS::kModuleArchUnknown;
+
+  bool timed_out = false;
+  if (!svc->pService->SymbolizeData(&info, &timed_out)) {
+    return (int) (timed_out ? err_timeout : err_symbolize_failed);
+  }
+
+  *file  = info.file;
+  *name  = info.name;
+  *line  = info.line;
+  *start = info.start;
+  *size  = info.size;
+  return (int) yes_send_done;
+}
+
 
 /* Wrapper for public interface header */
 
@@ -213,42 +699,220 @@ extern "C" {
 
 SANITIZER_INTERFACE_ATTRIBUTE
 int SanSymTool_init(const char * external_symbolizer_path) {
-  return SanSymToolInit(external_symbolizer_path);
+  return SanSymToolInit(&DefaultCtx, external_symbolizer_path, nullptr);
+}
+
+SANITIZER_INTERFACE_ATTRIBUTE
+int SanSymTool_init_ex(const char * external_symbolizer_path, const struct SanSymTool_options * opts) {
+  return SanSymToolInit(&DefaultCtx, external_symbolizer_path, opts);
 }
 
 SANITIZER_INTERFACE_ATTRIBUTE
 void SanSymTool_fini(void) {
-  SanSymToolFini();
+  SanSymToolFini(&DefaultCtx);
 }
 
 SANITIZER_INTERFACE_ATTRIBUTE
 int SanSymTool_addr_send(char *module, unsigned int offset, unsigned long *n_frames) {
-  return SanSymToolSendAddrDat(module, offset, n_frames);
+  return SanSymToolSendAddrDat(&DefaultCtx, module, offset, n_frames);
 }
 
 SANITIZER_INTERFACE_ATTRIBUTE
 int SanSymTool_addr_read(unsigned long idx, char **file, char **function, unsigned long *line, unsigned long *column) {
-  return SanSymToolReadAddrDat(idx, file, function, line, column);
+  return SanSymToolReadAddrDat(&DefaultCtx, idx, file, function, line, column);
 }
 
 SANITIZER_INTERFACE_ATTRIBUTE
 void SanSymTool_addr_free(void) {
-  SanSymToolFreeAddrRes();
+  SanSymToolFreeAddrRes(&DefaultCtx);
+}
+
+SANITIZER_INTERFACE_ATTRIBUTE
+int SanSymTool_addr_send_batch(char *module, const unsigned int *offsets, unsigned long n, unsigned long *n_frames) {
+  return SanSymToolSendAddrBatch(&DefaultCtx, module, offsets, n, n_frames);
+}
+
+SANITIZER_INTERFACE_ATTRIBUTE
+int SanSymTool_stack_symbolize(const struct SanSymTool_pc *pcs, unsigned long n, unsigned long *first_frames, unsigned long hash_frames, unsigned long long *hash) {
+  return SanSymToolStackSymbolize(&DefaultCtx, pcs, n, first_frames, hash_frames, hash);
 }
 
 SANITIZER_INTERFACE_ATTRIBUTE
 int SanSymTool_data_send(char *module, unsigned int offset) {
-  return SanSymToolSendDataDat(module, offset);
+  return SanSymToolSendDataDat(&DefaultCtx, module, offset);
 }
 
 SANITIZER_INTERFACE_ATTRIBUTE
 int SanSymTool_data_read(char **file, char **name, unsigned long *line, unsigned long *start, unsigned long *size) {
-  return SanSymToolReadDataDat(file, name, line, start, size);
+  return SanSymToolReadDataDat(&DefaultCtx, file, name, line, start, size);
+}
+
+SANITIZER_INTERFACE_ATTRIBUTE
+int SanSymTool_data_send_batch(char *module, const unsigned int *offsets, unsigned long n) {
+  return SanSymToolSendDataBatch(&DefaultCtx, module, offsets, n);
+}
+
+SANITIZER_INTERFACE_ATTRIBUTE
+int SanSymTool_data_read_at(unsigned long idx, char **file, char **name, unsigned long *line, unsigned long *start, unsigned long *size) {
+  return SanSymToolReadDataAt(&DefaultCtx, idx, file, name, line, start, size);
 }
 
 SANITIZER_INTERFACE_ATTRIBUTE
 void SanSymTool_data_free(void) {
-  SanSymToolFreeDataRes();
+  SanSymToolFreeDataRes(&DefaultCtx);
+}
+
+SANITIZER_INTERFACE_ATTRIBUTE
+int SanSymTool_async_fd(void) {
+  return SanSymToolAsyncFd(&DefaultCtx);
+}
+
+SANITIZER_INTERFACE_ATTRIBUTE
+int SanSymTool_addr_submit(char *module, unsigned int offset, unsigned long *ticket) {
+  return SanSymToolSubmitAddr(&DefaultCtx, module, offset, ticket);
+}
+
+SANITIZER_INTERFACE_ATTRIBUTE
+int SanSymTool_data_submit(char *module, unsigned int offset, unsigned long *ticket) {
+  return SanSymToolSubmitData(&DefaultCtx, module, offset, ticket);
+}
+
+SANITIZER_INTERFACE_ATTRIBUTE
+int SanSymTool_async_poll(unsigned long *ticket, int *is_data, unsigned long *n_frames) {
+  return SanSymToolPoll(&DefaultCtx, ticket, is_data, n_frames);
+}
+
+SANITIZER_INTERFACE_ATTRIBUTE
+void SanSymTool_set_demangle(int demangle) {
+  SanSymToolSetDemangle(&DefaultCtx, demangle);
+}
+
+SANITIZER_INTERFACE_ATTRIBUTE
+int SanSymTool_cache_stats(unsigned long *hits, unsigned long *misses, unsigned long *size) {
+  return SanSymToolCacheStats(&DefaultCtx, hits, misses, size);
+}
+
+SANITIZER_INTERFACE_ATTRIBUTE
+int SanSymTool_ctx_create(const char * external_symbolizer_path, const struct SanSymTool_options * opts, SanSymTool_ctx ** ctx) {
+  return SanSymToolCreate(external_symbolizer_path, opts, ctx);
+}
+
+SANITIZER_INTERFACE_ATTRIBUTE
+void SanSymTool_ctx_destroy(SanSymTool_ctx * ctx) {
+  if (ctx) { SanSymToolDestroy(ctx); }
+}
+
+SANITIZER_INTERFACE_ATTRIBUTE
+int SanSymTool_ctx_addr_send(SanSymTool_ctx * ctx, char *module, unsigned int offset, unsigned long *n_frames) {
+  if (!(ctx)) { return (int) err_has_nullptr; }
+  return SanSymToolSendAddrDat(ctx, module, offset, n_frames);
+}
+
+SANITIZER_INTERFACE_ATTRIBUTE
+int SanSymTool_ctx_addr_read(SanSymTool_ctx * ctx, unsigned long idx, char **file, char **function, unsigned long *line, unsigned long *column) {
+  if (!(ctx)) { return (int) err_has_nullptr; }
+  return SanSymToolReadAddrDat(ctx, idx, file, function, line, column);
+}
+
+SANITIZER_INTERFACE_ATTRIBUTE
+void SanSymTool_ctx_addr_free(SanSymTool_ctx * ctx) {
+  if (ctx) { SanSymToolFreeAddrRes(ctx); }
+}
+
+SANITIZER_INTERFACE_ATTRIBUTE
+int SanSymTool_ctx_addr_send_batch(SanSymTool_ctx * ctx, char *module, const unsigned int *offsets, unsigned long n, unsigned long *n_frames) {
+  if (!(ctx)) { return (int) err_has_nullptr; }
+  return SanSymToolSendAddrBatch(ctx, module, offsets, n, n_frames);
+}
+
+SANITIZER_INTERFACE_ATTRIBUTE
+int SanSymTool_ctx_stack_symbolize(SanSymTool_ctx * ctx, const struct SanSymTool_pc *pcs, unsigned long n, unsigned long *first_frames, unsigned long hash_frames, unsigned long long *hash) {
+  if (!(ctx)) { return (int) err_has_nullptr; }
+  return SanSymToolStackSymbolize(ctx, pcs, n, first_frames, hash_frames, hash);
+}
+
+SANITIZER_INTERFACE_ATTRIBUTE
+int SanSymTool_ctx_data_send(SanSymTool_ctx * ctx, char *module, unsigned int offset) {
+  if (!(ctx)) { return (int) err_has_nullptr; }
+  return SanSymToolSendDataDat(ctx, module, offset);
+}
+
+SANITIZER_INTERFACE_ATTRIBUTE
+int SanSymTool_ctx_data_read(SanSymTool_ctx * ctx, char **file, char **name, unsigned long *line, unsigned long *start, unsigned long *size) {
+  if (!(ctx)) { return (int) err_has_nullptr; }
+  return SanSymToolReadDataDat(ctx, file, name, line, start, size);
+}
+
+SANITIZER_INTERFACE_ATTRIBUTE
+int SanSymTool_ctx_data_send_batch(SanSymTool_ctx * ctx, char *module, const unsigned int *offsets, unsigned long n) {
+  if (!(ctx)) { return (int) err_has_nullptr; }
+  return SanSymToolSendDataBatch(ctx, module, offsets, n);
+}
+
+SANITIZER_INTERFACE_ATTRIBUTE
+int SanSymTool_ctx_data_read_at(SanSymTool_ctx * ctx, unsigned long idx, char **file, char **name, unsigned long *line, unsigned long *start, unsigned long *size) {
+  if (!(ctx)) { return (int) err_has_nullptr; }
+  return SanSymToolReadDataAt(ctx, idx, file, name, line, start, size);
+}
+
+SANITIZER_INTERFACE_ATTRIBUTE
+void SanSymTool_ctx_data_free(SanSymTool_ctx * ctx) {
+  if (ctx) { SanSymToolFreeDataRes(ctx); }
+}
+
+SANITIZER_INTERFACE_ATTRIBUTE
+int SanSymTool_ctx_async_fd(SanSymTool_ctx * ctx) {
+  if (!(ctx)) { return -1; }
+  return SanSymToolAsyncFd(ctx);
+}
+
+SANITIZER_INTERFACE_ATTRIBUTE
+int SanSymTool_ctx_addr_submit(SanSymTool_ctx * ctx, char *module, unsigned int offset, unsigned long *ticket) {
+  if (!(ctx)) { return (int) err_has_nullptr; }
+  return SanSymToolSubmitAddr(ctx, module, offset, ticket);
+}
+
+SANITIZER_INTERFACE_ATTRIBUTE
+int SanSymTool_ctx_data_submit(SanSymTool_ctx * ctx, char *module, unsigned int offset, unsigned long *ticket) {
+  if (!(ctx)) { return (int) err_has_nullptr; }
+  return SanSymToolSubmitData(ctx, module, offset, ticket);
+}
+
+SANITIZER_INTERFACE_ATTRIBUTE
+int SanSymTool_ctx_async_poll(SanSymTool_ctx * ctx, unsigned long *ticket, int *is_data, unsigned long *n_frames) {
+  if (!(ctx)) { return (int) err_has_nullptr; }
+  return SanSymToolPoll(ctx, ticket, is_data, n_frames);
+}
+
+SANITIZER_INTERFACE_ATTRIBUTE
+void SanSymTool_ctx_set_demangle(SanSymTool_ctx * ctx, int demangle) {
+  if (ctx) { SanSymToolSetDemangle(ctx, demangle); }
+}
+
+SANITIZER_INTERFACE_ATTRIBUTE
+int SanSymTool_ctx_cache_stats(SanSymTool_ctx * ctx, unsigned long *hits, unsigned long *misses, unsigned long *size) {
+  if (!(ctx)) { return (int) err_has_nullptr; }
+  return SanSymToolCacheStats(ctx, hits, misses, size);
+}
+
+SANITIZER_INTERFACE_ATTRIBUTE
+int SanSymTool_service_create(const char * external_symbolizer_path, const struct SanSymTool_options * opts, SanSymTool_service ** svc) {
+  return SanSymToolServiceCreate(external_symbolizer_path, opts, svc);
+}
+
+SANITIZER_INTERFACE_ATTRIBUTE
+void SanSymTool_service_destroy(SanSymTool_service * svc) {
+  if (svc) { SanSymToolServiceDestroy(svc); }
+}
+
+SANITIZER_INTERFACE_ATTRIBUTE
+int SanSymTool_service_addr(SanSymTool_service * svc, char *module, unsigned int offset, struct SanSymTool_frame *frames, unsigned long max_frames, unsigned long *n_frames) {
+  return SanSymToolServiceAddr(svc, module, offset, frames, max_frames, n_frames);
+}
+
+SANITIZER_INTERFACE_ATTRIBUTE
+int SanSymTool_service_data(SanSymTool_service * svc, char *module, unsigned int offset, char **file, char **name, unsigned long *line, unsigned long *start, unsigned long *size) {
+  return SanSymToolServiceData(svc, module, offset, file, name, line, start, size);
 }
 
 } // extern "C"
\ No newline at end of file
@@ -0,0 +1,284 @@
+//===-- symbol_index.cpp --------------------------------------------------===//
+//
+// Based on the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file gives implementation of the index files and their reader.
+//===----------------------------------------------------------------------===//
+
+#include "symbol_index.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#if SANITIZER_POSIX
+
+#include <unistd.h>
+
+#else // SANITIZER_POSIX
+#error ONLY SUPPORT POSIX NOW
+#endif // SANITIZER_POSIX
+
+namespace SANSYMTOOL_NS
+{
+
+static const char kSymbolIndexMagic[8] = {'S', 'S', 'T', 'I', 'N', 'D', 'E', 'X'};
+
+static uptr AlignUp8(uptr offset) { return (offset + 7) & ~(uptr)7; }
+
+// Places a table of |n| entries of |entry_size| bytes at |*offset|,
+// which is moved past it. Returns false if it isn't all in |size|.
+static bool PlaceTable(uptr size, u64 n, uptr entry_size, uptr *offset,
+                       uptr *table) {
+  uptr start = AlignUp8(*offset);
+  if (start > size || n > (size - start) / entry_size)
+    return false;
+  *table = start;
+  *offset = start + n * entry_size;
+  return true;
+}
+
+SymbolIndex::SymbolIndex()
+    : map_(nullptr), map_size_(0), header_(nullptr), code_starts_(nullptr),
+      code_chains_(nullptr), data_starts_(nullptr), data_(nullptr),
+      chains_(nullptr), chain_frames_(nullptr), frames_(nullptr),
+      strings_(nullptr) {}
+
+SymbolIndex::~SymbolIndex() { Close(); }
+
+void SymbolIndex::Close() {
+  UnmapFromMemory(map_, map_size_);
+  map_ = nullptr;
+  map_size_ = 0;
+  header_ = nullptr;
+}
+
+bool SymbolIndex::Open(const char *path) {
+  Close();
+  uptr size = 0;
+  const u8 *map = (const u8 *)MapFileToMemory(path, &size);
+  if (!map)
+    return false;
+  map_ = map;
+  map_size_ = size;
+
+  const SymbolIndexHeader *header = (const SymbolIndexHeader *)map;
+  bool ok = size >= sizeof(SymbolIndexHeader) &&
+            !std::memcmp(header->magic, kSymbolIndexMagic,
+                         sizeof(kSymbolIndexMagic)) &&
+            header->version == kSymbolIndexVersion &&
+            header->header_size == sizeof(SymbolIndexHeader) &&
+            header->identity[kSymbolIndexMaxIdentity - 1] == '\0' &&
+            header->n_chains < ~0U;
+  uptr offset = sizeof(SymbolIndexHeader);
+  uptr code_starts = 0, code_chains = 0, data_starts = 0, data = 0;
+  uptr chains = 0, chain_frames = 0, frames = 0, strings = 0;
+  ok = ok &&
+       PlaceTable(size, header->n_code, sizeof(u64), &offset, &code_starts) &&
+       PlaceTable(size, header->n_code, sizeof(u32), &offset, &code_chains) &&
+       PlaceTable(size, header->n_data, sizeof(u64), &offset, &data_starts) &&
+       PlaceTable(size, header->n_data, sizeof(SymbolIndexData), &offset,
+                  &data) &&
+       PlaceTable(size, header->n_chains + 1, sizeof(u32), &offset, &chains) &&
+       PlaceTable(size, header->n_chain_frames, sizeof(u32), &offset,
+                  &chain_frames) &&
+       PlaceTable(size, header->n_frames, sizeof(SymbolIndexFrame), &offset,
+                  &frames) &&
+       PlaceTable(size, header->strings_size, 1, &offset, &strings);
+  // A terminated string table keeps every string in it terminated.
+  ok = ok && (header->strings_size == 0 ||
+              map[strings + header->strings_size - 1] == '\0');
+  if (!ok) {
+    Close();
+    return false;
+  }
+
+  header_       = header;
+  code_starts_  = (const u64 *)(map + code_starts);
+  code_chains_  = (const u32 *)(map + code_chains);
+  data_starts_  = (const u64 *)(map + data_starts);
+  data_         = (const SymbolIndexData *)(map + data);
+  chains_       = (const u32 *)(map + chains);
+  chain_frames_ = (const u32 *)(map + chain_frames);
+  frames_       = (const SymbolIndexFrame *)(map + frames);
+  strings_      = (const char *)(map + strings);
+  return true;
+}
+
+sptr SymbolIndex::FindRange(const u64 *starts, uptr n, u64 offset) {
+  return std::upper_bound(starts, starts + n, offset) - starts - 1;
+}
+
+bool SymbolIndex::GetString(u32 offset, const char **str) const {
+  if (offset == kSymbolIndexNoString) {
+    *str = nullptr;
+    return true;
+  }
+  if (offset >= header_->strings_size)
+    return false;
+  *str = strings_ + offset;
+  return true;
+}
+
+bool SymbolIndex::Lookup(DataInfo *info) const {
+  if (!header_)
+    return false;
+  sptr i = FindRange(data_starts_, header_->n_data, info->module_offset);
+  if (i < 0 || data_[i].name == kSymbolIndexNoString)
+    return false;
+  const SymbolIndexData &data = data_[i];
+  const char *name, *file;
+  if (!GetString(data.name, &name) || !GetString(data.file, &file))
+    return false;
+  info->name  = CopyResultString(info->strings, name);
+  info->file  = CopyResultString(info->strings, file);
+  info->line  = data.line;
+  info->start = data.start;
+  info->size  = data.size;
+  return true;
+}
+
+bool SymbolIndex::Lookup(AddrInfo *info) const {
+  if (!header_)
+    return false;
+  sptr i = FindRange(code_starts_, header_->n_code, info->module_offset);
+  if (i < 0 || code_chains_[i] >= header_->n_chains)
+    return false;
+  u32 first = chains_[code_chains_[i]];
+  u32 last  = chains_[code_chains_[i] + 1];
+  if (first > last || last > header_->n_chain_frames)
+    return false;
+  // Check the whole chain before giving any of it.
+  const char *str;
+  for (u32 j = first; j < last; ++j) {
+    if (chain_frames_[j] >= header_->n_frames)
+      return false;
+    const SymbolIndexFrame &frame = frames_[chain_frames_[j]];
+    if (!GetString(frame.func, &str) || !GetString(frame.file, &str))
+      return false;
+  }
+  for (u32 j = first; j < last; ++j) {
+    const SymbolIndexFrame &frame = frames_[chain_frames_[j]];
+    FrameDat dat;
+    GetString(frame.func, &str);
+    dat.func = CopyResultString(info->strings, str);
+    GetString(frame.file, &str);
+    dat.file = CopyResultString(info->strings, str);
+    dat.lin  = frame.line;
+    dat.col  = frame.column;
+    info->frames.push_back(dat);
+  }
+  return true;
+}
+
+SymbolIndexWriter::SymbolIndexWriter() { chains_.push_back(0); }
+
+u32 SymbolIndexWriter::AddString(const char *str) {
+  if (!str)
+    return kSymbolIndexNoString;
+  auto it = string_ids_.emplace(str, (u32)strings_.size());
+  if (it.second)
+    strings_.insert(strings_.end(), str, str + std::strlen(str) + 1);
+  return it.first->second;
+}
+
+u32 SymbolIndexWriter::AddFrame(const FrameDat &dat) {
+  SymbolIndexFrame frame;
+  frame.func   = AddString(dat.func);
+  frame.file   = AddString(dat.file);
+  frame.line   = (u32)dat.lin;
+  frame.column = (u32)dat.col;
+  auto it = frame_ids_.emplace(std::string((const char *)&frame, sizeof(frame)),
+                               (u32)frames_.size());
+  if (it.second)
+    frames_.push_back(frame);
+  return it.first->second;
+}
+
+u32 SymbolIndexWriter::AddChain(const FrameDat *frames, uptr n_frames) {
+  std::vector<u32> ids(n_frames);
+  for (uptr i = 0; i < n_frames; ++i)
+    ids[i] = AddFrame(frames[i]);
+  auto it = chain_ids_.emplace(
+      std::string((const char *)ids.data(), ids.size() * sizeof(u32)),
+      (u32)(chains_.size() - 1));
+  if (it.second) {
+    chain_frames_.insert(chain_frames_.end(), ids.begin(), ids.end());
+    chains_.push_back((u32)chain_frames_.size());
+  }
+  return it.first->second;
+}
+
+void SymbolIndexWriter::AddCode(u64 start, const FrameDat *frames,
+                                uptr n_frames) {
+  CHECK(code_starts_.empty() || start > code_starts_.back());
+  u32 chain = n_frames ? AddChain(frames, n_frames) : kSymbolIndexNoChain;
+  if (!code_chains_.empty() && code_chains_.back() == chain)
+    return;
+  code_starts_.push_back(start);
+  code_chains_.push_back(chain);
+}
+
+void SymbolIndexWriter::AddData(u64 start, const DataInfo *info) {
+  CHECK(data_starts_.empty() || start > data_starts_.back());
+  SymbolIndexData data;
+  std::memset(&data, 0, sizeof(data));
+  data.name = kSymbolIndexNoString;
+  data.file = kSymbolIndexNoString;
+  if (info && info->name) {
+    data.start = info->start;
+    data.size  = info->size;
+    data.name  = AddString(info->name);
+    data.file  = AddString(info->file);
+    data.line  = (u32)info->line;
+  }
+  if (!data_.empty() && !std::memcmp(&data_.back(), &data, sizeof(data)))
+    return;
+  data_starts_.push_back(start);
+  data_.push_back(data);
+}
+
+// Adds a chunk of |size| bytes, then zeros up to a multiple of 8 bytes.
+static void AddTable(std::vector<FileChunk> *chunks, const void *data,
+                     uptr size) {
+  static const char kZeros[8] = {};
+  FileChunk table = {data, size};
+  FileChunk padding = {kZeros, AlignUp8(size) - size};
+  chunks->push_back(table);
+  chunks->push_back(padding);
+}
+
+bool SymbolIndexWriter::Write(const char *path, const char *identity) const {
+  SymbolIndexHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, kSymbolIndexMagic, sizeof(kSymbolIndexMagic));
+  header.version        = kSymbolIndexVersion;
+  header.header_size    = sizeof(SymbolIndexHeader);
+  header.n_code         = code_starts_.size();
+  header.n_data         = data_starts_.size();
+  header.n_chains       = chains_.size() - 1;
+  header.n_chain_frames = chain_frames_.size();
+  header.n_frames       = frames_.size();
+  header.strings_size   = strings_.size();
+  std::snprintf(header.identity, sizeof(header.identity), "%s", identity);
+
+  std::vector<FileChunk> chunks;
+  AddTable(&chunks, &header, sizeof(header));
+  AddTable(&chunks, code_starts_.data(), code_starts_.size() * sizeof(u64));
+  AddTable(&chunks, code_chains_.data(), code_chains_.size() * sizeof(u32));
+  AddTable(&chunks, data_starts_.data(), data_starts_.size() * sizeof(u64));
+  AddTable(&chunks, data_.data(), data_.size() * sizeof(SymbolIndexData));
+  AddTable(&chunks, chains_.data(), chains_.size() * sizeof(u32));
+  AddTable(&chunks, chain_frames_.data(),
+           chain_frames_.size() * sizeof(u32));
+  AddTable(&chunks, frames_.data(), frames_.size() * sizeof(SymbolIndexFrame));
+  AddTable(&chunks, strings_.data(), strings_.size());
+  return WriteFileAtomically(path, chunks.data(), chunks.size());
+}
+
+} // namespace SANSYMTOOL_NS
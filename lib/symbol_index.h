@@ -0,0 +1,165 @@
+//===-- symbol_index.h ----------------------------------------------------===//
+//
+// Based on the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file declares the index files made by sansymtool-index, holding
+// every answer of a symbolizer tool for a module, and their reader.
+//===----------------------------------------------------------------------===//
+
+#ifndef SANSYMTOOL_HEAD_SYMBOL_INDEX_H
+#define SANSYMTOOL_HEAD_SYMBOL_INDEX_H
+
+#include "symbolizer.h"
+
+#include <string>
+#include <unordered_map>
+
+namespace SANSYMTOOL_NS
+{
+
+// Layout of an index file, all in host byte order, where every
+// table starts at a multiple of 8 bytes:
+//   SymbolIndexHeader
+//   u64              code_starts[n_code]
+//   u32              code_chains[n_code]
+//   u64              data_starts[n_data]
+//   SymbolIndexData  data[n_data]
+//   u32              chains[n_chains + 1]
+//   u32              chain_frames[n_chain_frames]
+//   SymbolIndexFrame frames[n_frames]
+//   char             strings[strings_size]
+// Code range i covers offsets from code_starts[i] to code_starts[i + 1],
+// and its answer is chain code_chains[i]: the frames listed from
+// chain_frames[chains[c]] up to chain_frames[chains[c + 1]], innermost
+// first. Equal frames and chains are kept once. Data ranges are the
+// same, each with its answer in data[i]. kSymbolIndexNoChain, or data
+// without a name, marks a range with no answer, like the one ending
+// each section. Strings are referred to by offset, where
+// kSymbolIndexNoString stands for nullptr.
+static const u32 kSymbolIndexVersion = 1;
+static const u32 kSymbolIndexNoChain = ~0U;
+static const u32 kSymbolIndexNoString = ~0U;
+static const uptr kSymbolIndexMaxIdentity = 160;
+// Index files are named after their module with this appended.
+static const char kSymbolIndexSuffix[] = ".ssti";
+
+struct SymbolIndexHeader {
+  char magic[8];
+  u32  version;
+  u32  header_size;
+  u64  n_code;
+  u64  n_data;
+  u64  n_chains;
+  u64  n_chain_frames;
+  u64  n_frames;
+  u64  strings_size;
+  // GetModuleIdentity of the module it was made from.
+  char identity[kSymbolIndexMaxIdentity];
+};
+
+struct SymbolIndexFrame {
+  u32 func;
+  u32 file;
+  u32 line;
+  u32 column;
+};
+
+struct SymbolIndexData {
+  u64 start;
+  u64 size;
+  u32 name;
+  u32 file;
+  u32 line;
+  u32 reserved;
+};
+
+// Read-only view of an index file mapped into memory. Opening one
+// only checks the header against the file size, and every table is
+// used in place, so it costs nothing but the mapping. A lookup is a
+// binary search of the starts, then copying the strings of the answer.
+class SymbolIndex {
+ public:
+  SymbolIndex();
+  ~SymbolIndex();
+  SymbolIndex(const SymbolIndex &) = delete;
+  SymbolIndex &operator=(const SymbolIndex &) = delete;
+
+  // Returns false if |path| can't be mapped or isn't a valid index.
+  bool Open(const char *path);
+  void Close();
+  bool IsOpen() const { return header_ != nullptr; }
+
+  const char *identity() const { return header_->identity; }
+
+  // On a hit, fill in the answer as the indexed tool gave it.
+  // Strings are copied like the tools do, see CopyResultString.
+  bool Lookup(DataInfo *info) const;
+  bool Lookup(AddrInfo *info) const;
+
+ private:
+  // Index of the last range starting at or before |offset|, or -1.
+  static sptr FindRange(const u64 *starts, uptr n, u64 offset);
+  // Returns false if |offset| isn't a string of the index.
+  bool GetString(u32 offset, const char **str) const;
+
+  const u8 *map_;
+  uptr map_size_;
+  const SymbolIndexHeader *header_;
+  const u64 *code_starts_;
+  const u32 *code_chains_;
+  const u64 *data_starts_;
+  const SymbolIndexData *data_;
+  const u32 *chains_;
+  const u32 *chain_frames_;
+  const SymbolIndexFrame *frames_;
+  const char *strings_;
+};
+
+// Collects the answers for a module, range by range, and writes
+// them out as an index file.
+class SymbolIndexWriter {
+ public:
+  SymbolIndexWriter();
+
+  // Each range lasts until the next one is added, which must start
+  // further. With no frames, or no name for data, there is no answer
+  // for it. A range with the same answer as the one before is merged
+  // into it.
+  void AddCode(u64 start, const FrameDat *frames, uptr n_frames);
+  void AddData(u64 start, const DataInfo *info);
+
+  uptr NumCodeRanges() const { return code_starts_.size(); }
+  uptr NumDataRanges() const { return data_starts_.size(); }
+  uptr NumChains() const { return chains_.size() - 1; }
+  uptr NumFrames() const { return frames_.size(); }
+  uptr StringsSize() const { return strings_.size(); }
+
+  // Replaces |path| by rename, so readers never see a partial file.
+  bool Write(const char *path, const char *identity) const;
+
+ private:
+  u32 AddString(const char *str);
+  u32 AddFrame(const FrameDat &frame);
+  u32 AddChain(const FrameDat *frames, uptr n_frames);
+
+  std::vector<u64> code_starts_;
+  std::vector<u32> code_chains_;
+  std::vector<u64> data_starts_;
+  std::vector<SymbolIndexData> data_;
+  std::vector<u32> chains_;
+  std::vector<u32> chain_frames_;
+  std::vector<SymbolIndexFrame> frames_;
+  std::vector<char> strings_;
+  // Everything kept once, by its bytes.
+  std::unordered_map<std::string, u32> string_ids_;
+  std::unordered_map<std::string, u32> frame_ids_;
+  std::unordered_map<std::string, u32> chain_ids_;
+};
+
+} // namespace SANSYMTOOL_NS
+
+#endif // SANSYMTOOL_HEAD_SYMBOL_INDEX_H
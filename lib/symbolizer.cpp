@@ -30,19 +30,172 @@
 namespace SANSYMTOOL_NS
 {
 
-SymbolizerProcess::SymbolizerProcess(const char *path, bool use_posix_spawn)
+SymbolizerProcess::SymbolizerProcess(const char *path, bool use_posix_spawn,
+                                     u32 timeout_ms)
     : active_pid_(-1),
       path_(path),
       input_fd_(kInvalidFd),
       output_fd_(kInvalidFd),
+      batch_commands_(nullptr),
+      batch_size_(0),
+      batch_written_(0),
+      batch_read_(0),
+      batch_parsed_(0),
+      batch_scanned_(0),
+      async_(false),
+      async_parsed_(0),
+      async_scanned_(0),
       times_restarted_(0),
       failed_to_start_(false),
       reported_invalid_path_(false),
-      use_posix_spawn_(use_posix_spawn) {
+      use_posix_spawn_(use_posix_spawn),
+      timeout_ms_(timeout_ms),
+      deadline_(0),
+      timed_out_(false) {
   CHECK(path_);
   CHECK_NE(path_[0], '\0');
 }
 
+StringArena::~StringArena() {
+  Clear();
+  for (uptr i = 0; i < chunks_.size(); ++i)
+    std::free(chunks_[i]);
+}
+
+char *StringArena::Copy(const char *str, uptr size) {
+  char *copy;
+  if (size + 1 > kChunkSize / 4) {
+    copy = (char *)std::malloc(size + 1);
+    CHECK(copy);
+    large_.push_back(copy);
+  } else {
+    if (chunks_.empty() || used_ + size + 1 > kChunkSize) {
+      char *chunk = (char *)std::malloc(kChunkSize);
+      CHECK(chunk);
+      chunks_.push_back(chunk);
+      used_ = 0;
+    }
+    copy = chunks_.back() + used_;
+    used_ += size + 1;
+  }
+  std::memcpy(copy, str, size);
+  copy[size] = '\0';
+  return copy;
+}
+
+void StringArena::Clear() {
+  for (uptr i = 0; i < large_.size(); ++i)
+    std::free(large_[i]);
+  large_.clear();
+  for (uptr i = 1; i < chunks_.size(); ++i)
+    std::free(chunks_[i]);
+  if (chunks_.size() > 1)
+    chunks_.resize(1);
+  used_ = 0;
+}
+
+// Mixes eight bytes at a time, since demangled C++ names run to
+// hundreds of bytes and are hashed on every result.
+static u64 HashString(const char *str, uptr size) {
+  const u64 kMul = 0x9e3779b97f4a7c15ULL;
+  u64 hash = size * kMul;
+  for (; size >= 8; str += 8, size -= 8) {
+    u64 word;
+    std::memcpy(&word, str, 8);
+    hash = (hash ^ word) * kMul;
+    hash ^= hash >> 32;
+  }
+  if (size) {
+    u64 word = 0;
+    std::memcpy(&word, str, size);
+    hash = (hash ^ word) * kMul;
+  }
+  hash ^= hash >> 29;
+  return hash * kMul;
+}
+
+const char *StringTable::Intern(const char *str, uptr size) {
+  // Kept at most 3/4 full, so that probing stays short.
+  if ((size_ + 1) * 4 > slots_.size() * 3)
+    Grow();
+  u64 hash = HashString(str, size);
+  uptr mask = slots_.size() - 1;
+  for (uptr i = hash & mask;; i = (i + 1) & mask) {
+    Slot &slot = slots_[i];
+    if (!slot.str) {
+      slot.str = strings_.Copy(str, size);
+      slot.size = size;
+      slot.hash = hash;
+      ++size_;
+      return slot.str;
+    }
+    if (slot.hash == hash && slot.size == size &&
+        !std::memcmp(slot.str, str, size))
+      return slot.str;
+  }
+}
+
+void StringTable::Grow() {
+  std::vector<Slot> slots(slots_.empty() ? 1024 : slots_.size() * 2);
+  uptr mask = slots.size() - 1;
+  for (uptr i = 0; i < slots_.size(); ++i) {
+    if (!slots_[i].str)
+      continue;
+    uptr j = slots_[i].hash & mask;
+    while (slots[j].str)
+      j = (j + 1) & mask;
+    slots[j] = slots_[i];
+  }
+  slots_.swap(slots);
+}
+
+char *CopyResultString(StringTable *strings, const char *str) {
+  return str ? CopyResultString(strings, str, std::strlen(str)) : nullptr;
+}
+
+char *CopyResultString(StringTable *strings, const char *str, uptr size) {
+  if (strings)
+    return const_cast<char *>(strings->Intern(str, size));
+  char *copy = (char *)std::malloc(size + 1);
+  CHECK(copy);
+  std::memcpy(copy, str, size);
+  copy[size] = '\0';
+  return copy;
+}
+
+void FreeResultString(StringTable *strings, char *str) {
+  if (!strings)
+    std::free(str);
+}
+
+OutputBuffer::~OutputBuffer() { std::free(data_); }
+
+void OutputBuffer::reserve(uptr size) {
+  if (size <= capacity_)
+    return;
+  uptr capacity = capacity_ ? capacity_ * 2 : 4096;
+  if (capacity < size)
+    capacity = size;
+  char *data = (char *)std::realloc(data_, capacity);
+  CHECK(data);
+  data_ = data;
+  capacity_ = capacity;
+}
+
+bool SymbolizerTool::SymbolizeDataBatch(DataInfo *infos, uptr n) {
+  for (uptr i = 0; i < n; ++i)
+    if (!SymbolizeData(&infos[i]))
+      return false;
+  return true;
+}
+
+bool SymbolizerTool::SymbolizeAddrBatch(AddrInfo *infos, uptr n) {
+  for (uptr i = 0; i < n; ++i)
+    if (!SymbolizeAddr(&infos[i]))
+      return false;
+  return true;
+}
+
 static bool IsSameModule(const char* path) {
   // Sanitizer may be used for symbolizer itself.
   // This will never happen for our tool.
@@ -57,11 +210,16 @@ const char *SymbolizerProcess::SendCommand(const char *command) {
     failed_to_start_ = true;
     return nullptr;
   }
+  timed_out_ = false;
   for (; times_restarted_ < kMaxTimesRestarted; times_restarted_++) {
     // Start or restart symbolizer if we failed to send command to it.
     if (const char *res = SendCommandImpl(command))
       return res;
     Restart();
+    // The same command would most likely hang it again.
+    // Not counted as a restart, the symbolizer wasn't broken.
+    if (timed_out_)
+      return nullptr;
   }
   if (!failed_to_start_) {
     SAYSTH("WARNING: Failed to use and restart external symbolizer!\n");
@@ -73,6 +231,7 @@ const char *SymbolizerProcess::SendCommand(const char *command) {
 const char *SymbolizerProcess::SendCommandImpl(const char *command) {
   if (input_fd_ == kInvalidFd || output_fd_ == kInvalidFd)
       return nullptr;
+  StartDeadline();
   if (!WriteToSymbolizer(command, std::strlen(command)))
       return nullptr;
   if (!ReadFromSymbolizer())
@@ -88,44 +247,259 @@ bool SymbolizerProcess::Restart() {
     CloseFile(input_fd_);
   if (output_fd_ != kInvalidFd)
     CloseFile(output_fd_);
+  // Never close them twice, the numbers may have been reused.
+  input_fd_ = output_fd_ = kInvalidFd;
+  ResetAsync();
   return StartSymbolizerSubprocess();
 }
 
 proc_id_t SymbolizerProcess::GetPID() { return active_pid_; }
 
-bool SymbolizerProcess::ReadFromSymbolizer() {
+bool SymbolizerProcess::SendCommandBatch(const char *const *commands, uptr n,
+                                         std::vector<const char *> *responses) {
+  responses->clear();
+  if (n == 0)
+    return true;
+  if (failed_to_start_)
+    return false;
+  timed_out_ = false;
+  for (; times_restarted_ < kMaxTimesRestarted; times_restarted_++) {
+    // The whole batch is resent after a restart, since there's
+    // no way to tell which commands the dead symbolizer handled.
+    if (SendCommandBatchImpl(commands, n, responses))
+      return true;
+    Restart();
+    if (timed_out_)
+      return false;
+  }
+  if (!failed_to_start_) {
+    SAYSTH("WARNING: Failed to use and restart external symbolizer!\n");
+    failed_to_start_ = true;
+  }
+  return false;
+}
+
+bool SymbolizerProcess::SendCommandBatchImpl(const char *const *commands,
+                                             uptr n,
+                                             std::vector<const char *> *responses) {
+  if (input_fd_ == kInvalidFd || output_fd_ == kInvalidFd)
+    return false;
+  ResetBatch(commands, n);
+  while (!BatchDone()) {
+    if (!WriteBatchWindow() || !ReadBatchWindow())
+      return false;
+  }
+  FinishBatch(responses);
+  return true;
+}
+
+bool SymbolizerProcess::BeginBatch(const char *const *commands, uptr n) {
+  timed_out_ = false;
+  if (failed_to_start_)
+    return false;
+  // Start the symbolizer lazily, like the first SendCommand does.
+  if ((input_fd_ == kInvalidFd || output_fd_ == kInvalidFd) && !Restart())
+    return false;
+  ResetBatch(commands, n);
+  return true;
+}
+
+void SymbolizerProcess::ResetBatch(const char *const *commands, uptr n) {
+  batch_commands_ = commands;
+  batch_size_ = n;
+  batch_written_ = batch_read_ = batch_parsed_ = batch_scanned_ = 0;
   buffer_.clear();
-  constexpr uptr max_length = 1024;
-  bool ret = true;
-  do {
-    uptr just_read = 0;
-    uptr size_before = buffer_.size();
-    buffer_.resize(size_before + max_length);
-    buffer_.resize(buffer_.capacity());
-    bool ret = ReadFromFile(input_fd_, &buffer_[size_before],
-                            buffer_.size() - size_before, &just_read);
+  // Pairs of (start, content length) for each response in buffer_.
+  batch_spans_.clear();
+  StartDeadline();
+}
+
+bool SymbolizerProcess::WriteBatchWindow() {
+  // Gather a window of commands, at least one.
+  batch_buffer_.clear();
+  uptr window_end = batch_written_;
+  while (window_end < batch_size_) {
+    const char *command = batch_commands_[window_end];
+    uptr len = std::strlen(command);
+    if (window_end > batch_written_ &&
+        batch_buffer_.size() + len > kBatchWindowSize)
+      break;
+    batch_buffer_.insert(batch_buffer_.end(), command, command + len);
+    ++window_end;
+  }
+  if (!WriteToSymbolizer(batch_buffer_.data(), batch_buffer_.size()))
+    return false;
+  batch_written_ = window_end;
+  return true;
+}
+
+bool SymbolizerProcess::ReadBatchWindow() {
+  // Collect all the responses to the commands written so far.
+  while (batch_read_ < batch_written_) {
+    uptr content = 0, length = 0;
+    uptr size = buffer_.size() - batch_parsed_;
+    if (FindEndOfOutput(buffer_.data() + batch_parsed_, size, batch_scanned_,
+                        &content, &length)) {
+      batch_spans_.push_back(batch_parsed_);
+      batch_spans_.push_back(content);
+      batch_parsed_ += length;
+      batch_scanned_ = 0;
+      ++batch_read_;
+      // Each response gets the full time, so a big batch
+      // fails only if the symbolizer stops making progress.
+      StartDeadline();
+    } else {
+      batch_scanned_ = size;
+      if (!AppendFromSymbolizer())
+        return false;
+    }
+  }
+  return true;
+}
+
+void SymbolizerProcess::FinishBatch(std::vector<const char *> *responses) {
+  CHECK(BatchDone());
+  uptr n = batch_size_;
+  // Make room for the terminating null after each response.
+  // Moving them from back to front never clobbers an unmoved one.
+  buffer_.resize(batch_parsed_ + n);
+  for (uptr i = n; i-- > 0;) {
+    uptr start = batch_spans_[2 * i], content = batch_spans_[2 * i + 1];
+    std::memmove(&buffer_[start + i], &buffer_[start], content);
+    buffer_[start + i + content] = '\0';
+  }
+  responses->resize(n);
+  for (uptr i = 0; i < n; ++i)
+    (*responses)[i] = &buffer_[batch_spans_[2 * i] + i];
+  batch_commands_ = nullptr;
+}
+
+void SymbolizerProcess::ResetAsync() {
+  async_pending_.clear();
+  async_parsed_ = async_scanned_ = 0;
+  if (async_)
+    buffer_.clear();
+}
 
-    if (!ret)
-      just_read = 0;
+bool SymbolizerProcess::AsyncWrite(const char *command) {
+  CHECK(async_);
+  async_pending_.insert(async_pending_.end(), command,
+                        command + std::strlen(command));
+  return AsyncFlush();
+}
 
-    buffer_.resize(size_before + just_read);
+bool SymbolizerProcess::AsyncFlush() {
+  while (!async_pending_.empty()) {
+    uptr write_len = 0;
+    error_t err = 0;
+    if (!WriteToFile(output_fd_, async_pending_.data(), async_pending_.size(),
+                     &write_len, &err)) {
+      if (err == EAGAIN || err == EWOULDBLOCK)
+        return true;
+      SAYSTH("WARNING: Can't write to symbolizer");
+      std::fprintf(stderr, "(at fd %d)\n", output_fd_);
+      return false;
+    }
+    async_pending_.erase(async_pending_.begin(),
+                         async_pending_.begin() + write_len);
+  }
+  return true;
+}
 
-    // We can't read 0 bytes, as we don't expect external symbolizer to close
-    // its stdout.
-    if (just_read == 0) {
+bool SymbolizerProcess::AsyncRead() {
+  CHECK(async_);
+  constexpr uptr min_length = 4096;
+  while (true) {
+    uptr just_read = 0;
+    error_t err = 0;
+    buffer_.reserve(buffer_.size() + min_length);
+    bool success = ReadFromFile(input_fd_, buffer_.data() + buffer_.size(),
+                                buffer_.spare(), &just_read, &err);
+    if (success)
+      buffer_.commit(just_read);
+    if (!success && (err == EAGAIN || err == EWOULDBLOCK))
+      return true;
+    // EOF, the symbolizer has closed its stdout.
+    if (!success || just_read == 0) {
       SAYSTH("WARNING: Can't read from symbolizer");
       std::fprintf(stderr, "(at fd %d)\n", input_fd_);
-      ret = false;
-      break;
+      return false;
     }
-  } while (!ReachedEndOfOutput(buffer_.data(), buffer_.size()));
+  }
+}
+
+const char *SymbolizerProcess::AsyncNextResponse() {
+  CHECK(async_);
+  uptr content = 0, length = 0;
+  uptr size = buffer_.size() - async_parsed_;
+  if (!FindEndOfOutput(buffer_.data() + async_parsed_, size, async_scanned_,
+                       &content, &length)) {
+    async_scanned_ = size;
+    return nullptr;
+  }
+  // Copied out, since the next AsyncRead may move buffer_.
+  const char *start = buffer_.data() + async_parsed_;
+  async_response_.assign(start, start + content);
+  async_response_.push_back('\0');
+  async_parsed_ += length;
+  async_scanned_ = 0;
+  // Drop what has been consumed once it's all used up.
+  if (async_parsed_ == buffer_.size()) {
+    buffer_.clear();
+    async_parsed_ = 0;
+  }
+  return async_response_.data();
+}
+
+// Leaves the response in buffer_, cut to its meaningful
+// part and null-terminated in place.
+bool SymbolizerProcess::ReadFromSymbolizer() {
+  buffer_.clear();
+  uptr scanned = 0, content = 0, length = 0;
+  while (!FindEndOfOutput(buffer_.data(), buffer_.size(), scanned,
+                          &content, &length)) {
+    scanned = buffer_.size();
+    if (!AppendFromSymbolizer()) {
+      buffer_.push_back('\0');
+      return false;
+    }
+  }
+  buffer_.resize(content);
   buffer_.push_back('\0');
-  return ret;
+  return true;
+}
+
+// Reads whatever is available from the symbolizer and
+// appends it to buffer_. Returns false if nothing was read.
+bool SymbolizerProcess::AppendFromSymbolizer() {
+  constexpr uptr min_length = 4096;
+  if (!WaitForIO(input_fd_, /* for_write */ false))
+    return false;
+  uptr just_read = 0;
+  buffer_.reserve(buffer_.size() + min_length);
+  bool ret = ReadFromFile(input_fd_, buffer_.data() + buffer_.size(),
+                          buffer_.spare(), &just_read);
+
+  if (!ret)
+    just_read = 0;
+
+  buffer_.commit(just_read);
+
+  // We can't read 0 bytes, as we don't expect external symbolizer to close
+  // its stdout.
+  if (just_read == 0) {
+    SAYSTH("WARNING: Can't read from symbolizer");
+    std::fprintf(stderr, "(at fd %d)\n", input_fd_);
+    return false;
+  }
+  return true;
 }
 
 bool SymbolizerProcess::WriteToSymbolizer(const char *buffer, uptr length) {
   if (length == 0)
     return true;
+  if (!WaitForIO(output_fd_, /* for_write */ true))
+    return false;
   uptr write_len = 0;
   bool success = WriteToFile(output_fd_, buffer, length, &write_len);
   if (!success || write_len != length) {
@@ -140,8 +514,13 @@ bool SymbolizerProcess::WriteToSymbolizer(const char *buffer, uptr length) {
 /* POSIX-specific implementation of symbolizer parts */
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <sys/wait.h>
 #include <signal.h>
+#include <spawn.h>
+#include <dirent.h>
+#include <sys/syscall.h>
 
 bool CreateTwoHighNumberedPipes(int *infd_, int *outfd_) {
   int *infd = NULL;
@@ -183,6 +562,49 @@ bool CreateTwoHighNumberedPipes(int *infd_, int *outfd_) {
   return true;
 }
 
+// Closes all fds >= |lowfd| in a freshly forked child, so
+// only async-signal-safe calls are made here. Looping up to
+// _SC_OPEN_MAX costs one syscall per possible fd, which is
+// about a million of them with a high nofile limit. Try
+// close_range (Linux 5.9) first, then only the fds listed
+// in /proc/self/fd, and the loop as the last resort.
+static void CloseFdsFrom(int lowfd) {
+#if defined(SYS_close_range)
+  if (syscall(SYS_close_range, lowfd, ~0U, 0) == 0) { return; }
+#endif
+#if SANITIZER_LINUX && defined(SYS_getdents64)
+  int dir_fd = open("/proc/self/fd", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (dir_fd >= 0) {
+    // Layout of struct linux_dirent64.
+    struct dirent64_header {
+      u64 d_ino;
+      s64 d_off;
+      unsigned short d_reclen;
+      unsigned char d_type;
+      char d_name[1];
+    };
+    char buf[4096] __attribute__((aligned(8)));
+    for (;;) {
+      long nread = syscall(SYS_getdents64, dir_fd, buf, sizeof(buf));
+      if (nread <= 0) { break; }
+      for (long pos = 0; pos < nread;) {
+        struct dirent64_header *d = (struct dirent64_header *)(buf + pos);
+        const char *name = d->d_name;
+        pos += d->d_reclen;
+        if (name[0] < '0' || name[0] > '9') { continue; }
+        int fd = 0;
+        for (; *name >= '0' && *name <= '9'; ++name)
+          fd = fd * 10 + (*name - '0');
+        if (fd >= lowfd && fd != dir_fd) { close(fd); }
+      }
+    }
+    close(dir_fd);
+    return;
+  }
+#endif
+  for (int fd = sysconf(_SC_OPEN_MAX); fd >= lowfd; fd--) close(fd);
+}
+
 // Starts a subprocess and returs its pid.
 // Originally declared in sanitizer_file.h.
 // Here is its POSIX implementation with envs copied.
@@ -191,10 +613,8 @@ bool CreateTwoHighNumberedPipes(int *infd_, int *outfd_) {
 // The files will always be closed in parent process even in case of an error.
 // The child process will close all fds after STDERR_FILENO
 // before passing control to a program.
-pid_t StartSubprocess(const char *program, const char *const argv[], 
-                      fd_t stdin_fd  = kInvalidFd,
-                      fd_t stdout_fd = kInvalidFd,
-                      fd_t stderr_fd = kInvalidFd) {
+pid_t StartSubprocess(const char *program, const char *const argv[],
+                      fd_t stdin_fd, fd_t stdout_fd, fd_t stderr_fd) {
   auto file_closer = at_scope_exit([&] {
     if (stdin_fd != kInvalidFd) {
       close(stdin_fd);
@@ -255,7 +675,7 @@ pid_t StartSubprocess(const char *program, const char *const argv[],
       close(stderr_fd);
     }
 
-    for (int fd = sysconf(_SC_OPEN_MAX); fd > 2; fd--) close(fd);
+    CloseFdsFrom(STDERR_FILENO + 1);
 
     execv(program, const_cast<char **>(&argv[0]));
 
@@ -265,13 +685,113 @@ pid_t StartSubprocess(const char *program, const char *const argv[],
   return pid;
 }
 
+// Same as StartSubprocess, but launched by posix_spawn. glibc
+// implements it with a CLONE_VM|CLONE_VFORK clone, so nothing of
+// the parent's address space is copied, which is much cheaper than
+// fork when the host is large. The child is set up the same way:
+// SIGPIPE back to default, a new session, and the fds redirected.
+// Fds after STDERR_FILENO are closed with posix_spawn_file_actions_
+// addclosefrom_np where available (glibc 2.34). Otherwise only the
+// ones marked close-on-exec are closed.
+pid_t SpawnSubprocess(const char *program, const char *const argv[],
+                      fd_t stdin_fd, fd_t stdout_fd, fd_t stderr_fd) {
+  auto file_closer = at_scope_exit([&] {
+    if (stdin_fd != kInvalidFd) {
+      close(stdin_fd);
+    }
+    if (stdout_fd != kInvalidFd) {
+      close(stdout_fd);
+    }
+    if (stderr_fd != kInvalidFd) {
+      close(stderr_fd);
+    }
+  });
+
+  posix_spawn_file_actions_t actions;
+  posix_spawnattr_t attr;
+  int err = posix_spawn_file_actions_init(&actions);
+  if (err) {
+    SAYSTH("WARNING: failed to init spawn actions");
+    std::fprintf(stderr, "(with errno %d)\n", err);
+    return -1;
+  }
+  err = posix_spawnattr_init(&attr);
+  if (err) {
+    posix_spawn_file_actions_destroy(&actions);
+    SAYSTH("WARNING: failed to init spawn attributes");
+    std::fprintf(stderr, "(with errno %d)\n", err);
+    return -1;
+  }
+  auto spawn_cleaner = at_scope_exit([&] {
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+  });
+
+  if (stdin_fd != kInvalidFd && !err) {
+    err = posix_spawn_file_actions_adddup2(&actions, stdin_fd, STDIN_FILENO);
+    if (!err)
+      err = posix_spawn_file_actions_addclose(&actions, stdin_fd);
+  }
+  if (stdout_fd != kInvalidFd && !err) {
+    err = posix_spawn_file_actions_adddup2(&actions, stdout_fd, STDOUT_FILENO);
+    if (!err)
+      err = posix_spawn_file_actions_addclose(&actions, stdout_fd);
+  }
+  if (stderr_fd != kInvalidFd && !err) {
+    err = posix_spawn_file_actions_adddup2(&actions, stderr_fd, STDERR_FILENO);
+    if (!err)
+      err = posix_spawn_file_actions_addclose(&actions, stderr_fd);
+  }
+#if defined(__GLIBC__) && defined(__GLIBC_PREREQ)
+# if __GLIBC_PREREQ(2, 34)
+  if (!err)
+    err = posix_spawn_file_actions_addclosefrom_np(&actions, STDERR_FILENO + 1);
+# endif
+#endif
+
+  // See StartSubprocess for why SIGPIPE is reset and setsid is needed.
+  short flags = POSIX_SPAWN_SETSIGDEF;
+  sigset_t sigdefault;
+  sigemptyset(&sigdefault);
+  sigaddset(&sigdefault, SIGPIPE);
+  if (!err)
+    err = posix_spawnattr_setsigdefault(&attr, &sigdefault);
+#ifdef POSIX_SPAWN_SETSID
+  flags |= POSIX_SPAWN_SETSID;
+#else
+  // At least keep it out of the terminal's foreground process group.
+  flags |= POSIX_SPAWN_SETPGROUP;
+  if (!err)
+    err = posix_spawnattr_setpgroup(&attr, 0);
+#endif
+  if (!err)
+    err = posix_spawnattr_setflags(&attr, flags);
+  if (err) {
+    SAYSTH("WARNING: failed to set up spawn");
+    std::fprintf(stderr, "(with errno %d)\n", err);
+    return -1;
+  }
+
+  pid_t pid;
+  err = posix_spawn(&pid, program, &actions, &attr,
+                    const_cast<char **>(&argv[0]), ::environ);
+  if (err) {
+    SAYSTH("WARNING: failed to posix_spawn");
+    std::fprintf(stderr, "(with errno %d)\n", err);
+    return -1;
+  }
+  return pid;
+}
+
 // Send SIGKILL to a child process and wait for it
 bool KillChildProcess(pid_t pid) {
   // check its status first
   pid_t waitpid_status = waitpid(pid, 0, WNOHANG);
-  if (waitpid_status == 0) { return true; }
+  // Already exited, and now it's reaped.
+  if (waitpid_status == pid) { return true; }
   if (waitpid_status <  0) {
-    if (errno == ECHILD) { return false; }
+    // Already reaped by someone else, e.g. IsProcessRunning.
+    if (errno == ECHILD) { return true; }
     else {
       SAYSTH("Waiting on child process failed");
       std::fprintf(stderr, "(with errno %d)\n", errno);
@@ -318,6 +838,37 @@ int WaitForProcess(pid_t pid) {
   return process_status;
 }
 
+bool SymbolizerProcess::StartAsync() {
+  if (input_fd_ != kInvalidFd && output_fd_ != kInvalidFd && async_)
+    return true;
+  if (failed_to_start_)
+    return false;
+  if (input_fd_ == kInvalidFd || output_fd_ == kInvalidFd) {
+    // Restarts are limited just like in SendCommand.
+    if (times_restarted_ >= kMaxTimesRestarted) {
+      SAYSTH("WARNING: Failed to use and restart external symbolizer!\n");
+      failed_to_start_ = true;
+      return false;
+    }
+    times_restarted_++;
+    // Set first, so that the child isn't waited for while starting.
+    async_ = true;
+    if (!Restart())
+      return false;
+  }
+  for (fd_t fd : {input_fd_, output_fd_}) {
+    int flags = fcntl(fd, F_GETFL);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+      SAYSTH("WARNING: Can't make the pipe non-blocking");
+      std::fprintf(stderr, "(with errno %d)\n", errno);
+      return false;
+    }
+  }
+  async_ = true;
+  ResetAsync();
+  return true;
+}
+
 bool SymbolizerProcess::StartSymbolizerSubprocess() {
   if (!FileExists(path_)) {
     if (!reported_invalid_path_) {
@@ -340,39 +891,121 @@ bool SymbolizerProcess::StartSymbolizerSubprocess() {
   std::fprintf(stderr, "\n");
 #endif
 
-  if (use_posix_spawn_) {
-    UNIMPLEMENTED(); // we don't support this since getting env is complex
-  } else {
-    fd_t infd[2] = {}, outfd[2] = {};
-    if (!CreateTwoHighNumberedPipes(infd, outfd)) {
-      SAYSTH("WARNING: Can't create a socket pair to start "
-             "external symbolizer");
-      std::fprintf(stderr, "(with errno: %d)\n", errno);
-      return false;
-    }
+  fd_t infd[2] = {}, outfd[2] = {};
+  if (!CreateTwoHighNumberedPipes(infd, outfd)) {
+    SAYSTH("WARNING: Can't create a socket pair to start "
+           "external symbolizer");
+    std::fprintf(stderr, "(with errno: %d)\n", errno);
+    return false;
+  }
+  // Our own ends must not leak into this child or any later one.
+  fcntl(infd[0], F_SETFD, FD_CLOEXEC);
+  fcntl(outfd[1], F_SETFD, FD_CLOEXEC);
 
+  if (use_posix_spawn_)
+    pid = SpawnSubprocess(path_, argv, /* stdin */ outfd[0], /* stdout */ infd[1]);
+  else
     pid = StartSubprocess(path_, argv, /* stdin */ outfd[0], /* stdout */ infd[1]);
-    if (pid < 0) {
-      close(infd[0]);
-      close(outfd[1]);
-      return false;
-    }
-
-    input_fd_ = infd[0];
-    output_fd_ = outfd[1];
+  if (pid < 0) {
+    close(infd[0]);
+    close(outfd[1]);
+    return false;
   }
 
+  input_fd_ = infd[0];
+  output_fd_ = outfd[1];
+
   CHECK_GT(pid, 0);
+  active_pid_ = pid;
+
+  // Non-blocking callers must never wait for the child to come up.
+  // If it doesn't, the first AsyncRead finds its stdout closed.
+  if (async_)
+    return true;
 
   // Check that symbolizer subprocess started successfully.
-  usleep((u64)kSymbolizerStartupTimeMillis * 1000);
-  if (!IsProcessRunning(pid)) {
-    // Either waitpid failed, or child has already exited.
+  // Prefer a round trip, which takes only as long as the child
+  // really needs, and also catches one that can't serve requests.
+  char probe[kProbeBufferSize];
+  GetReadinessProbe(path_, probe, kProbeBufferSize);
+  bool ready;
+  if (probe[0] != '\0') {
+    ready = WaitUntilReady(probe);
+  } else {
+    usleep((u64)kSymbolizerStartupTimeMillis * 1000);
+    ready = IsProcessRunning(pid);
+  }
+  if (!ready) {
+    // Either waitpid failed, or child has already exited or hung.
     SAYSTH("WARNING: external symbolizer didn't start up correctly!\n");
+    Kill();
     return false;
   }
-  
-  active_pid_ = pid;
+  return true;
+}
+
+void SymbolizerProcess::StartDeadline() {
+  deadline_ = timeout_ms_
+                  ? MonotonicNanoTime() + (u64)timeout_ms_ * 1000 * 1000
+                  : 0;
+}
+
+// Waits until |fd| can be read or written without blocking.
+// Returns false if deadline_ passes first. With no deadline,
+// returns true at once and lets the blocking call wait.
+bool SymbolizerProcess::WaitForIO(fd_t fd, bool for_write) {
+  if (!deadline_)
+    return true;
+  while (true) {
+    u64 now = MonotonicNanoTime();
+    if (now >= deadline_) {
+      SAYSTH("WARNING: Symbolizer didn't answer in time");
+      std::fprintf(stderr, "(%u ms)\n", timeout_ms_);
+      timed_out_ = true;
+      return false;
+    }
+    struct pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = for_write ? POLLOUT : POLLIN;
+    pfd.revents = 0;
+    int res = poll(&pfd, 1, (int)((deadline_ - now) / (1000 * 1000)) + 1);
+    if (res < 0 && errno == EINTR)
+      continue;
+    // Errors and hangups are left to the read or write.
+    if (res != 0)
+      return true;
+  }
+}
+
+bool SymbolizerProcess::WaitUntilReady(const char *probe) {
+  // Startup has a deadline of its own, not the request's one.
+  deadline_ = 0;
+  if (!WriteToSymbolizer(probe, std::strlen(probe)))
+    return false;
+  buffer_.clear();
+  u64 deadline = MonotonicNanoTime() +
+                 (u64)kSymbolizerReadyTimeoutMillis * 1000 * 1000;
+  uptr scanned = 0, content = 0, length = 0;
+  while (!FindEndOfOutput(buffer_.data(), buffer_.size(), scanned,
+                          &content, &length)) {
+    scanned = buffer_.size();
+    u64 now = MonotonicNanoTime();
+    if (now >= deadline)
+      return false;
+    struct pollfd pfd;
+    pfd.fd = input_fd_;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    int res = poll(&pfd, 1, (int)((deadline - now) / (1000 * 1000)) + 1);
+    if (res < 0 && errno == EINTR)
+      continue;
+    if (res < 0)
+      return false;
+    // Hung up with nothing left to read is caught here as well.
+    if (res > 0 && !AppendFromSymbolizer())
+      return false;
+  }
+  buffer_.clear();
   return true;
 }
 
@@ -398,58 +1031,63 @@ bool SymbolizerProcess::Kill() {
       CloseFile(input_fd_);
     if (output_fd_ != kInvalidFd)
       CloseFile(output_fd_);
+    input_fd_ = output_fd_ = kInvalidFd;
+    ResetAsync();
     return true;
   }
 }
 
-const char *ExtractToken(const char *str, const char *delims, char **result) {
+const char *ExtractToken(const char *str, const char *delims, char **result,
+                         StringTable *strings) {
   std::size_t prefix_len = std::strcspn(str, delims);
-  *result = (char*)std::malloc(prefix_len + 1);
-  std::memcpy(*result, str, prefix_len);
-  (*result)[prefix_len] = '\0';
+  *result = CopyResultString(strings, str, prefix_len);
+  const char *prefix_end = str + prefix_len;
+  if (*prefix_end != '\0') prefix_end++;
+  return prefix_end;
+}
+
+// Numbers are read from a copy on the stack, so that atoll never
+// looks past the delimiter.
+static const char *ExtractNumber(const char *str, const char *delims,
+                                 long long *result) {
+  std::size_t prefix_len = std::strcspn(str, delims);
+  char buff[32];
+  uptr size = prefix_len < sizeof(buff) ? prefix_len : sizeof(buff) - 1;
+  std::memcpy(buff, str, size);
+  buff[size] = '\0';
+  *result = std::atoll(buff);
   const char *prefix_end = str + prefix_len;
   if (*prefix_end != '\0') prefix_end++;
   return prefix_end;
 }
 
 const char *ExtractInt(const char *str, const char *delims, int *result) {
-  char *buff = nullptr;
-  const char *ret = ExtractToken(str, delims, &buff);
-  if (buff) {
-    *result = (int)std::atoll(buff);
-  }
-  std::free(buff);
+  long long number;
+  const char *ret = ExtractNumber(str, delims, &number);
+  *result = (int)number;
   return ret;
 }
 
 const char *ExtractUptr(const char *str, const char *delims, uptr *result) {
-  char *buff = nullptr;
-  const char *ret = ExtractToken(str, delims, &buff);
-  if (buff) {
-    *result = (uptr)std::atoll(buff);
-  }
-  std::free(buff);
+  long long number;
+  const char *ret = ExtractNumber(str, delims, &number);
+  *result = (uptr)number;
   return ret;
 }
 
 const char *ExtractSptr(const char *str, const char *delims, sptr *result) {
-  char *buff = nullptr;
-  const char *ret = ExtractToken(str, delims, &buff);
-  if (buff) {
-    *result = (sptr)std::atoll(buff);
-  }
-  std::free(buff);
+  long long number;
+  const char *ret = ExtractNumber(str, delims, &number);
+  *result = (sptr)number;
   return ret;
 }
 
 const char *ExtractTokenUpToDelimiter(const char *str, const char *delimiter,
-                                      char **result) {
+                                      char **result, StringTable *strings) {
   const char *found_delimiter = std::strstr(str, delimiter);
   uptr prefix_len =
       found_delimiter ? found_delimiter - str : std::strlen(str);
-  *result = (char *)std::malloc(prefix_len + 1);
-  std::memcpy(*result, str, prefix_len);
-  (*result)[prefix_len] = '\0';
+  *result = CopyResultString(strings, str, prefix_len);
   const char *prefix_end = str + prefix_len;
   if (*prefix_end != '\0') prefix_end += std::strlen(delimiter);
   return prefix_end;
@@ -16,9 +16,67 @@
 #include "common.h"
 #include <vector>
 
+#include <sys/types.h>
+
 namespace SANSYMTOOL_NS
 {
 
+// Bump allocator owning strings, so that all of them are freed at
+// once. Strings are packed into chunks, and the first chunk is kept by
+// Clear, so that refilling it allocates nothing.
+class StringArena {
+public:
+  StringArena() : used_(0) {}
+  ~StringArena();
+  StringArena(const StringArena &) = delete;
+  StringArena &operator=(const StringArena &) = delete;
+
+  // Returns a null-terminated copy of the |size| bytes at |str|.
+  char *Copy(const char *str, uptr size);
+  // Frees all the strings.
+  void Clear();
+
+private:
+  enum { kChunkSize = 16384 };
+
+  std::vector<char *> chunks_;
+  // Strings too large to be packed, each in its own block.
+  std::vector<char *> large_;
+  // Bytes taken in the last chunk.
+  uptr used_;
+};
+
+// Set of immutable strings, each kept once at a stable address until
+// the table is destroyed. Results of a target keep naming the same few
+// thousand functions and files, so interning them bounds the memory of
+// a long-running process by what its modules contain rather than by
+// how many requests it served, and equal names can be compared by
+// their pointers. Slots are probed linearly by a hash of the bytes.
+class StringTable {
+public:
+  StringTable() : size_(0) {}
+  StringTable(const StringTable &) = delete;
+  StringTable &operator=(const StringTable &) = delete;
+
+  // Returns the null-terminated string equal to the |size| bytes at
+  // |str|, copying them only the first time they are seen.
+  const char *Intern(const char *str, uptr size);
+  // Number of distinct strings.
+  uptr size() const { return size_; }
+
+private:
+  struct Slot {
+    const char *str; // nullptr if empty
+    uptr        size;
+    u64         hash;
+  };
+  void Grow();
+
+  StringArena       strings_;
+  std::vector<Slot> slots_;
+  uptr              size_;
+};
+
 // Advanced symbolizer can symbolize an address
 // as data or executable code respectively.
 // For now, DataInfo is used to describe global variable.
@@ -32,6 +90,9 @@ struct DataInfo {
   char *name;
   uptr  start;
   uptr  size;
+
+  // Interns the strings above if set, otherwise they are from malloc.
+  StringTable *strings;
 };
 
 // Advanced symbolizer can deal with inlined functions.
@@ -50,8 +111,18 @@ struct AddrInfo {
   ModuleArch module_arch;
 
   std::vector<FrameDat> frames;
+  // Interns the strings of frames if set, otherwise they are from malloc.
+  StringTable *strings = nullptr;
 };
 
+// Interns |str| for a result whose strings are kept by |strings|, or
+// copies it with malloc if that's nullptr. Gives nullptr for nullptr.
+// Interned strings are shared, so they must never be written.
+char *CopyResultString(StringTable *strings, const char *str);
+char *CopyResultString(StringTable *strings, const char *str, uptr size);
+// Frees a string given by CopyResultString, unless |strings| keeps it.
+void FreeResultString(StringTable *strings, char *str);
+
 // Base class for a symbolizer tool
 class SymbolizerTool {
 public:
@@ -68,6 +139,33 @@ public:
   // then we use the following methods to fill the remained fields.
   virtual bool SymbolizeData(DataInfo *info) { UNIMPLEMENTED(); }
   virtual bool SymbolizeAddr(AddrInfo *info) { UNIMPLEMENTED(); }
+
+  // Batched versions of the methods above. |infos| points to |n| structs
+  // pre-filled in the same way. By default they are symbolized one by one,
+  // but tools backed by SymbolizerProcess pipeline them instead.
+  // Return false if any of them failed.
+  virtual bool SymbolizeDataBatch(DataInfo *infos, uptr n);
+  virtual bool SymbolizeAddrBatch(AddrInfo *infos, uptr n);
+
+  // Completion-based requests, which never block the caller.
+  // A request tagged with |ticket| is queued by SubmitXXXX, then
+  // PollCompletion hands back one finished request if there is any.
+  // It sets |ticket| and |is_data|, fills |data| or |addr| accordingly,
+  // and sets |ok| to false if the request failed. GetCompletionFd gives
+  // an fd which stays readable while there may be something to poll,
+  // so it can be watched by the caller's own event loop.
+  // Tools not supporting this return false and kInvalidFd.
+  virtual fd_t GetCompletionFd() { return kInvalidFd; }
+  virtual bool SubmitData(const DataInfo &info, u64 ticket) { return false; }
+  virtual bool SubmitAddr(const AddrInfo &info, u64 ticket) { return false; }
+  virtual bool PollCompletion(u64 *ticket, bool *is_data, bool *ok,
+                              DataInfo *data, AddrInfo *addr) {
+    return false;
+  }
+
+  // True if the last blocking request failed because the
+  // symbolizer didn't answer before its deadline.
+  virtual bool LastRequestTimedOut() const { return false; }
   
   // Destroy all SymbolizerProcess related stuffs.
   // IT IS IRREVERSIBLE !!!
@@ -78,14 +176,104 @@ public:
   virtual void StopTheWorld() { UNIMPLEMENTED(); }
 };
 
+// Growable buffer holding output of a symbolizer. Unlike std::vector,
+// it doesn't initialize its spare capacity, so output can be read
+// straight into it at no cost beyond the read itself. The memory is
+// kept across requests and only grows, by doubling.
+class OutputBuffer {
+public:
+  OutputBuffer() : data_(nullptr), size_(0), capacity_(0) {}
+  ~OutputBuffer();
+  OutputBuffer(const OutputBuffer &) = delete;
+  OutputBuffer &operator=(const OutputBuffer &) = delete;
+
+  char *data() { return data_; }
+  const char *data() const { return data_; }
+  uptr size() const { return size_; }
+  uptr spare() const { return capacity_ - size_; }
+  char &operator[](uptr i) { return data_[i]; }
+  void clear() { size_ = 0; }
+
+  // Grows or shrinks to |size| bytes, new ones left uninitialized.
+  void resize(uptr size) {
+    reserve(size);
+    size_ = size;
+  }
+  void push_back(char c) {
+    if (size_ == capacity_)
+      reserve(size_ + 1);
+    data_[size_++] = c;
+  }
+  // Makes room for at least |size| bytes in total.
+  void reserve(uptr size);
+  // Marks |n| bytes written into the spare capacity as used.
+  void commit(uptr n) {
+    CHECK_LE(n, spare());
+    size_ += n;
+  }
+
+private:
+  char *data_;
+  uptr size_;
+  uptr capacity_;
+};
+
 // SymbolizerProcess encapsulates communication between the tool and
 // external symbolizer program, running in a different subprocess.
 // SymbolizerProcess may not be used from two threads simultaneously.
 class SymbolizerProcess {
 public:
-  explicit SymbolizerProcess(const char *path, bool use_posix_spawn = false);
+  // With a nonzero |timeout_ms|, a blocking request fails if the
+  // symbolizer takes longer than that to answer. The subprocess is
+  // then considered hung, it's restarted and the request isn't retried.
+  explicit SymbolizerProcess(const char *path, bool use_posix_spawn = false,
+                             u32 timeout_ms = 0);
   const char *SendCommand(const char *command);
 
+  // Pipelined version of SendCommand. All the |n| commands are written
+  // back to back (in windows small enough to never block on the pipe),
+  // and the responses are parsed out of the stream in order.
+  // On success |responses| receives |n| null-terminated strings,
+  // which stay valid until the next command is sent.
+  bool SendCommandBatch(const char *const *commands, uptr n,
+                        std::vector<const char *> *responses);
+
+  // Step-by-step form of SendCommandBatch, which lets a caller keep
+  // several symbolizers busy at the same time:
+  //   BeginBatch, then WriteBatchWindow and ReadBatchWindow in turn
+  //   until BatchDone, then FinishBatch.
+  // |commands| must stay alive until the batch is finished.
+  // Nothing is retried here. If any step fails, use SendCommandBatch.
+  bool BeginBatch(const char *const *commands, uptr n);
+  bool BatchDone() const { return batch_read_ == batch_size_; }
+  bool WriteBatchWindow();
+  bool ReadBatchWindow();
+  void FinishBatch(std::vector<const char *> *responses);
+
+  // True if the last blocking request, or the last step of a batch,
+  // failed for running out of time.
+  bool TimedOut() const { return timed_out_; }
+
+  // Non-blocking interface. StartAsync starts the subprocess if needed,
+  // without waiting for it to get ready, and switches its pipes to
+  // non-blocking mode, so once it is used, the blocking methods above
+  // must not be used anymore.
+  // AsyncWrite queues a command and writes as much as the pipe takes,
+  // the rest is written by later calls to AsyncFlush. AsyncRead takes
+  // everything available from the pipe. AsyncNextResponse returns the
+  // next complete response (valid until the next call) or nullptr.
+  // Failures mean the subprocess is gone and has to be restarted,
+  // which drops all the queued commands and buffered output.
+  bool StartAsync();
+  bool AsyncWrite(const char *command);
+  bool AsyncFlush();
+  bool AsyncWritePending() const { return !async_pending_.empty(); }
+  bool AsyncRead();
+  const char *AsyncNextResponse();
+  bool AsyncBuffered() const { return async_parsed_ < buffer_.size(); }
+  fd_t GetInputFd() const { return input_fd_; }
+  fd_t GetOutputFd() const { return output_fd_; }
+
   virtual ~SymbolizerProcess() {}
 
   /* Methods for controlling the subprocess */
@@ -102,10 +290,14 @@ protected:
   virtual bool StartSymbolizerSubprocess();
   virtual bool ReadFromSymbolizer();
 
-  std::vector<char> &GetBuff() { return buffer_; }
-
 private:
-  virtual bool ReachedEndOfOutput(const char *buffer, uptr length) const {
+  // Used to split a stream of responses. If a complete response sits at
+  // the beginning of |buffer|, return true, set |length| to the bytes it
+  // occupies and |content| to the length of its meaningful part.
+  // The first |scanned| bytes were given before with no end found,
+  // so only the bytes arrived since then need to be looked at.
+  virtual bool FindEndOfOutput(const char *buffer, uptr size, uptr scanned,
+                               uptr *content, uptr *length) const {
     UNIMPLEMENTED();
   }
 
@@ -115,8 +307,24 @@ private:
     UNIMPLEMENTED();
   }
 
+  /// Fill in a cheap command which the child process must answer
+  /// before it's considered ready. Leave it empty to just give the
+  /// child some time and check it's still running.
+  virtual void GetReadinessProbe(const char *path_to_binary,
+                                 char *buffer, uptr size) const {
+    buffer[0] = '\0';
+  }
+
   const char *SendCommandImpl(const char *command);
+  bool SendCommandBatchImpl(const char *const *commands, uptr n,
+                            std::vector<const char *> *responses);
+  void ResetBatch(const char *const *commands, uptr n);
+  void ResetAsync();
+  bool AppendFromSymbolizer();
   bool WriteToSymbolizer(const char *buffer, uptr length);
+  void StartDeadline();
+  bool WaitForIO(fd_t fd, bool for_write);
+  bool WaitUntilReady(const char *probe);
 
   //PID of current active symbolizer process, -1 for non
   proc_id_t active_pid_;
@@ -125,29 +333,68 @@ private:
   fd_t input_fd_;
   fd_t output_fd_;
 
-  std::vector<char> buffer_;
+  OutputBuffer buffer_;
+  // State of the batch in progress.
+  const char *const *batch_commands_;
+  uptr batch_size_;
+  uptr batch_written_;
+  uptr batch_read_;
+  uptr batch_parsed_;
+  uptr batch_scanned_;
+  std::vector<char> batch_buffer_;
+  std::vector<uptr> batch_spans_;
+  // State of the non-blocking mode.
+  bool async_;
+  std::vector<char> async_pending_;
+  uptr async_parsed_;
+  uptr async_scanned_;
+  std::vector<char> async_response_;
 
+  // Bytes of commands written at a time in SendCommandBatch.
+  // Not larger than PIPE_BUF, so a write into a pipe drained
+  // by the symbolizer never blocks while it's busy answering.
+  static const uptr kBatchWindowSize = 4096;
   static const uptr kMaxTimesRestarted = 5;
   static const int kSymbolizerStartupTimeMillis = 10;
+  static const int kSymbolizerReadyTimeoutMillis = 5000;
+  static const uptr kProbeBufferSize = 1024;
   uptr times_restarted_;
   bool failed_to_start_;
   bool reported_invalid_path_;
   bool use_posix_spawn_;
+  // Deadline of the response being waited for, by MonotonicNanoTime.
+  u32 timeout_ms_;
+  u64 deadline_;
+  bool timed_out_;
 };
 
+// Launching of symbolizer subprocesses, also timed by
+// tools/spawn-bench. Defined in symbolizer.cpp.
+pid_t StartSubprocess(const char *program, const char *const argv[],
+                      fd_t stdin_fd  = kInvalidFd,
+                      fd_t stdout_fd = kInvalidFd,
+                      fd_t stderr_fd = kInvalidFd);
+pid_t SpawnSubprocess(const char *program, const char *const argv[],
+                      fd_t stdin_fd  = kInvalidFd,
+                      fd_t stdout_fd = kInvalidFd,
+                      fd_t stderr_fd = kInvalidFd);
+int WaitForProcess(pid_t pid);
+
 // Used by LLVMSymbolizer, Addr2LinePool.
 // Although declared here for common usage,
-// it is defined in use_llvm_symbolizer.cpp
+// they are defined in use_llvm_symbolizer.cpp
 void ParseSymbolizeAddrOutput(const char *str, AddrInfo *res);
+void ParseSymbolizeDataOutput(const char *str, DataInfo *info);
 
 // Parsing helpers, 'str' is searched for delimiter(s) and a string or uptr
-// is extracted. When extracting a string, a newly allocated (using std::malloc)
-// and null-terminated buffer is returned. They return a pointer
-// to the next characted after the found delimiter.
-const char *ExtractToken             (const char *str, const char *delims,    char **result);
+// is extracted. When extracting a string, a null-terminated copy is
+// returned, interned by |strings| if it's given or newly allocated by
+// std::malloc otherwise. They return a pointer to the next characted after the found
+// delimiter.
+const char *ExtractToken             (const char *str, const char *delims,    char **result, StringTable *strings = nullptr);
 const char *ExtractInt               (const char *str, const char *delims,    int   *result);
 const char *ExtractUptr              (const char *str, const char *delims,    uptr  *result);
-const char *ExtractTokenUpToDelimiter(const char *str, const char *delimiter, char **result);
+const char *ExtractTokenUpToDelimiter(const char *str, const char *delimiter, char **result, StringTable *strings = nullptr);
 
 } // namespace SANSYMTOOL_NS
 
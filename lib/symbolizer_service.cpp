@@ -0,0 +1,289 @@
+//===-- symbolizer_service.cpp --------------------------------------------===//
+//
+// Based on the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file gives implementation of the shared symbolizer service.
+//===----------------------------------------------------------------------===//
+
+#include "symbolizer_service.h"
+
+#if SANITIZER_POSIX
+
+#include <sched.h>
+#include <unistd.h>
+#if SANITIZER_LINUX
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif // SANITIZER_LINUX
+
+#else // SANITIZER_POSIX
+#error ONLY SUPPORT POSIX NOW
+#endif // SANITIZER_POSIX
+
+namespace SANSYMTOOL_NS
+{
+
+enum { kWaiting = 0, kSleeping = 1, kDone = 2 };
+static const u32 kStopBit = 1U << 31;
+// Requests sent to the symbolizer at once at most.
+static const uptr kMaxBatch = 256;
+// Checks of a request before its caller goes to sleep, if there is
+// another CPU to serve it meanwhile.
+static const int kSpins = 256;
+
+// Sleeps while |*word| is |value|, though it may return earlier.
+static void FutexWait(std::atomic<u32> *word, u32 value) {
+#if SANITIZER_LINUX
+  syscall(SYS_futex, (u32 *)word, FUTEX_WAIT_PRIVATE, value, nullptr,
+          nullptr, 0);
+#else // SANITIZER_LINUX
+  (void)word;
+  (void)value;
+  sched_yield();
+#endif // SANITIZER_LINUX
+}
+
+static void FutexWake(std::atomic<u32> *word) {
+#if SANITIZER_LINUX
+  syscall(SYS_futex, (u32 *)word, FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr,
+          0);
+#else // SANITIZER_LINUX
+  (void)word;
+#endif // SANITIZER_LINUX
+}
+
+static inline void CpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#endif
+}
+
+SymbolizerService::SymbolizerService(SymbolizerTool *tool,
+                                     StringTable *strings,
+                                     Demangler *demangler)
+    : tool_(tool),
+      strings_(strings),
+      demangler_(demangler),
+      tail_(&stub_),
+      head_(&stub_),
+      pending_(0),
+      spins_(sysconf(_SC_NPROCESSORS_ONLN) > 1 ? kSpins : 0),
+      started_(false) {
+  CHECK(tool_ && strings_);
+  stub_.next.store(nullptr, std::memory_order_relaxed);
+}
+
+SymbolizerService::~SymbolizerService() {
+  if (!started_)
+    return;
+  pending_.fetch_or(kStopBit, std::memory_order_release);
+  FutexWake(&pending_);
+  pthread_join(thread_, nullptr);
+}
+
+bool SymbolizerService::Start() {
+  CHECK(!started_);
+  if (pthread_create(&thread_, nullptr, ThreadStart, this)) {
+    SAYSTH("WARNING: Can't start the symbolizer service thread\n");
+    return false;
+  }
+  started_ = true;
+  return true;
+}
+
+void SymbolizerService::Push(Request *request) {
+  request->next.store(nullptr, std::memory_order_relaxed);
+  Request *prev = tail_.exchange(request, std::memory_order_acq_rel);
+  // Until this store, the consumer sees the queue end at |prev|.
+  prev->next.store(request, std::memory_order_release);
+}
+
+SymbolizerService::Request *SymbolizerService::Pop() {
+  Request *head = head_;
+  Request *next = head->next.load(std::memory_order_acquire);
+  if (head == &stub_) {
+    if (!next)
+      return nullptr;
+    head_ = head = next;
+    next = next->next.load(std::memory_order_acquire);
+  }
+  if (next) {
+    head_ = next;
+    return head;
+  }
+  // |head| is the last one, which can only be taken once the stub is
+  // behind it, so that the queue is never left without a node.
+  if (head != tail_.load(std::memory_order_acquire))
+    return nullptr;
+  Push(&stub_);
+  next = head->next.load(std::memory_order_acquire);
+  if (next) {
+    head_ = next;
+    return head;
+  }
+  return nullptr;
+}
+
+bool SymbolizerService::SymbolizeAddr(AddrInfo *info, bool *timed_out) {
+  Request request;
+  request.addr = info;
+  request.data = nullptr;
+  return Run(&request, timed_out);
+}
+
+bool SymbolizerService::SymbolizeData(DataInfo *info, bool *timed_out) {
+  Request request;
+  request.addr = nullptr;
+  request.data = info;
+  return Run(&request, timed_out);
+}
+
+bool SymbolizerService::Run(Request *request, bool *timed_out) {
+  request->ok = false;
+  request->timed_out = false;
+  request->state.store(kWaiting, std::memory_order_relaxed);
+  Push(request);
+  if (pending_.fetch_add(1, std::memory_order_release) == 0)
+    FutexWake(&pending_);
+
+  // Spin a little before sleeping, since a request answered from
+  // memory comes back in about the time a sleep takes to start.
+  for (int i = 0; i < spins_; ++i) {
+    if (request->state.load(std::memory_order_acquire) == kDone)
+      break;
+    CpuRelax();
+  }
+  u32 state = kWaiting;
+  if (request->state.compare_exchange_strong(state, kSleeping,
+                                             std::memory_order_acquire)) {
+    while (request->state.load(std::memory_order_acquire) != kDone)
+      FutexWait(&request->state, kSleeping);
+  }
+  *timed_out = request->timed_out;
+  return request->ok;
+}
+
+void SymbolizerService::Complete(Request *request) {
+  // The caller may return and drop |request| as soon as it's done.
+  if (request->state.exchange(kDone, std::memory_order_acq_rel) == kSleeping)
+    FutexWake(&request->state);
+}
+
+void *SymbolizerService::ThreadStart(void *arg) {
+  ((SymbolizerService *)arg)->Loop();
+  return nullptr;
+}
+
+void SymbolizerService::Loop() {
+  std::vector<Request *> addrs, datas;
+  for (;;) {
+    u32 pending = pending_.load(std::memory_order_acquire);
+    if ((pending & ~kStopBit) == 0) {
+      if (pending & kStopBit)
+        return;
+      FutexWait(&pending_, pending);
+      continue;
+    }
+    addrs.clear();
+    datas.clear();
+    while (addrs.size() + datas.size() < kMaxBatch) {
+      Request *request = Pop();
+      if (!request)
+        break;
+      (request->addr ? addrs : datas).push_back(request);
+    }
+    uptr n = addrs.size() + datas.size();
+    if (n == 0) {
+      // A caller is between its exchange and its link.
+      sched_yield();
+      continue;
+    }
+    ServeAddrs(addrs.data(), addrs.size());
+    ServeDatas(datas.data(), datas.size());
+    // A caller's fetch_add comes after its Push, so a request may have
+    // been popped and served before it was counted. Then this takes
+    // |pending_| below zero, wrapping it around to the top bit for a
+    // moment, until the late fetch_add brings it back. Meanwhile the
+    // loop above sees a count that isn't 0, never a stop, since the
+    // stop bit is only set once no request is in flight, and at worst
+    // pops nothing and yields.
+    pending_.fetch_sub((u32)n, std::memory_order_release);
+  }
+}
+
+void SymbolizerService::ServeAddrs(Request **requests, uptr n) {
+  if (n == 0)
+    return;
+  std::vector<AddrInfo> infos(n);
+  for (uptr i = 0; i < n; ++i) {
+    infos[i].module        = requests[i]->addr->module;
+    infos[i].module_offset = requests[i]->addr->module_offset;
+    infos[i].module_arch   = requests[i]->addr->module_arch;
+    infos[i].strings       = strings_;
+  }
+  bool ok = tool_->SymbolizeAddrBatch(infos.data(), n);
+  bool timed_out = !ok && tool_->LastRequestTimedOut();
+  if (!ok && !timed_out) {
+    // The symbolizer broke, and is restarted by the next request, so
+    // the batch is sent once more as it is. Retrying each request
+    // alone would cost up to kMaxBatch round trips, and as many
+    // timeouts if it hangs, which is why a timeout isn't retried.
+    for (uptr i = 0; i < n; ++i)
+      infos[i].frames.clear();
+    ok = tool_->SymbolizeAddrBatch(infos.data(), n);
+    timed_out = !ok && tool_->LastRequestTimedOut();
+  }
+  for (uptr i = 0; i < n; ++i) {
+    Request *request = requests[i];
+    request->ok = ok;
+    request->timed_out = timed_out;
+    if (request->ok && demangler_) {
+      for (uptr j = 0; j < infos[i].frames.size(); ++j) {
+        char *&func = infos[i].frames[j].func;
+        if (func)
+          func = const_cast<char *>(demangler_->Demangle(func, strings_));
+      }
+    }
+    if (request->ok)
+      request->addr->frames.swap(infos[i].frames);
+    Complete(request);
+  }
+}
+
+void SymbolizerService::ServeDatas(Request **requests, uptr n) {
+  if (n == 0)
+    return;
+  std::vector<DataInfo> infos(n);
+  for (uptr i = 0; i < n; ++i) {
+    infos[i] = *requests[i]->data;
+    infos[i].strings = strings_;
+  }
+  bool ok = tool_->SymbolizeDataBatch(infos.data(), n);
+  bool timed_out = !ok && tool_->LastRequestTimedOut();
+  if (!ok && !timed_out) {
+    // See ServeAddrs.
+    for (uptr i = 0; i < n; ++i) {
+      infos[i] = *requests[i]->data;
+      infos[i].strings = strings_;
+    }
+    ok = tool_->SymbolizeDataBatch(infos.data(), n);
+    timed_out = !ok && tool_->LastRequestTimedOut();
+  }
+  for (uptr i = 0; i < n; ++i) {
+    Request *request = requests[i];
+    request->ok = ok;
+    request->timed_out = timed_out;
+    if (request->ok && demangler_ && infos[i].name)
+      infos[i].name =
+          const_cast<char *>(demangler_->Demangle(infos[i].name, strings_));
+    if (request->ok)
+      *request->data = infos[i];
+    Complete(request);
+  }
+}
+
+} // namespace SANSYMTOOL_NS
@@ -0,0 +1,109 @@
+//===-- symbolizer_service.h ----------------------------------------------===//
+//
+// Based on the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file declares a symbolizer shared by many threads, served by a
+// thread of its own.
+//===----------------------------------------------------------------------===//
+
+#ifndef SANSYMTOOL_HEAD_SYMBOLIZER_SERVICE_H
+#define SANSYMTOOL_HEAD_SYMBOLIZER_SERVICE_H
+
+#include "symbolizer.h"
+#include "demangle.h"
+
+#include <atomic>
+#include <vector>
+
+#if SANITIZER_POSIX
+#include <pthread.h>
+#else // SANITIZER_POSIX
+#error ONLY SUPPORT POSIX NOW
+#endif // SANITIZER_POSIX
+
+namespace SANSYMTOOL_NS
+{
+
+// Lets any number of threads symbolize through one tool at the same
+// time. A caller puts its request on a lock-free queue, which takes a
+// single atomic exchange, so callers never wait for each other. The
+// service thread takes all the requests queued while it was busy and
+// sends them as one batch, so the more callers there are, the fewer
+// round trips to the symbolizer each request costs. It then marks
+// each request done in the request itself, waking its caller only if
+// the caller went to sleep waiting for it.
+//
+// The tool, the string table and the demangler are only ever touched
+// by the service thread, so none of them has to be thread safe, and
+// the strings of results stay valid until the table is destroyed.
+class SymbolizerService {
+ public:
+  // Doesn't take ownership of anything, all of which must outlive
+  // the service. |demangler| is nullptr if names aren't demangled.
+  SymbolizerService(SymbolizerTool *tool, StringTable *strings,
+                    Demangler *demangler);
+  // Stops the service thread. No request may be in flight.
+  ~SymbolizerService();
+  SymbolizerService(const SymbolizerService &) = delete;
+  SymbolizerService &operator=(const SymbolizerService &) = delete;
+
+  // Starts the service thread, returns false if it can't.
+  bool Start();
+
+  // Same as SymbolizerTool's, and may be called from any thread.
+  // They block until the request is served. If it failed,
+  // |timed_out| tells whether the symbolizer didn't answer in time.
+  bool SymbolizeAddr(AddrInfo *info, bool *timed_out);
+  bool SymbolizeData(DataInfo *info, bool *timed_out);
+
+ private:
+  struct Request {
+    std::atomic<Request *> next;
+    AddrInfo *addr; // nullptr for data
+    DataInfo *data;
+    bool ok;
+    bool timed_out;
+    // kWaiting, kSleeping or kDone, and a futex word.
+    std::atomic<u32> state;
+  };
+
+  // Intrusive MPSC queue of Vyukov: producers exchange the tail and
+  // then link the old one to their node, while the single consumer
+  // follows the links from the head. A stub node keeps it never
+  // empty, so neither side needs a lock.
+  void Push(Request *request);
+  // Returns nullptr if nothing is queued, or if a push is halfway.
+  Request *Pop();
+  // Queues |request| and waits for it to be served.
+  bool Run(Request *request, bool *timed_out);
+
+  static void *ThreadStart(void *arg);
+  void Loop();
+  void ServeAddrs(Request **requests, uptr n);
+  void ServeDatas(Request **requests, uptr n);
+  void Complete(Request *request);
+
+  SymbolizerTool *tool_;
+  StringTable *strings_;
+  Demangler *demangler_;
+
+  Request stub_;
+  std::atomic<Request *> tail_;
+  Request *head_; // Only touched by the service thread.
+  // Requests queued but not served yet, and kStopBit once the
+  // service is stopping. The service thread sleeps on it at 0.
+  std::atomic<u32> pending_;
+  // Spinning only steals time from the service thread on one CPU.
+  int spins_;
+
+  pthread_t thread_;
+  bool started_;
+};
+
+} // namespace SANSYMTOOL_NS
+
+#endif // SANSYMTOOL_HEAD_SYMBOLIZER_SERVICE_H
@@ -20,8 +20,9 @@
 namespace SANSYMTOOL_NS
 {
 
-Addr2LineProcess::Addr2LineProcess(const char *path, const char *module_name) 
-  : SymbolizerProcess(path), module_name_(strdup(module_name)) {}
+Addr2LineProcess::Addr2LineProcess(const char *path, const char *module_name,
+                                   bool use_posix_spawn, u32 timeout_ms)
+  : SymbolizerProcess(path, use_posix_spawn, timeout_ms), module_name_(strdup(module_name)) {}
 
 char *Addr2LineProcess::module_name() const { return module_name_; }
 
@@ -37,9 +38,7 @@ void Addr2LineProcess::GetArgV(const char *path_to_binary,
   int i = 0;
   argv[i++] = path_to_binary;
 
-#if SANSYMTOOL_ADDR2LINE_DEMANGLE
-  argv[i++] = "-C";
-#endif
+  // Without -C, as names are demangled in process.
 #if SANSYMTOOL_ADDR2LINE_INLINES
   argv[i++] = "-i";
 #endif
@@ -49,45 +48,41 @@ void Addr2LineProcess::GetArgV(const char *path_to_binary,
   CHECK_LE(i, kArgVMax);
 }
 
+void Addr2LineProcess::GetReadinessProbe(const char *path_to_binary,
+                                         char *buffer, uptr size) const {
+  // Two dummy addresses make a response of two terminators,
+  // the same shape as an invalid offset.
+  std::snprintf(buffer, size, "0x%zx\n0x%zx\n",
+                dummy_address_, dummy_address_);
+}
+
 const char Addr2LineProcess::output_terminator_[] = "??\n??:0\n";
 
-bool Addr2LineProcess::ReachedEndOfOutput(const char *buffer,
-                                          uptr length) const {
+bool Addr2LineProcess::FindEndOfOutput(const char *buffer, uptr size,
+                                       uptr scanned, uptr *content,
+                                       uptr *length) const {
   const size_t kTerminatorLen = sizeof(output_terminator_) - 1;
-  // Skip, if we read just kTerminatorLen bytes, because Addr2Line output
-  // should consist at least of two pairs of lines:
+  // Addr2Line output should consist at least of two pairs of lines:
   // 1. First one, corresponding to given offset to be symbolized
   // (may be equal to output_terminator_, if offset is not valid).
   // 2. Second one for output_terminator_, itself to mark the end of output.
-  if (length <= kTerminatorLen) return false;
-  // Addr2Line output should end up with output_terminator_.
-  return !memcmp(buffer + length - kTerminatorLen,
-                          output_terminator_, kTerminatorLen);
-}
-
-bool Addr2LineProcess::ReadFromSymbolizer() {
-  if (!SymbolizerProcess::ReadFromSymbolizer())
-    return false;
-  auto &buff = GetBuff();
-  // We should cut out output_terminator_ at the end of given buffer,
-  // appended by addr2line to mark the end of its meaningful output.
-  // We cannot scan buffer from it's beginning, because it is legal for it
-  // to start with output_terminator_ in case given offset is invalid. So,
-  // scanning from second character.
-  char *garbage = strstr(buff.data() + 1, output_terminator_);
-  // This should never be NULL since buffer must end up with
-  // output_terminator_.
-  CHECK(garbage);
-
-  // Trim the buffer.
-  uintptr_t new_size = garbage - buff.data();
-  GetBuff().resize(new_size);
-  GetBuff().push_back('\0');
+  // So start from the second character, and the terminator is cut off
+  // from the content.
+  if (size <= kTerminatorLen) return false;
+  // A terminator may straddle what was scanned and what is new.
+  uptr from = scanned >= kTerminatorLen ? scanned - kTerminatorLen + 1 : 1;
+  const void *found = memmem(buffer + from, size - from,
+                             output_terminator_, kTerminatorLen);
+  if (!found) return false;
+  *content = (const char *)found - buffer;
+  *length = *content + kTerminatorLen;
   return true;
 }
 
-Addr2LinePool::Addr2LinePool(const char *addr2line_path)
-    : addr2line_path_(addr2line_path) {
+Addr2LinePool::Addr2LinePool(const char *addr2line_path,
+                             bool use_posix_spawn, u32 timeout_ms)
+    : addr2line_path_(addr2line_path), use_posix_spawn_(use_posix_spawn),
+      timeout_ms_(timeout_ms), last_timed_out_(false) {
     addr2line_pool_.reserve(SANSYMTOOL_ADDR2LINE_POOLMAX);
   }
 
@@ -113,7 +108,37 @@ void Addr2LinePool::FlushPool() {
 
 void Addr2LinePool::StopTheWorld() { FlushPool(); }
 
-const char *Addr2LinePool::SendCommand(const char *module_name, uptr module_offset) {
+bool Addr2LinePool::SymbolizeAddrBatch(AddrInfo *infos, uptr n) {
+  // One addr2line serves one module, so pipeline each
+  // run of requests targeting the same module.
+  last_timed_out_ = false;
+  uptr begin = 0;
+  while (begin < n) {
+    uptr end = begin + 1;
+    while (end < n && 0 == strcmp(infos[begin].module, infos[end].module))
+      ++end;
+    Addr2LineProcess *addr2line = GetProcess(infos[begin].module);
+    batch_commands_.resize((end - begin) * kBufferSize);
+    std::vector<const char *> commands(end - begin);
+    for (uptr i = begin; i < end; ++i) {
+      char *buffer = &batch_commands_[(i - begin) * kBufferSize];
+      std::snprintf(buffer, kBufferSize, "0x%zx\n0x%zx\n",
+                    infos[i].module_offset, Addr2LineProcess::dummy_address_);
+      commands[i - begin] = buffer;
+    }
+    if (!addr2line->SendCommandBatch(commands.data(), end - begin,
+                                     &batch_results_)) {
+      last_timed_out_ = addr2line->TimedOut();
+      return false;
+    }
+    for (uptr i = begin; i < end; ++i)
+      ParseSymbolizeAddrOutput(batch_results_[i - begin], &infos[i]);
+    begin = end;
+  }
+  return true;
+}
+
+Addr2LineProcess *Addr2LinePool::GetProcess(const char *module_name) {
   Addr2LineProcess *addr2line = 0;
   for (uptr i = 0; i < addr2line_pool_.size(); ++i) {
     if (0 ==
@@ -126,14 +151,22 @@ const char *Addr2LinePool::SendCommand(const char *module_name, uptr module_offs
     if (addr2line_pool_.size() >= SANSYMTOOL_ADDR2LINE_POOLMAX)
       { FlushPool(); } //if full, flush first.
     addr2line =
-        new Addr2LineProcess(addr2line_path_, module_name);
+        new Addr2LineProcess(addr2line_path_, module_name, use_posix_spawn_,
+                             timeout_ms_);
     addr2line_pool_.push_back(addr2line);
   }
   CHECK_EQ(0, strcmp(module_name, addr2line->module_name()));
+  return addr2line;
+}
+
+const char *Addr2LinePool::SendCommand(const char *module_name, uptr module_offset) {
+  Addr2LineProcess *addr2line = GetProcess(module_name);
   char buffer[kBufferSize];
   std::snprintf(buffer, kBufferSize, "0x%zx\n0x%zx\n",
-                    module_offset, dummy_address_);
-  return addr2line->SendCommand(buffer);
+                    module_offset, Addr2LineProcess::dummy_address_);
+  const char *res = addr2line->SendCommand(buffer);
+  last_timed_out_ = addr2line->TimedOut();
+  return res;
 }
 
 } // namespace SANSYMTOOL_NS
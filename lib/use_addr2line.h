@@ -24,19 +24,26 @@ namespace SANSYMTOOL_NS
 
 class Addr2LineProcess final : public SymbolizerProcess {
  public:
-  Addr2LineProcess(const char *path, const char *module_name);
+  Addr2LineProcess(const char *path, const char *module_name,
+                   bool use_posix_spawn = false, u32 timeout_ms = 0);
 
   char *module_name() const;
   // Free the strdup result with pointer set to 0 in case needed
   void module_name_free();
 
+  // addr2line answers it with output_terminator_.
+  static const uptr dummy_address_ =
+      FIRST_32_SECOND_64(UINT32_MAX, UINT64_MAX);
+
  private:
   void GetArgV(const char *path_to_binary,
                const char *(&argv)[kArgVMax]) const override;
 
-  bool ReachedEndOfOutput(const char *buffer, uptr length) const override;
+  void GetReadinessProbe(const char *path_to_binary,
+                         char *buffer, uptr size) const override;
 
-  bool ReadFromSymbolizer() override;
+  bool FindEndOfOutput(const char *buffer, uptr size, uptr scanned,
+                       uptr *content, uptr *length) const override;
 
   char *module_name_;  // Owned, leaked. Unless free with module_name_free
   static const char output_terminator_[];
@@ -44,18 +51,27 @@ class Addr2LineProcess final : public SymbolizerProcess {
 
 class Addr2LinePool final : public SymbolizerTool {
  public:
-  explicit Addr2LinePool(const char *addr2line_path);
+  explicit Addr2LinePool(const char *addr2line_path,
+                         bool use_posix_spawn = false, u32 timeout_ms = 0);
 
   bool SymbolizeData(DataInfo *info) override;
   bool SymbolizeAddr(AddrInfo *info) override;
 
+  bool SymbolizeAddrBatch(AddrInfo *infos, uptr n) override;
+
+  bool LastRequestTimedOut() const override { return last_timed_out_; }
+
   void StopTheWorld() override;
 
  private:
   const char *SendCommand(const char *module_name, uptr module_offset);
+  Addr2LineProcess *GetProcess(const char *module_name);
 
   static const uptr kBufferSize = 64;
   const char *addr2line_path_;
+  bool use_posix_spawn_;
+  u32 timeout_ms_;
+  bool last_timed_out_;
 
   // If there are many different module names,
   // we'll get many subprocesses running addr2line.
@@ -63,8 +79,8 @@ class Addr2LinePool final : public SymbolizerTool {
   void FlushPool();
   std::vector<Addr2LineProcess*> addr2line_pool_;
 
-  static const uptr dummy_address_ =
-      FIRST_32_SECOND_64(UINT32_MAX, UINT64_MAX);
+  std::vector<char> batch_commands_;
+  std::vector<const char *> batch_results_;
 };
 
 } // namespace SANSYMTOOL_NS
@@ -0,0 +1,144 @@
+//===-- use_llvm_library.cpp ----------------------------------------------===//
+//
+// Based on the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file gives implementation of the symbolizer tool calling LLVM's
+// DebugInfo/Symbolize library. The output of llvm-symbolizer is built in
+// llvm/tools/llvm-symbolizer/llvm-symbolizer.cpp and DIPrinter.cpp from
+// the very same calls, which is what the results here follow.
+//===----------------------------------------------------------------------===//
+
+#include "use_llvm_library.h"
+
+#if SANSYMTOOL_LLVM_SYMBOLIZE
+
+#include "llvm/Config/llvm-config.h"
+#include "llvm/DebugInfo/Symbolize/Symbolize.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+namespace SANSYMTOOL_NS
+{
+
+using llvm::symbolize::LLVMSymbolizer;
+
+// "module" or "module:arch", as llvm-symbolizer takes it.
+static std::string ModuleSpec(const char *module_name, ModuleArch arch) {
+  std::string spec(module_name);
+  if (arch != kModuleArchUnknown) {
+    spec += ':';
+    spec += ModuleArchToString(arch);
+  }
+  return spec;
+}
+
+// Unknown names are DILineInfo::BadString, which llvm-symbolizer
+// prints as "??", and which ParseSymbolizeAddrOutput turns into 0.
+static char *CopyName(StringTable *strings, const std::string &name) {
+  if (name == llvm::DILineInfo::BadString)
+    return nullptr;
+  return CopyResultString(strings, name.data(), name.size());
+}
+
+static void AppendFrame(const llvm::DILineInfo &line_info, AddrInfo *info) {
+  FrameDat frame;
+  frame.func = CopyName(info->strings, line_info.FunctionName);
+  frame.file = CopyName(info->strings, line_info.FileName);
+  frame.lin  = line_info.Line;
+  frame.col  = line_info.Column;
+  info->frames.push_back(frame);
+}
+
+LLVMLibrarySymbolizer::LLVMLibrarySymbolizer(const char *debug_dir) {
+  LLVMSymbolizer::Options opts;
+  // Names are demangled in process, only if the caller wants them.
+  opts.Demangle = false;
+  // The former is for build-id directories, the latter for debuglinks.
+  if (debug_dir && debug_dir[0]) {
+    opts.DebugFileDirectory.push_back(debug_dir);
+    opts.FallbackDebugPath = debug_dir;
+  }
+  symbolizer_ = new LLVMSymbolizer(opts);
+}
+
+LLVMLibrarySymbolizer::~LLVMLibrarySymbolizer() {
+  delete symbolizer_;
+}
+
+void LLVMLibrarySymbolizer::StopTheWorld() {
+  symbolizer_->flush();
+}
+
+// A module which can't be read gives a single unknown frame,
+// like llvm-symbolizer does after reporting the error.
+bool LLVMLibrarySymbolizer::SymbolizeAddr(AddrInfo *info) {
+  llvm::object::SectionedAddress offset = {
+      info->module_offset, llvm::object::SectionedAddress::UndefSection};
+  std::string module = ModuleSpec(info->module, info->module_arch);
+#if SANSYMTOOL_LLVMSYMBOLIZER_INLINES
+  llvm::Expected<llvm::DIInliningInfo> res =
+      symbolizer_->symbolizeInlinedCode(module, offset);
+  if (!res) {
+    llvm::consumeError(res.takeError());
+    AppendFrame(llvm::DILineInfo(), info);
+    return true;
+  }
+  if (res->getNumberOfFrames() == 0)
+    AppendFrame(llvm::DILineInfo(), info);
+  for (u32 i = 0; i < res->getNumberOfFrames(); ++i)
+    AppendFrame(res->getFrame(i), info);
+#else
+  llvm::Expected<llvm::DILineInfo> res =
+      symbolizer_->symbolizeCode(module, offset);
+  if (!res) {
+    llvm::consumeError(res.takeError());
+    AppendFrame(llvm::DILineInfo(), info);
+    return true;
+  }
+  AppendFrame(*res, info);
+#endif
+  return true;
+}
+
+bool LLVMLibrarySymbolizer::SymbolizeData(DataInfo *info) {
+  llvm::object::SectionedAddress offset = {
+      info->module_offset, llvm::object::SectionedAddress::UndefSection};
+  llvm::Expected<llvm::DIGlobal> res = symbolizer_->symbolizeData(
+      ModuleSpec(info->module, info->module_arch), offset);
+  if (!res) {
+    llvm::consumeError(res.takeError());
+    info->file  = nullptr;
+    info->line  = 0;
+    info->name  = nullptr;
+    info->start = 0;
+    info->size  = 0;
+    return true;
+  }
+  info->name  = CopyName(info->strings, res->Name);
+  info->start = res->Start;
+  info->size  = res->Size;
+#if LLVM_VERSION_MAJOR >= 15
+  // Where the variable is declared, from its DW_TAG_variable, which
+  // llvm-symbolizer prints as a third line.
+  info->file  = res->DeclFile.empty()
+                    ? nullptr
+                    : CopyResultString(info->strings, res->DeclFile.data(),
+                                       res->DeclFile.size());
+  info->line  = res->DeclLine;
+#else
+  // Neither the library nor llvm-symbolizer tell it before LLVM 15.
+  info->file  = nullptr;
+  info->line  = 0;
+#endif
+  return true;
+}
+
+} // namespace SANSYMTOOL_NS
+
+#endif // SANSYMTOOL_LLVM_SYMBOLIZE
@@ -0,0 +1,56 @@
+//===-- use_llvm_library.h ------------------------------------------------===//
+//
+// Based on the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file declares a symbolizer tool calling LLVM's DebugInfo/Symbolize
+// library in process. It's only built with SANSYMTOOL_LLVM_SYMBOLIZE.
+//===----------------------------------------------------------------------===//
+
+#ifndef SANSYMTOOL_HEAD_USE_LLVM_LIBRARY_H
+#define SANSYMTOOL_HEAD_USE_LLVM_LIBRARY_H
+
+#include "symbolizer.h"
+
+#if SANSYMTOOL_LLVM_SYMBOLIZE
+
+namespace llvm {
+namespace symbolize {
+class LLVMSymbolizer;
+} // namespace symbolize
+} // namespace llvm
+
+namespace SANSYMTOOL_NS
+{
+
+// Does what llvm-symbolizer does with the same options as
+// LLVMSymbolizerProcess, but through function calls into the
+// library instead of a subprocess, so there is nothing to fork,
+// pipe or parse. Results are the same as the ones parsed from
+// llvm-symbolizer of that LLVM version, which gives the file and
+// line where data is declared since LLVM 15. Only an unknown file
+// of data is 0 here rather than "??". Modules are kept open by the
+// library until StopTheWorld. Separate debug files are looked for
+// in |debug_dir|, which can be nullptr for the default.
+class LLVMLibrarySymbolizer final : public SymbolizerTool {
+ public:
+  explicit LLVMLibrarySymbolizer(const char *debug_dir);
+  ~LLVMLibrarySymbolizer() override;
+
+  bool SymbolizeData(DataInfo *info) override;
+  bool SymbolizeAddr(AddrInfo *info) override;
+
+  void StopTheWorld() override;
+
+ private:
+  llvm::symbolize::LLVMSymbolizer *symbolizer_;
+};
+
+} // namespace SANSYMTOOL_NS
+
+#endif // SANSYMTOOL_LLVM_SYMBOLIZE
+
+#endif // SANSYMTOOL_HEAD_USE_LLVM_LIBRARY_H
@@ -16,33 +16,48 @@
 #include <cstdlib>
 #include <cstring>
 
+#if SANITIZER_LINUX
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
+
 namespace SANSYMTOOL_NS
 {
 
 // Parse a <file>:<line>[:<column>] buffer. The file path may contain colons on
 // Windows, so extract tokens from the right hand side first. The column info is
-// also optional.
-static const char *ParseFileLineInfo(FrameDat *info, const char *str) {
-  char *file_line_info = nullptr;
-  str = ExtractToken(str, "\n", &file_line_info);
-  CHECK(file_line_info);
-
-  if (uptr size = std::strlen(file_line_info)) {
-    char *back = file_line_info + size - 1;
+// also optional. Only the file name is copied, interned by |strings| if given.
+static const char *ParseFileLineInfo(FrameDat *info, const char *str,
+                                     StringTable *strings) {
+  uptr size = std::strcspn(str, "\n");
+  const char *end = str + size;
+
+  if (size) {
+    const char *back = end - 1;
     for (int i = 0; i < 2; ++i) {
-      while (back > file_line_info && IsDigit(*back)) --back;
+      while (back > str && IsDigit(*back)) --back;
       if (*back != ':' || !IsDigit(back[1])) break;
       info->col = info->lin;
       info->lin = std::atoll(back + 1);
-      // Truncate the string at the colon to keep only filename.
-      *back = '\0';
+      // Drop the colon and what follows to keep only filename.
+      size = back - str;
       --back;
     }
-    ExtractToken(file_line_info, "", &info->file);
+    // addr2line (v2.34) can give "??:?" rather than "??", or
+    // "FileName:?" rather than "FileName", leaving *lin* 0.
+    // So must drop the ":?" as well.
+    if (0 == info->lin && size > 3 && str[size - 2] == ':' &&
+        str[size - 1] == '?')
+      size -= 2;
+    // File names can be "??", in which case we write 0
+    // instead to mark that names are unknown.
+    if (!(size == 2 && str[0] == '?' && str[1] == '?'))
+      info->file = CopyResultString(strings, str, size);
   }
 
-  std::free(file_line_info);
-  return str;
+  return *end != '\0' ? end + 1 : end;
 }
 
 // Parses one or more two-line strings in the following format:
@@ -52,17 +67,21 @@ static const char *ParseFileLineInfo(FrameDat *info, const char *str) {
 // use the same output format.
 void ParseSymbolizeAddrOutput(const char *str, AddrInfo *res) {
   while (true) {
-    char *function_name = nullptr;
-    str = ExtractToken(str, "\n", &function_name);
-    CHECK(function_name);
-    if (function_name[0] == '\0') {
+    uptr size = std::strcspn(str, "\n");
+    if (size == 0) {
       // There are no more frames.
-      free(function_name);
       break;
     }
     struct FrameDat ThisFrame;
-    ThisFrame.func = function_name;
-    // ParseFileLineInfo may leave *lin* and *col* untouched.
+    // Functions can be "??", in which case we write 0
+    // instead to mark that names are unknown.
+    if (size == 2 && str[0] == '?' && str[1] == '?')
+      ThisFrame.func = 0;
+    else
+      ThisFrame.func = CopyResultString(res->strings, str, size);
+    str += size;
+    if (*str != '\0') str++;
+    // ParseFileLineInfo may leave *lin*, *col* and *file* untouched.
     // e.g. addr2line (v2.34) can give
     //     FuncName
     //     ??:?
@@ -72,30 +91,10 @@ void ParseSymbolizeAddrOutput(const char *str, AddrInfo *res) {
     // both of which can make the for-loop break before 
     // setting *lin* and *col*.
     // So must init them as 0 to avoid reading uninitialized values.
+    ThisFrame.file = 0;
     ThisFrame.lin = 0;
     ThisFrame.col = 0;
-    str = ParseFileLineInfo(&ThisFrame, str);
-
-    // Functions and filenames can be "??", in which case 
-    // we write 0 instead to mark that names are unknown.
-    if (0 == std::strcmp(ThisFrame.func, "??")) {
-      std::free(ThisFrame.func);
-      ThisFrame.func = 0;
-    }
-    // In the case of addr2line mentioned above, file name
-    // will be recognized as "??:?" rather than "??", or
-    // "FileName:?" rather than "FileName".
-    // So we have more damn checks!
-    if (ThisFrame.file && 0 == ThisFrame.lin) {
-      char *wtf = ThisFrame.file;
-      uptr sz_ = std::strlen(ThisFrame.file);
-      if ((sz_ > 3) && (*(wtf+sz_-2) == ':') && (*(wtf+sz_-1) == '?'))
-        { *(wtf+sz_-2) = '\0'; }
-    }
-    if (ThisFrame.file && 0 == std::strcmp(ThisFrame.file, "??")) {
-      std::free(ThisFrame.file);
-      ThisFrame.file = 0;
-    }
+    str = ParseFileLineInfo(&ThisFrame, str, res->strings);
     res->frames.push_back(ThisFrame);
   }
 }
@@ -108,22 +107,33 @@ void ParseSymbolizeAddrOutput(const char *str, AddrInfo *res) {
 // for symbolizing the third line in D123538, 
 // but we support the older two-line information as well.
 void ParseSymbolizeDataOutput(const char *str, DataInfo *info) {
-  str = ExtractToken(str, "\n", &info->name);
+  str = ExtractToken(str, "\n", &info->name, info->strings);
   str = ExtractUptr(str, " ", &info->start);
   str = ExtractUptr(str, "\n", &info->size);
   // Note: If the third line isn't present, these calls will set info.{file,
   // line} to empty strings.
-  str = ExtractToken(str, ":", &info->file);
+  str = ExtractToken(str, ":", &info->file, info->strings);
   str = ExtractUptr(str, "\n", &info->line);
 }
 
-LLVMSymbolizerProcess::LLVMSymbolizerProcess(const char *path)
-    : SymbolizerProcess(path) {}
+LLVMSymbolizerProcess::LLVMSymbolizerProcess(const char *path,
+                                             bool use_posix_spawn,
+                                             u32 timeout_ms)
+    : SymbolizerProcess(path, use_posix_spawn, timeout_ms) {}
+
 
-bool LLVMSymbolizerProcess::ReachedEndOfOutput(const char *buffer, uptr length) const {
-  // Empty line marks the end of llvm-symbolizer output.
-  return length >= 2 && buffer[length - 1] == '\n' &&
-           buffer[length - 2] == '\n';
+bool LLVMSymbolizerProcess::FindEndOfOutput(const char *buffer, uptr size,
+                                            uptr scanned, uptr *content,
+                                            uptr *length) const {
+  // Empty line marks the end of llvm-symbolizer output. Keep it in
+  // the content, since ParseSymbolizeAddrOutput stops there.
+  for (uptr i = scanned > 1 ? scanned : 1; i < size; ++i) {
+    if (buffer[i] == '\n' && buffer[i - 1] == '\n') {
+      *content = *length = i + 1;
+      return true;
+    }
+  }
+  return false;
 }
 
 void LLVMSymbolizerProcess::GetArgV(const char *path_to_binary,
@@ -155,12 +165,6 @@ void LLVMSymbolizerProcess::GetArgV(const char *path_to_binary,
   const char* const kSymbolizerArch = "--default-arch=unknown";
 #endif
 
-#if SANSYMTOOL_LLVMSYMBOLIZER_DEMANGLE
-  const char *const demangle_flag = "--demangle";
-#else
-  const char *const demangle_flag = "--no-demangle";
-#endif
-
 #if SANSYMTOOL_LLVMSYMBOLIZER_INLINES
   const char *const inline_flag = "--inlines";
 #else
@@ -169,15 +173,52 @@ void LLVMSymbolizerProcess::GetArgV(const char *path_to_binary,
 
   int i = 0;
   argv[i++] = path_to_binary;
-  argv[i++] = demangle_flag;
+  // Names are demangled in process, only if the caller wants them.
+  argv[i++] = "--no-demangle";
   argv[i++] = inline_flag;
   argv[i++] = kSymbolizerArch;
   argv[i++] = nullptr;
   CHECK_LE(i, kArgVMax);
 }
 
-LLVMSymbolizer::LLVMSymbolizer(const char *path)
-    : symbolizer_process_(new LLVMSymbolizerProcess(path)) {}
+void LLVMSymbolizerProcess::GetReadinessProbe(const char *path_to_binary,
+                                              char *buffer, uptr size) const {
+  // Two empty lines are echoed as two empty lines, which is a
+  // complete response. Nothing is opened or parsed for them and
+  // nothing goes to stderr, unlike for any module named.
+  (void)path_to_binary;
+  std::snprintf(buffer, size, "\n\n");
+}
+
+LLVMSymbolizer::LLVMSymbolizer(const char *path, uptr n_shards,
+                               bool use_posix_spawn, u32 timeout_ms)
+    : last_timed_out_(false),
+      path_(path),
+      use_posix_spawn_(use_posix_spawn),
+      async_process_(nullptr),
+      async_failed_(0),
+      completion_fd_(kInvalidFd),
+      event_fd_(kInvalidFd),
+      event_signaled_(false),
+      watched_pid_(-1),
+      watching_output_(false) {
+  if (n_shards == 0)
+    n_shards = 1;
+  // Processes are started lazily on their first request.
+  for (uptr i = 0; i < n_shards; ++i)
+    shards_.push_back(new LLVMSymbolizerProcess(path, use_posix_spawn, timeout_ms));
+  shard_results_.resize(n_shards);
+}
+
+LLVMSymbolizerProcess *LLVMSymbolizer::ShardFor(const char *module_name) {
+  if (shards_.size() == 1)
+    return shards_[0];
+  // FNV-1a
+  u32 hash = 2166136261U;
+  for (const char *p = module_name; *p; ++p)
+    hash = (hash ^ (u8)*p) * 16777619U;
+  return shards_[hash % shards_.size()];
+}
 
 bool LLVMSymbolizer::SymbolizeAddr(AddrInfo *info) {
   const char *buf = FormatAndSendCommand(
@@ -197,35 +238,329 @@ bool LLVMSymbolizer::SymbolizeData(DataInfo *info) {
   return true;
 }
 
+bool LLVMSymbolizer::SymbolizeAddrBatch(AddrInfo *infos, uptr n) {
+  if (!FormatAndSendBatch("CODE", infos, n))
+    return false;
+  for (uptr i = 0; i < n; ++i)
+    ParseSymbolizeAddrOutput(batch_results_[i], &infos[i]);
+  return true;
+}
+
+bool LLVMSymbolizer::SymbolizeDataBatch(DataInfo *infos, uptr n) {
+  if (!FormatAndSendBatch("DATA", infos, n))
+    return false;
+  for (uptr i = 0; i < n; ++i)
+    ParseSymbolizeDataOutput(batch_results_[i], &infos[i]);
+  return true;
+}
+
 void LLVMSymbolizer::StopTheWorld() {
-  if (symbolizer_process_) {
-    symbolizer_process_->Kill();
-    delete symbolizer_process_;
-    symbolizer_process_ = nullptr;
+  for (uptr i = 0; i < shards_.size(); ++i) {
+    shards_[i]->Kill();
+    delete shards_[i];
+  }
+  shards_.clear();
+  if (async_process_) {
+    async_process_->Kill();
+    delete async_process_;
+    async_process_ = nullptr;
+  }
+  async_requests_.clear();
+  async_failed_ = 0;
+  if (completion_fd_ != kInvalidFd) {
+    CloseFile(completion_fd_);
+    completion_fd_ = kInvalidFd;
+  }
+  if (event_fd_ != kInvalidFd) {
+    CloseFile(event_fd_);
+    event_fd_ = kInvalidFd;
+  }
+}
+
+fd_t LLVMSymbolizer::GetCompletionFd() {
+#if SANITIZER_LINUX
+  if (completion_fd_ == kInvalidFd && !shards_.empty()) {
+    completion_fd_ = epoll_create1(EPOLL_CLOEXEC);
+    event_fd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (completion_fd_ < 0 || event_fd_ < 0) {
+      SAYSTH("WARNING: Can't create the completion fd");
+      std::fprintf(stderr, "(with errno %d)\n", errno);
+      if (completion_fd_ >= 0) CloseFile(completion_fd_);
+      if (event_fd_ >= 0) CloseFile(event_fd_);
+      completion_fd_ = event_fd_ = kInvalidFd;
+      return kInvalidFd;
+    }
+    struct epoll_event ev;
+    std::memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    epoll_ctl(completion_fd_, EPOLL_CTL_ADD, event_fd_, &ev);
+    event_signaled_ = false;
+    watched_pid_ = -1;
+    UpdateCompletionFd();
+    SignalCompletion(!async_requests_.empty());
+  }
+  return completion_fd_;
+#else
+  return kInvalidFd;
+#endif
+}
+
+bool LLVMSymbolizer::SubmitData(const DataInfo &info, u64 ticket) {
+  return Submit("DATA", info.module, info.module_offset, info.module_arch,
+                ticket, true);
+}
+
+bool LLVMSymbolizer::SubmitAddr(const AddrInfo &info, u64 ticket) {
+  return Submit("CODE", info.module, info.module_offset, info.module_arch,
+                ticket, false);
+}
+
+bool LLVMSymbolizer::Submit(const char *command_prefix, char *module_name,
+                            uptr module_offset, ModuleArch arch, u64 ticket,
+                            bool is_data) {
+  if (shards_.empty())
+    return false;
+  int size_needed = FormatCommand(buffer_, kBufferSize, command_prefix,
+                                  module_name, module_offset, arch);
+  if (size_needed >= static_cast<int>(kBufferSize)) {
+    SAYSTH("WARNING: Command buffer too small!\n");
+    return false;
+  }
+  if (!async_process_)
+    async_process_ = new LLVMSymbolizerProcess(path_, use_posix_spawn_);
+  // Requests already failed still wait to be polled,
+  // while the process is restarted for the new ones.
+  if (!async_process_->StartAsync())
+    return false;
+
+  AsyncRequest request = {ticket, is_data, module_name, module_offset, arch};
+  async_requests_.push_back(request);
+  if (!async_process_->AsyncWrite(buffer_))
+    FailAsyncRequests();
+  UpdateCompletionFd();
+  return true;
+}
+
+bool LLVMSymbolizer::PollCompletion(u64 *ticket, bool *is_data, bool *ok,
+                                    DataInfo *data, AddrInfo *addr) {
+  // Failed requests are all at the front, hand them back first.
+  const char *response = nullptr;
+  if (async_failed_ == 0 && !async_requests_.empty()) {
+    response = async_process_->AsyncNextResponse();
+    if (!response) {
+      if (!async_process_->AsyncFlush() || !async_process_->AsyncRead())
+        FailAsyncRequests();
+      else
+        response = async_process_->AsyncNextResponse();
+    }
+    UpdateCompletionFd();
+  }
+  if (!response && async_failed_ == 0) {
+    SignalCompletion(false);
+    return false;
+  }
+
+  // Responses always come in the order of requests.
+  AsyncRequest request = async_requests_.front();
+  async_requests_.pop_front();
+  *ticket = request.ticket;
+  *is_data = request.is_data;
+  *ok = response != nullptr;
+  if (response && request.is_data) {
+    data->module        = request.module;
+    data->module_offset = request.module_offset;
+    data->module_arch   = request.module_arch;
+    ParseSymbolizeDataOutput(response, data);
+  } else if (response) {
+    addr->module        = request.module;
+    addr->module_offset = request.module_offset;
+    addr->module_arch   = request.module_arch;
+    ParseSymbolizeAddrOutput(response, addr);
+  } else {
+    async_failed_--;
+  }
+  SignalCompletion(async_failed_ > 0 || async_process_->AsyncBuffered());
+  return true;
+}
+
+void LLVMSymbolizer::FailAsyncRequests() {
+  async_failed_ = async_requests_.size();
+  // Drop the process, the next request restarts it.
+  async_process_->Kill();
+  SignalCompletion(true);
+}
+
+void LLVMSymbolizer::UpdateCompletionFd() {
+#if SANITIZER_LINUX
+  if (completion_fd_ == kInvalidFd || !async_process_)
+    return;
+  // Closed fds of a dead process leave the epoll set by themselves.
+  proc_id_t pid = async_process_->GetPID();
+  if (pid == -1) {
+    watched_pid_ = -1;
+    return;
+  }
+  struct epoll_event ev;
+  std::memset(&ev, 0, sizeof(ev));
+  bool want_output = async_process_->AsyncWritePending();
+  if (pid != watched_pid_) {
+    ev.events = EPOLLIN;
+    epoll_ctl(completion_fd_, EPOLL_CTL_ADD, async_process_->GetInputFd(),
+              &ev);
+    watched_pid_ = pid;
+    watching_output_ = false;
   }
+  if (want_output != watching_output_) {
+    ev.events = EPOLLOUT;
+    epoll_ctl(completion_fd_, want_output ? EPOLL_CTL_ADD : EPOLL_CTL_DEL,
+              async_process_->GetOutputFd(), &ev);
+    watching_output_ = want_output;
+  }
+#endif
+}
+
+void LLVMSymbolizer::SignalCompletion(bool ready) {
+#if SANITIZER_LINUX
+  if (event_fd_ == kInvalidFd || ready == event_signaled_)
+    return;
+  u64 value = 1;
+  if (ready)
+    WriteToFile(event_fd_, &value, sizeof(value));
+  else
+    ReadFromFile(event_fd_, &value, sizeof(value));
+  event_signaled_ = ready;
+#endif
+}
+
+int LLVMSymbolizer::FormatCommand(char *buffer, uptr size,
+                                  const char *command_prefix,
+                                  const char *module_name, uptr module_offset,
+                                  ModuleArch arch) {
+  CHECK(module_name);
+  if (arch == kModuleArchUnknown)
+    return std::snprintf(buffer, size, "%s \"%s\" 0x%zx\n",
+                         command_prefix, module_name, module_offset);
+  return std::snprintf(buffer, size, "%s \"%s:%s\" 0x%zx\n",
+                       command_prefix, module_name,
+                       ModuleArchToString(arch), module_offset);
 }
 
 const char *LLVMSymbolizer::FormatAndSendCommand(const char *command_prefix,
                                                  const char *module_name,
                                                  uptr module_offset,
                                                  ModuleArch arch) {
-  CHECK(module_name);
-  int size_needed = 0;
-  if (arch == kModuleArchUnknown)
-    size_needed = std::snprintf(buffer_, kBufferSize, "%s \"%s\" 0x%zx\n",
-                                    command_prefix, module_name, module_offset);
-  else
-    size_needed = std::snprintf(buffer_, kBufferSize,
-                                    "%s \"%s:%s\" 0x%zx\n", command_prefix,
-                                    module_name, ModuleArchToString(arch),
-                                    module_offset);
+  last_timed_out_ = false;
+  int size_needed = FormatCommand(buffer_, kBufferSize, command_prefix,
+                                  module_name, module_offset, arch);
 
   if (size_needed >= static_cast<int>(kBufferSize)) {
     SAYSTH("WARNING: Command buffer too small!\n");
     return nullptr;
   }
 
-  return symbolizer_process_->SendCommand(buffer_);
+  if (shards_.empty())
+    return nullptr;
+  LLVMSymbolizerProcess *shard = ShardFor(module_name);
+  const char *res = shard->SendCommand(buffer_);
+  last_timed_out_ = shard->TimedOut();
+  return res;
+}
+
+template <typename InfoT>
+bool LLVMSymbolizer::FormatAndSendBatch(const char *command_prefix,
+                                        InfoT *infos, uptr n) {
+  last_timed_out_ = false;
+  if (shards_.empty())
+    return false;
+  if (n == 0) {
+    batch_results_.clear();
+    return true;
+  }
+  // Commands are stored back to back, each one null-terminated.
+  // Pointers are taken only after batch_commands_ stops growing.
+  batch_commands_.clear();
+  for (uptr i = 0; i < n; ++i) {
+    int size_needed = FormatCommand(buffer_, kBufferSize, command_prefix,
+                                    infos[i].module, infos[i].module_offset,
+                                    infos[i].module_arch);
+    if (size_needed >= static_cast<int>(kBufferSize)) {
+      SAYSTH("WARNING: Command buffer too small!\n");
+      return false;
+    }
+    batch_commands_.insert(batch_commands_.end(), buffer_,
+                           buffer_ + size_needed + 1);
+  }
+  std::vector<const char *> commands(n);
+  for (uptr i = 0, pos = 0; i < n; ++i) {
+    commands[i] = &batch_commands_[pos];
+    pos += std::strlen(commands[i]) + 1;
+  }
+  return SendBatchToShards(infos[0].module, commands.data(), n);
+}
+
+bool LLVMSymbolizer::SendBatchToShards(const char *module_name,
+                                       const char *const *commands, uptr n) {
+  uptr n_used = (n + kMinShardBatch - 1) / kMinShardBatch;
+  if (n_used > shards_.size())
+    n_used = shards_.size();
+  if (n_used <= 1) {
+    LLVMSymbolizerProcess *shard = ShardFor(module_name);
+    bool ok = shard->SendCommandBatch(commands, n, &batch_results_);
+    last_timed_out_ = shard->TimedOut();
+    return ok;
+  }
+
+  // Slice i covers commands [begin[i], begin[i + 1]).
+  std::vector<uptr> begin(n_used + 1);
+  std::vector<bool> ok(n_used);
+  for (uptr i = 0; i <= n_used; ++i)
+    begin[i] = n * i / n_used;
+  for (uptr i = 0; i < n_used; ++i)
+    ok[i] = shards_[i]->BeginBatch(commands + begin[i],
+                                   begin[i + 1] - begin[i]);
+
+  // Feed every shard a window before waiting for any of them,
+  // so that all the processes are working at the same time.
+  bool pending = true;
+  while (pending) {
+    pending = false;
+    for (uptr i = 0; i < n_used; ++i)
+      if (ok[i] && !shards_[i]->BatchDone())
+        ok[i] = shards_[i]->WriteBatchWindow();
+    for (uptr i = 0; i < n_used; ++i) {
+      if (ok[i] && !shards_[i]->BatchDone())
+        ok[i] = shards_[i]->ReadBatchWindow();
+      if (ok[i] && !shards_[i]->BatchDone())
+        pending = true;
+    }
+  }
+
+  // A hung shard is restarted, but its slice isn't retried.
+  for (uptr i = 0; i < n_used; ++i) {
+    if (!ok[i] && shards_[i]->TimedOut()) {
+      shards_[i]->Restart();
+      last_timed_out_ = true;
+    }
+  }
+  if (last_timed_out_)
+    return false;
+
+  batch_results_.resize(n);
+  for (uptr i = 0; i < n_used; ++i) {
+    std::vector<const char *> &results = shard_results_[i];
+    uptr count = begin[i + 1] - begin[i];
+    if (ok[i]) {
+      shards_[i]->FinishBatch(&results);
+    } else if (!shards_[i]->SendCommandBatch(commands + begin[i], count,
+                                             &results)) {
+      // SendCommandBatch has already restarted and retried this slice.
+      last_timed_out_ = shards_[i]->TimedOut();
+      return false;
+    }
+    for (uptr j = 0; j < count; ++j)
+      batch_results_[begin[i] + j] = results[j];
+  }
+  return true;
 }
 
 }
\ No newline at end of file
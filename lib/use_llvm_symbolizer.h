@@ -15,6 +15,8 @@
 
 #include "symbolizer.h"
 
+#include <deque>
+
 namespace SANSYMTOOL_NS
 {
 
@@ -31,32 +33,104 @@ namespace SANSYMTOOL_NS
 
 class LLVMSymbolizerProcess final : public SymbolizerProcess {
  public:
-  explicit LLVMSymbolizerProcess(const char *path);
+  explicit LLVMSymbolizerProcess(const char *path, bool use_posix_spawn = false,
+                                 u32 timeout_ms = 0);
 
  private:
-  bool ReachedEndOfOutput(const char *buffer, uptr length) const override;
+  bool FindEndOfOutput(const char *buffer, uptr size, uptr scanned,
+                       uptr *content, uptr *length) const override;
 
   void GetArgV(const char *path_to_binary,
                const char *(&argv)[kArgVMax]) const override;
+
+  void GetReadinessProbe(const char *path_to_binary,
+                         char *buffer, uptr size) const override;
 };
 
+// With more than one shard, LLVMSymbolizer runs a pool of
+// llvm-symbolizer processes. A single request always goes to
+// the shard picked by hashing the module name, so that each
+// process keeps its own modules warm. A batch is cut into
+// contiguous slices which are pipelined through all the
+// shards at the same time.
 class LLVMSymbolizer final : public SymbolizerTool {
  public:
-  explicit LLVMSymbolizer(const char *path);
+  explicit LLVMSymbolizer(const char *path, uptr n_shards = 1,
+                          bool use_posix_spawn = false, u32 timeout_ms = 0);
 
   bool SymbolizeData(DataInfo *info) override;
   bool SymbolizeAddr(AddrInfo *info) override;
 
+  bool SymbolizeDataBatch(DataInfo *infos, uptr n) override;
+  bool SymbolizeAddrBatch(AddrInfo *infos, uptr n) override;
+
+  fd_t GetCompletionFd() override;
+  bool SubmitData(const DataInfo &info, u64 ticket) override;
+  bool SubmitAddr(const AddrInfo &info, u64 ticket) override;
+  bool PollCompletion(u64 *ticket, bool *is_data, bool *ok,
+                      DataInfo *data, AddrInfo *addr) override;
+
+  bool LastRequestTimedOut() const override { return last_timed_out_; }
+
   void StopTheWorld() override;
 
  private:
   const char *FormatAndSendCommand(const char *command_prefix,
                                    const char *module_name, uptr module_offset,
                                    ModuleArch arch);
+  int FormatCommand(char *buffer, uptr size, const char *command_prefix,
+                    const char *module_name, uptr module_offset,
+                    ModuleArch arch);
 
-  LLVMSymbolizerProcess *symbolizer_process_;
+  // Format all the commands into batch_commands_ and send them together.
+  // Results are left in batch_results_.
+  template <typename InfoT>
+  bool FormatAndSendBatch(const char *command_prefix, InfoT *infos, uptr n);
+  bool SendBatchToShards(const char *module_name,
+                         const char *const *commands, uptr n);
+
+  LLVMSymbolizerProcess *ShardFor(const char *module_name);
+
+  std::vector<LLVMSymbolizerProcess *> shards_;
+  // Don't bother waking up another shard for less than this.
+  static const uptr kMinShardBatch = 64;
+  std::vector<std::vector<const char *>> shard_results_;
+  bool last_timed_out_;
+
+  // Completion-based requests go through a process of their own,
+  // since its pipes are non-blocking. On Linux, its pipes and an
+  // eventfd are watched by an epoll instance given to the caller.
+  // The eventfd keeps it readable while completions are ready but
+  // no more output is coming, e.g. after the process has died.
+  struct AsyncRequest {
+    u64        ticket;
+    bool       is_data;
+    char      *module;
+    uptr       module_offset;
+    ModuleArch module_arch;
+  };
+  bool Submit(const char *command_prefix, char *module_name,
+              uptr module_offset, ModuleArch arch, u64 ticket, bool is_data);
+  void FailAsyncRequests();
+  void UpdateCompletionFd();
+  void SignalCompletion(bool ready);
+
+  const char *path_;
+  bool use_posix_spawn_;
+  LLVMSymbolizerProcess *async_process_;
+  std::deque<AsyncRequest> async_requests_;
+  // Number of requests at the front of async_requests_ already failed.
+  uptr async_failed_;
+  fd_t completion_fd_;
+  fd_t event_fd_;
+  bool event_signaled_;
+  proc_id_t watched_pid_;
+  bool watching_output_;
   static const uptr kBufferSize = 16 * 1024;
   char buffer_[kBufferSize];
+
+  std::vector<char> batch_commands_;
+  std::vector<const char *> batch_results_;
 };
 
 } // namespace SANSYMTOOL_NS
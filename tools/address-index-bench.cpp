@@ -0,0 +1,175 @@
+//===-- address-index-bench.cpp -------------------------------------------===//
+//
+// Based on the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// Compares AddressIndex with std::upper_bound over the same addresses:
+//
+//   address-index-bench [-n lookups] [module...]
+//
+// The addresses are the symbol starts of each module given, such as
+// demo/*.bin, then synthetic tables from a thousand to a million
+// addresses. Each table is searched for the same random addresses
+// both ways, the answers are checked to agree, and the time taken per
+// lookup is printed. Exits with 1 if any answer differs.
+//===----------------------------------------------------------------------===//
+
+#include "address_index.h"
+#include "elf_file.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#if SANITIZER_POSIX
+
+#include <elf.h>
+#include <unistd.h>
+
+#else // SANITIZER_POSIX
+#error ONLY SUPPORT POSIX NOW
+#endif // SANITIZER_POSIX
+
+using namespace SANSYMTOOL_NS;
+
+namespace {
+
+void Usage() {
+  std::fprintf(stderr, "usage: address-index-bench [-n lookups] [module...]\n");
+  std::exit(2);
+}
+
+// xorshift64*, so that every run searches for the same addresses.
+u64 Random(u64 *state) {
+  *state ^= *state >> 12;
+  *state ^= *state << 25;
+  *state ^= *state >> 27;
+  return *state * 0x2545f4914f6cdd1dULL;
+}
+
+template <typename Sym>
+void ReadStarts(const ElfFile &elf, const ElfFile::Section &table,
+                std::vector<u64> *starts) {
+  const u8 *data = elf.SectionData(table);
+  if (!data || table.entsize != sizeof(Sym))
+    return;
+  for (uptr i = 0; i < table.size / sizeof(Sym); ++i) {
+    const Sym *sym = (const Sym *)(data + i * sizeof(Sym));
+    if (sym->st_shndx != SHN_UNDEF && sym->st_value)
+      starts->push_back(sym->st_value);
+  }
+}
+
+// Symbol starts of |path| from .symtab, or .dynsym without it.
+bool GetSymbolStarts(const char *path, std::vector<u64> *starts) {
+  ElfFile elf;
+  if (!elf.Open(path))
+    return false;
+  const ElfFile::Section *symtab = nullptr, *dynsym = nullptr;
+  for (uptr i = 0; i < elf.NumSections(); ++i) {
+    const ElfFile::Section &section = elf.GetSection(i);
+    if (section.type == SHT_SYMTAB)
+      symtab = &section;
+    else if (section.type == SHT_DYNSYM && !dynsym)
+      dynsym = &section;
+  }
+  const ElfFile::Section *table = symtab ? symtab : dynsym;
+  if (!table)
+    return false;
+  if (elf.is_64())
+    ReadStarts<Elf64_Sym>(elf, *table, starts);
+  else
+    ReadStarts<Elf32_Sym>(elf, *table, starts);
+  std::sort(starts->begin(), starts->end());
+  starts->erase(std::unique(starts->begin(), starts->end()), starts->end());
+  return !starts->empty();
+}
+
+// Functions of 16 to 1024 bytes, from where a PIE is loaded.
+void MakeStarts(uptr n, u64 *state, std::vector<u64> *starts) {
+  u64 address = 0x555555554000ULL;
+  for (uptr i = 0; i < n; ++i) {
+    starts->push_back(address);
+    address += 16 * (1 + Random(state) % 64);
+  }
+}
+
+// Returns false if the two searches disagree.
+bool Run(const char *name, const std::vector<u64> &starts, uptr n_lookups,
+         u64 *state) {
+  // From a bit before the first start to a bit after the last one.
+  u64 first = starts.front(), last = starts.back();
+  u64 span = last - first + 1;
+  std::vector<u64> lookups(n_lookups);
+  for (uptr i = 0; i < n_lookups; ++i)
+    lookups[i] = first - span / 16 + Random(state) % (span + span / 8);
+
+  AddressIndex index;
+  u64 start = MonotonicNanoTime();
+  index.Build(starts.data(), starts.size());
+  u64 build = MonotonicNanoTime() - start;
+
+  // Sums keep the searches from being optimized away.
+  uptr sum_binary = 0, sum_index = 0;
+  start = MonotonicNanoTime();
+  for (uptr i = 0; i < n_lookups; ++i)
+    sum_binary += std::upper_bound(starts.begin(), starts.end(), lookups[i]) -
+                  starts.begin();
+  u64 binary = MonotonicNanoTime() - start;
+  start = MonotonicNanoTime();
+  for (uptr i = 0; i < n_lookups; ++i)
+    sum_index += index.UpperBound(lookups[i]);
+  u64 indexed = MonotonicNanoTime() - start;
+
+  bool agree = sum_binary == sum_index;
+  for (uptr i = 0; i < n_lookups && agree; ++i)
+    agree = index.UpperBound(lookups[i]) ==
+            (uptr)(std::upper_bound(starts.begin(), starts.end(), lookups[i]) -
+                   starts.begin());
+  std::printf("%-40s %9zu %8.1f ms %8.1f ns %8.1f ns%s\n", name,
+              (size_t)starts.size(), build / 1e6, (double)binary / n_lookups,
+              (double)indexed / n_lookups, agree ? "" : "  MISMATCH");
+  return agree;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  uptr n_lookups = 1 << 22;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:")) != -1) {
+    if (opt == 'n')
+      n_lookups = std::strtoul(optarg, nullptr, 10);
+    else
+      Usage();
+  }
+  if (n_lookups == 0)
+    Usage();
+
+  std::printf("%-40s %9s %11s %11s %11s\n", "table", "addresses", "build",
+              "upper_bound", "index");
+  u64 state = 0x9e3779b97f4a7c15ULL;
+  bool ok = true;
+  for (int i = optind; i < argc; ++i) {
+    std::vector<u64> starts;
+    if (!GetSymbolStarts(argv[i], &starts)) {
+      std::fprintf(stderr, "address-index-bench: no symbols in %s\n",
+                   argv[i]);
+      continue;
+    }
+    ok &= Run(StripModuleName(argv[i]), starts, n_lookups, &state);
+  }
+  static const uptr kSizes[] = {1000, 10000, 100000, 1000000};
+  for (uptr i = 0; i < sizeof(kSizes) / sizeof(kSizes[0]); ++i) {
+    std::vector<u64> starts;
+    MakeStarts(kSizes[i], &state, &starts);
+    char name[64];
+    std::snprintf(name, sizeof(name), "synthetic-%zu", (size_t)kSizes[i]);
+    ok &= Run(name, starts, n_lookups, &state);
+  }
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,251 @@
+//===-- sansymtool-index.cpp ----------------------------------------------===//
+//
+// Based on the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// Symbolizes a module once and writes every answer out as an index file,
+// which IndexSymbolizer then serves without parsing anything:
+//
+//   sansymtool-index [-s symbolizer] [-j shards] [-d debug_dir] [-o output]
+//                    module
+//
+// Answers come from the symbol tables and DWARF of the module read in
+// process, or with -s from llvm-symbolizer or addr2line at that path,
+// with -j subprocesses for the former. Code is asked for in executable
+// sections, and data in the other allocated ones, only at the offsets
+// where ElfSymbolizer says the answer may change. The output defaults
+// to "<module>.ssti". A stripped module is read along with its separate
+// debug file, looked for in -d or the default directory.
+//===----------------------------------------------------------------------===//
+
+#include "elf_file.h"
+#include "elf_symbolizer.h"
+#include "symbol_index.h"
+#include "use_addr2line.h"
+#include "use_llvm_symbolizer.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#if SANITIZER_POSIX
+
+#include <elf.h>
+#include <unistd.h>
+
+#else // SANITIZER_POSIX
+#error ONLY SUPPORT POSIX NOW
+#endif // SANITIZER_POSIX
+
+using namespace SANSYMTOOL_NS;
+
+namespace {
+
+struct Range {
+  u64 start;
+  u64 end;
+};
+
+// Requests sent to the tool at once.
+const uptr kBatchSize = 4096;
+
+void Usage() {
+  std::fprintf(stderr, "usage: sansymtool-index [-s symbolizer] [-j shards] "
+                       "[-d debug_dir] [-o output] module\n");
+  std::exit(2);
+}
+
+// Allocated sections of |elf| which are executable or not, as sorted
+// ranges, with the ones touching each other merged.
+void GetSectionRanges(const ElfFile &elf, bool executable,
+                      std::vector<Range> *ranges) {
+  for (uptr i = 0; i < elf.NumSections(); ++i) {
+    const ElfFile::Section &section = elf.GetSection(i);
+    if (!(section.flags & SHF_ALLOC) || !section.addr || !section.size ||
+        !(section.flags & SHF_EXECINSTR) != !executable)
+      continue;
+    Range range = {section.addr, section.addr + section.size};
+    ranges->push_back(range);
+  }
+  std::sort(ranges->begin(), ranges->end(),
+            [](const Range &a, const Range &b) { return a.start < b.start; });
+  uptr kept = 0;
+  for (uptr i = 0; i < ranges->size(); ++i) {
+    Range &range = (*ranges)[i];
+    if (kept && range.start <= (*ranges)[kept - 1].end)
+      (*ranges)[kept - 1].end = std::max((*ranges)[kept - 1].end, range.end);
+    else
+      (*ranges)[kept++] = range;
+  }
+  ranges->resize(kept);
+}
+
+// The start of |range|, then every boundary within it.
+void GetOffsets(const Range &range, const std::vector<u64> &boundaries,
+                std::vector<u64> *offsets) {
+  offsets->clear();
+  offsets->push_back(range.start);
+  auto it = std::upper_bound(boundaries.begin(), boundaries.end(),
+                             range.start);
+  for (; it != boundaries.end() && *it < range.end; ++it)
+    offsets->push_back(*it);
+}
+
+// Without a subprocess, a failed batch only means some offsets have no
+// answer. Otherwise the symbolizer broke, and the index would be wrong.
+bool IndexCode(SymbolizerTool *tool, bool must_answer, char *module,
+               const std::vector<Range> &ranges,
+               const std::vector<u64> &boundaries, SymbolIndexWriter *writer) {
+  std::vector<u64> offsets;
+  std::vector<AddrInfo> infos;
+  for (uptr r = 0; r < ranges.size(); ++r) {
+    GetOffsets(ranges[r], boundaries, &offsets);
+    for (uptr first = 0; first < offsets.size(); first += kBatchSize) {
+      uptr n = std::min(kBatchSize, offsets.size() - first);
+      infos.clear();
+      infos.resize(n);
+      for (uptr i = 0; i < n; ++i) {
+        infos[i].module        = module;
+        infos[i].module_offset = offsets[first + i];
+        infos[i].module_arch   = kModuleArchUnknown;
+      }
+      if (!tool->SymbolizeAddrBatch(infos.data(), n) && must_answer)
+        return false;
+      for (uptr i = 0; i < n; ++i) {
+        std::vector<FrameDat> &frames = infos[i].frames;
+        writer->AddCode(offsets[first + i], frames.data(), frames.size());
+        for (uptr j = 0; j < frames.size(); ++j) {
+          std::free(frames[j].func);
+          std::free(frames[j].file);
+        }
+      }
+    }
+    writer->AddCode(ranges[r].end, nullptr, 0);
+  }
+  return true;
+}
+
+bool IndexData(SymbolizerTool *tool, bool must_answer, char *module,
+               const std::vector<Range> &ranges,
+               const std::vector<u64> &boundaries, SymbolIndexWriter *writer) {
+  std::vector<u64> offsets;
+  std::vector<DataInfo> infos;
+  for (uptr r = 0; r < ranges.size(); ++r) {
+    GetOffsets(ranges[r], boundaries, &offsets);
+    for (uptr first = 0; first < offsets.size(); first += kBatchSize) {
+      uptr n = std::min(kBatchSize, offsets.size() - first);
+      infos.resize(n);
+      std::memset(infos.data(), 0, n * sizeof(DataInfo));
+      for (uptr i = 0; i < n; ++i) {
+        infos[i].module        = module;
+        infos[i].module_offset = offsets[first + i];
+        infos[i].module_arch   = kModuleArchUnknown;
+      }
+      if (!tool->SymbolizeDataBatch(infos.data(), n) && must_answer)
+        return false;
+      for (uptr i = 0; i < n; ++i) {
+        writer->AddData(offsets[first + i], &infos[i]);
+        std::free(infos[i].name);
+        std::free(infos[i].file);
+      }
+    }
+    writer->AddData(ranges[r].end, nullptr);
+  }
+  return true;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  const char *symbolizer = nullptr;
+  const char *output = nullptr;
+  const char *debug_dir = nullptr;
+  uptr n_shards = 1;
+  int opt;
+  while ((opt = getopt(argc, argv, "s:j:d:o:")) != -1) {
+    switch (opt) {
+      case 's': symbolizer = optarg; break;
+      case 'j': n_shards = std::strtoul(optarg, nullptr, 10); break;
+      case 'd': debug_dir = optarg; break;
+      case 'o': output = optarg; break;
+      default: Usage();
+    }
+  }
+  if (optind + 1 != argc)
+    Usage();
+  char *module = argv[optind];
+  std::string path = output ? output : std::string(module) + kSymbolIndexSuffix;
+
+  ElfFile elf;
+  char identity[kSymbolIndexMaxIdentity];
+  if (!elf.Open(module) ||
+      !GetModuleIdentity(module, identity, sizeof(identity))) {
+    std::fprintf(stderr, "sansymtool-index: can't read %s\n", module);
+    return 1;
+  }
+
+  ElfSymbolizer *elf_symbolizer = new ElfSymbolizer(nullptr, debug_dir, nullptr);
+  std::vector<u64> boundaries;
+  if (!elf_symbolizer->GetBoundaries(module, &boundaries)) {
+    std::fprintf(stderr, "sansymtool-index: no symbols in %s\n", module);
+    delete elf_symbolizer;
+    return 1;
+  }
+  std::sort(boundaries.begin(), boundaries.end());
+  boundaries.erase(std::unique(boundaries.begin(), boundaries.end()),
+                   boundaries.end());
+
+  SymbolizerTool *tool = elf_symbolizer;
+  if (symbolizer) {
+    const char *name = StripModuleName(symbolizer);
+    static const char kLLVMSymbolizerPrefix[] = "llvm-symbolizer";
+    if (access(symbolizer, X_OK)) {
+      std::fprintf(stderr, "sansymtool-index: can't run %s\n", symbolizer);
+      delete elf_symbolizer;
+      return 1;
+    } else if (!std::strncmp(name, kLLVMSymbolizerPrefix,
+                             std::strlen(kLLVMSymbolizerPrefix))) {
+      tool = new LLVMSymbolizer(symbolizer, n_shards);
+    } else if (!std::strcmp(name, "addr2line")) {
+      tool = new Addr2LinePool(symbolizer);
+    } else {
+      std::fprintf(stderr, "sansymtool-index: unsupported symbolizer %s\n",
+                   symbolizer);
+      delete elf_symbolizer;
+      return 1;
+    }
+  }
+
+  std::vector<Range> code_ranges, data_ranges;
+  GetSectionRanges(elf, true, &code_ranges);
+  GetSectionRanges(elf, false, &data_ranges);
+  SymbolIndexWriter writer;
+  bool ok = IndexCode(tool, tool != elf_symbolizer, module, code_ranges,
+                      boundaries, &writer) &&
+            IndexData(tool, tool != elf_symbolizer, module, data_ranges,
+                      boundaries, &writer);
+  tool->StopTheWorld();
+  if (tool != elf_symbolizer)
+    delete tool;
+  delete elf_symbolizer;
+  if (!ok) {
+    std::fprintf(stderr, "sansymtool-index: %s failed\n", symbolizer);
+    return 1;
+  }
+  if (!writer.Write(path.c_str(), identity)) {
+    std::fprintf(stderr, "sansymtool-index: can't write %s\n", path.c_str());
+    return 1;
+  }
+  std::fprintf(stderr,
+               "%s: %zu code ranges, %zu data ranges, %zu chains, "
+               "%zu frames, %zu bytes of strings\n",
+               path.c_str(), (size_t)writer.NumCodeRanges(),
+               (size_t)writer.NumDataRanges(), (size_t)writer.NumChains(),
+               (size_t)writer.NumFrames(), (size_t)writer.StringsSize());
+  return 0;
+}
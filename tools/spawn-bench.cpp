@@ -0,0 +1,150 @@
+//===-- spawn-bench.cpp ---------------------------------------------------===//
+//
+// Based on the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// Times how long launching a symbolizer subprocess takes:
+//
+//   spawn-bench [-n launches] [-f nofile] [-m heap_mb] [program]
+//
+// Each launch starts |program| (/bin/true by default) with its stdin
+// and stdout on pipes, as symbolizers are started, and waits for it to
+// exit. It's done three ways:
+//   fork+loop     fork, closing every fd up to _SC_OPEN_MAX one by one,
+//                 which is how the child used to be set up
+//   fork          StartSubprocess, closing fds with close_range or
+//                 by walking /proc/self/fd
+//   posix_spawn   SpawnSubprocess
+// The nofile limit is raised to |nofile| first (as far as the hard
+// limit allows), since the loop costs one syscall per possible fd,
+// and |heap_mb| of memory is touched, since fork copies page tables.
+// The mean time per launch is printed.
+//===----------------------------------------------------------------------===//
+
+#include "symbolizer.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#if SANITIZER_POSIX
+
+#include <sys/resource.h>
+#include <unistd.h>
+
+#else // SANITIZER_POSIX
+#error ONLY SUPPORT POSIX NOW
+#endif // SANITIZER_POSIX
+
+using namespace SANSYMTOOL_NS;
+
+namespace {
+
+void Usage() {
+  std::fprintf(stderr, "usage: spawn-bench [-n launches] [-f nofile] "
+                       "[-m heap_mb] [program]\n");
+  std::exit(2);
+}
+
+// The child setup replaced by CloseFdsFrom, kept here to compare with.
+pid_t StartSubprocessLoop(const char *program, const char *const argv[],
+                          fd_t stdin_fd, fd_t stdout_fd) {
+  pid_t pid = fork();
+  if (pid == 0) {
+    dup2(stdin_fd, STDIN_FILENO);
+    dup2(stdout_fd, STDOUT_FILENO);
+    for (int fd = sysconf(_SC_OPEN_MAX); fd > 2; fd--)
+      close(fd);
+    execv(program, const_cast<char **>(&argv[0]));
+    _exit(1);
+  }
+  close(stdin_fd);
+  close(stdout_fd);
+  return pid;
+}
+
+enum Method { kForkLoop, kFork, kPosixSpawn };
+
+// Returns the mean nanoseconds per launch, or 0 if any failed.
+u64 Run(Method method, const char *program, uptr n_launches) {
+  const char *argv[] = {program, nullptr};
+  u64 total = 0;
+  for (uptr i = 0; i < n_launches; ++i) {
+    int infd[2], outfd[2];
+    if (pipe(infd) || pipe(outfd))
+      return 0;
+    u64 start = MonotonicNanoTime();
+    pid_t pid;
+    if (method == kForkLoop)
+      pid = StartSubprocessLoop(program, argv, outfd[0], infd[1]);
+    else if (method == kFork)
+      pid = StartSubprocess(program, argv, outfd[0], infd[1]);
+    else
+      pid = SpawnSubprocess(program, argv, outfd[0], infd[1]);
+    // Up to its exit, which takes the exec in, and all the fds
+    // closed before it.
+    int status = pid > 0 ? WaitForProcess(pid) : -1;
+    total += MonotonicNanoTime() - start;
+    close(infd[0]);
+    close(outfd[1]);
+    if (status != 0)
+      return 0;
+  }
+  return total / n_launches;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  uptr n_launches = 200;
+  rlim_t nofile = 1 << 20;
+  uptr heap_mb = 0;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:f:m:")) != -1) {
+    if (opt == 'n')
+      n_launches = std::strtoul(optarg, nullptr, 10);
+    else if (opt == 'f')
+      nofile = std::strtoul(optarg, nullptr, 10);
+    else if (opt == 'm')
+      heap_mb = std::strtoul(optarg, nullptr, 10);
+    else
+      Usage();
+  }
+  if (n_launches == 0 || optind + 1 < argc)
+    Usage();
+  const char *program = optind < argc ? argv[optind] : "/bin/true";
+
+  struct rlimit limit;
+  if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+    limit.rlim_cur = nofile < limit.rlim_max ? nofile : limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+  }
+  // Touched, so that there are pages to copy the tables of.
+  std::vector<char> heap(heap_mb << 20, 1);
+
+  std::printf("nofile %ld, heap %zu MB, %zu launches of %s\n",
+              sysconf(_SC_OPEN_MAX), (size_t)heap_mb, (size_t)n_launches,
+              program);
+  static const struct {
+    Method method;
+    const char *name;
+  } kMethods[] = {{kForkLoop, "fork+loop"},
+                  {kFork, "fork"},
+                  {kPosixSpawn, "posix_spawn"}};
+  bool ok = true;
+  for (uptr i = 0; i < sizeof(kMethods) / sizeof(kMethods[0]); ++i) {
+    u64 mean = Run(kMethods[i].method, program, n_launches);
+    if (!mean) {
+      std::fprintf(stderr, "spawn-bench: %s failed to run %s\n",
+                   kMethods[i].name, program);
+      ok = false;
+      continue;
+    }
+    std::printf("%-12s %9.3f ms\n", kMethods[i].name, mean / 1e6);
+  }
+  return ok ? 0 : 1;
+}
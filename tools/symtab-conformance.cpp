@@ -0,0 +1,295 @@
+//===-- symtab-conformance.cpp --------------------------------------------===//
+//
+// Based on the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// Checks use_elf_symtab against plain llvm-symbolizer:
+//
+//   symtab-conformance [-s symbolizer] [-k step] module...
+//
+// Every |step|-th byte (1 by default) of .text of each module is
+// symbolized as code, and of .data and .bss as data, once by a context
+// with use_elf_symtab and once by one without it, both running the
+// same llvm-symbolizer. Every frame of the two must be the same, with
+// the names left mangled. Mismatches are printed along with how many
+// offsets agree, and how long each context took from its creation,
+// i.e. with cold caches and the DWARF decoded on the way. Exits with 1
+// if anything differs. demo/big_symbol_conformance.sh runs it on the
+// demo binaries and on demo/big-symbol.cpp built a few more ways.
+//===----------------------------------------------------------------------===//
+
+#include "sanitizer_symbolizer_tool.h"
+#include "elf_file.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#if SANITIZER_POSIX
+
+#include <unistd.h>
+
+#else // SANITIZER_POSIX
+#error ONLY SUPPORT POSIX NOW
+#endif // SANITIZER_POSIX
+
+using namespace SANSYMTOOL_NS;
+
+namespace {
+
+// Same value as yes_send_done of RetCode in lib/interface.cpp.
+const int kSendDone = 2;
+const uptr kMaxReported = 10;
+
+void Usage() {
+  std::fprintf(stderr, "usage: symtab-conformance [-s symbolizer] "
+                       "[-k step] module...\n");
+  std::exit(2);
+}
+
+struct Frame {
+  const char *file;
+  const char *function;
+  unsigned long line;
+  unsigned long column;
+};
+
+struct Data {
+  const char *file;
+  const char *name;
+  unsigned long line;
+  unsigned long start;
+  unsigned long size;
+};
+
+bool SameString(const char *a, const char *b) {
+  return a == b || (a && b && 0 == std::strcmp(a, b));
+}
+
+const char *Or(const char *str) { return str ? str : "??"; }
+
+// llvm-symbolizer gives "\n" as the file of data when it has none,
+// see SanSymTool_data_read, where use_elf_symtab gives 0.
+bool SameDataFile(const char *a, const char *b) {
+  if (a && 0 == std::strcmp(a, "\n"))
+    a = nullptr;
+  if (b && 0 == std::strcmp(b, "\n"))
+    b = nullptr;
+  return SameString(a, b);
+}
+
+// Offsets of every |step|-th byte of the sections named.
+void GetOffsets(const ElfFile &elf, const char *const *names, uptr step,
+                std::vector<unsigned int> *offsets) {
+  for (; *names; ++names) {
+    const ElfFile::Section *section = elf.FindSection(*names);
+    if (!section || section->addr + section->size > ~0U)
+      continue;
+    for (u64 offset = section->addr; offset < section->addr + section->size;
+         offset += step)
+      offsets->push_back((unsigned int)offset);
+  }
+}
+
+// Makes a context with plain llvm-symbolizer or with use_elf_symtab.
+SanSymTool_ctx *Create(const char *symbolizer, int use_elf_symtab) {
+  struct SanSymTool_options opts;
+  std::memset(&opts, 0, sizeof(opts));
+  opts.use_elf_symtab = use_elf_symtab;
+  SanSymTool_ctx *ctx = nullptr;
+  SanSymTool_ctx_create(symbolizer, &opts, &ctx);
+  return ctx;
+}
+
+// Symbolizes |offsets| as code in a new context, filling |frames| and
+// where the frames of each offset start. Their strings stay valid until
+// |ctx| is destroyed. Returns the nanoseconds taken, or 0 if it failed.
+u64 RunCode(const char *symbolizer, int use_elf_symtab, char *module,
+            const std::vector<unsigned int> &offsets, SanSymTool_ctx **ctx,
+            std::vector<Frame> *frames, std::vector<uptr> *first) {
+  u64 start = MonotonicNanoTime();
+  *ctx = Create(symbolizer, use_elf_symtab);
+  if (!*ctx)
+    return 0;
+  std::vector<unsigned long> n_frames(offsets.size());
+  int ret = SanSymTool_ctx_addr_send_batch(*ctx, module, offsets.data(),
+                                           offsets.size(), n_frames.data());
+  u64 took = MonotonicNanoTime() - start;
+  if (ret == kSendDone) {
+    uptr idx = 0;
+    for (uptr i = 0; i < offsets.size(); ++i) {
+      first->push_back(frames->size());
+      for (unsigned long j = 0; j < n_frames[i]; ++j, ++idx) {
+        Frame frame;
+        char *file, *function;
+        SanSymTool_ctx_addr_read(*ctx, idx, &file, &function, &frame.line,
+                                 &frame.column);
+        frame.file = file;
+        frame.function = function;
+        frames->push_back(frame);
+      }
+    }
+    first->push_back(frames->size());
+  }
+  return ret == kSendDone ? (took ? took : 1) : 0;
+}
+
+u64 RunData(const char *symbolizer, int use_elf_symtab, char *module,
+            const std::vector<unsigned int> &offsets, SanSymTool_ctx **ctx,
+            std::vector<Data> *datas) {
+  u64 start = MonotonicNanoTime();
+  *ctx = Create(symbolizer, use_elf_symtab);
+  if (!*ctx)
+    return 0;
+  int ret = SanSymTool_ctx_data_send_batch(*ctx, module, offsets.data(),
+                                           offsets.size());
+  u64 took = MonotonicNanoTime() - start;
+  for (uptr i = 0; ret == kSendDone && i < offsets.size(); ++i) {
+    Data data;
+    char *file, *name;
+    SanSymTool_ctx_data_read_at(*ctx, i, &file, &name, &data.line,
+                                &data.start, &data.size);
+    data.file = file;
+    data.name = name;
+    datas->push_back(data);
+  }
+  return ret == kSendDone ? (took ? took : 1) : 0;
+}
+
+bool SameFrames(const std::vector<Frame> &a, uptr a_begin, uptr a_end,
+                const std::vector<Frame> &b, uptr b_begin, uptr b_end) {
+  if (a_end - a_begin != b_end - b_begin)
+    return false;
+  for (uptr i = 0; i < a_end - a_begin; ++i) {
+    const Frame &x = a[a_begin + i], &y = b[b_begin + i];
+    if (!SameString(x.file, y.file) || !SameString(x.function, y.function) ||
+        x.line != y.line || x.column != y.column)
+      return false;
+  }
+  return true;
+}
+
+void PrintFrames(const char *tag, const std::vector<Frame> &frames,
+                 uptr begin, uptr end) {
+  for (uptr i = begin; i < end; ++i)
+    std::printf("    %s %s %s:%lu:%lu\n", tag, Or(frames[i].function),
+                Or(frames[i].file), frames[i].line, frames[i].column);
+}
+
+// Returns false if the two contexts disagree or either failed.
+bool CheckCode(const char *symbolizer, char *module, const ElfFile &elf,
+               uptr step) {
+  static const char *const kSections[] = {".text", nullptr};
+  std::vector<unsigned int> offsets;
+  GetOffsets(elf, kSections, step, &offsets);
+  if (offsets.empty())
+    return true;
+  SanSymTool_ctx *ctx[2];
+  std::vector<Frame> frames[2];
+  std::vector<uptr> first[2];
+  u64 took[2];
+  for (int i = 0; i < 2; ++i)
+    took[i] = RunCode(symbolizer, i, module, offsets, &ctx[i], &frames[i],
+                      &first[i]);
+  if (!took[0] || !took[1]) {
+    std::printf("%s: code FAILED\n", module);
+    SanSymTool_ctx_destroy(ctx[0]);
+    SanSymTool_ctx_destroy(ctx[1]);
+    return false;
+  }
+  uptr same = 0;
+  for (uptr i = 0; i < offsets.size(); ++i) {
+    if (SameFrames(frames[0], first[0][i], first[0][i + 1], frames[1],
+                   first[1][i], first[1][i + 1])) {
+      ++same;
+    } else if (i - same < kMaxReported) {
+      std::printf("  0x%x differs\n", offsets[i]);
+      PrintFrames("llvm-symbolizer", frames[0], first[0][i], first[0][i + 1]);
+      PrintFrames("use_elf_symtab ", frames[1], first[1][i], first[1][i + 1]);
+    }
+  }
+  std::printf("%s: code %zu/%zu identical, llvm-symbolizer %.1f ms, "
+              "use_elf_symtab %.1f ms\n",
+              module, (size_t)same, (size_t)offsets.size(), took[0] / 1e6,
+              took[1] / 1e6);
+  SanSymTool_ctx_destroy(ctx[0]);
+  SanSymTool_ctx_destroy(ctx[1]);
+  return same == offsets.size();
+}
+
+bool CheckData(const char *symbolizer, char *module, const ElfFile &elf,
+               uptr step) {
+  static const char *const kSections[] = {".data", ".bss", nullptr};
+  std::vector<unsigned int> offsets;
+  GetOffsets(elf, kSections, step, &offsets);
+  if (offsets.empty())
+    return true;
+  SanSymTool_ctx *ctx[2];
+  std::vector<Data> datas[2];
+  u64 took[2];
+  for (int i = 0; i < 2; ++i)
+    took[i] = RunData(symbolizer, i, module, offsets, &ctx[i], &datas[i]);
+  if (!took[0] || !took[1]) {
+    std::printf("%s: data FAILED\n", module);
+    SanSymTool_ctx_destroy(ctx[0]);
+    SanSymTool_ctx_destroy(ctx[1]);
+    return false;
+  }
+  uptr same = 0;
+  for (uptr i = 0; i < offsets.size(); ++i) {
+    const Data &x = datas[0][i], &y = datas[1][i];
+    if (SameDataFile(x.file, y.file) && SameString(x.name, y.name) &&
+        x.line == y.line && x.start == y.start && x.size == y.size) {
+      ++same;
+    } else if (i - same < kMaxReported) {
+      std::printf("  0x%x differs\n", offsets[i]);
+      std::printf("    llvm-symbolizer %s %s:%lu 0x%lx %lu\n", Or(x.name),
+                  SameDataFile(x.file, nullptr) ? "??" : x.file, x.line,
+                  x.start, x.size);
+      std::printf("    use_elf_symtab  %s %s:%lu 0x%lx %lu\n", Or(y.name),
+                  Or(y.file), y.line, y.start, y.size);
+    }
+  }
+  std::printf("%s: data %zu/%zu identical, llvm-symbolizer %.1f ms, "
+              "use_elf_symtab %.1f ms\n",
+              module, (size_t)same, (size_t)offsets.size(), took[0] / 1e6,
+              took[1] / 1e6);
+  SanSymTool_ctx_destroy(ctx[0]);
+  SanSymTool_ctx_destroy(ctx[1]);
+  return same == offsets.size();
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  const char *symbolizer = "/usr/bin/llvm-symbolizer";
+  uptr step = 1;
+  int opt;
+  while ((opt = getopt(argc, argv, "s:k:")) != -1) {
+    if (opt == 's')
+      symbolizer = optarg;
+    else if (opt == 'k')
+      step = std::strtoul(optarg, nullptr, 10);
+    else
+      Usage();
+  }
+  if (step == 0 || optind == argc)
+    Usage();
+
+  bool ok = true;
+  for (int i = optind; i < argc; ++i) {
+    ElfFile elf;
+    if (!elf.Open(argv[i])) {
+      std::fprintf(stderr, "symtab-conformance: can't read %s\n", argv[i]);
+      ok = false;
+      continue;
+    }
+    ok &= CheckCode(symbolizer, argv[i], elf, step);
+    ok &= CheckData(symbolizer, argv[i], elf, step);
+  }
+  return ok ? 0 : 1;
+}